@@ -7,22 +7,46 @@
  * Created: September 30, 2015
  *
  * Description:
- * Periodically checks the message queue to see if there is a command
- * specific for itself sent by the Controller. It reads any messages
- * and triggers a motion/action and sends a response back to the
- * Controller immediately after the operation.
+ * Blocks on the message queue until the Controller sends it a command,
+ * then triggers a motion/action and sends a response back to the
+ * Controller immediately after the operation. With -r, it waits at
+ * least a minimum interval after each command before taking the next
+ * one. With -c, identical commands already queued behind the one just
+ * carried out are acknowledged without being carried out again. SIGINT
+ * or SIGTERM ends any wait, and the Actuator deregisters and exits.
  *
  */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <signal.h>
 
-#include <sys/time.h>
 #include <sys/msg.h>
 
 #include "message_queue.h"
+#include "timestamp.h"
+#include "stats.h"
+#include "transport.h"
+
+// Latencies seen by this Actuator, in nanoseconds. The hops of a
+// command caused by a reading add up to the Sensor to Actuator time.
+struct latency_stats
+{
+    struct stats_histogram sensor_to_actuator;
+    struct stats_histogram sensor_to_controller;    // Reading taken to Controller receipt
+    struct stats_histogram in_controller;           // Controller receipt to command sent
+    struct stats_histogram command_to_ack;          // Command sent to ack sent
+};
+
+void acknowledge(struct transport *transport, pid_t pid,
+        const struct message_struct *command, struct latency_stats *stats);
+int wait_until(long long deadline);
+void program_done(int signal_number);
+
+sig_atomic_t g_program_done_flag = 0;
 
 int main(int argc, char* argv[])
 {
@@ -30,115 +54,284 @@ int main(int argc, char* argv[])
     int msgid;
 
     char *name;
+    int transport_kind = TRANSPORT_MSGQUEUE;
+    int dedicated_queue = 0;
+    int reply_msgid = REPLY_SHARED_QUEUE;
+    int min_interval_ms = 0;
+    int coalesce = 0;
+    int option;
 
-    int running = 1;
-    struct timeval t1, t2;
+    struct transport transport;
+    static struct latency_stats stats;
+    long long executed = 0;
+    long long coalesced = 0;
+    int have_message = 0;
 
     struct message_struct tx_data;
     struct message_struct rx_data;
-    int tx_data_size = sizeof(struct message_struct) - sizeof(long);
-    int rx_data_size = sizeof(struct message_struct) - sizeof(long);
+    struct message_struct next_data;
+    struct sigaction sa;
 
-    if (argc < 2)
+    while ((option = getopt(argc, argv, "Qcr:t:")) != -1)
     {
-        fprintf(stderr, "Usage: actuator NAME\n");
+        switch (option)
+        {
+        case 'Q':
+            dedicated_queue = 1;
+            break;
+        case 'c':
+            coalesce = 1;
+            break;
+        case 'r':
+            min_interval_ms = atoi(optarg);
+            break;
+        case 't':
+            transport_kind = transport_parse(optarg);
+            if (transport_kind != -1)
+            {
+                break;
+            }
+            // Fall through
+        default:
+            fprintf(stderr, "Usage: actuator [-Q] [-c] [-r MIN_INTERVAL_MS] [-t msgqueue|shm] NAME\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 1)
+    {
+        fprintf(stderr, "Usage: actuator [-Q] [-c] [-r MIN_INTERVAL_MS] [-t msgqueue|shm] NAME\n");
         exit(EXIT_FAILURE);
     }
 
-    name = argv[1];
+    name = argv[optind];
+
+    if (min_interval_ms < 0)
+    {
+        fprintf(stderr, "MIN_INTERVAL_MS(%d) must not be negative\n", min_interval_ms);
+        exit(EXIT_FAILURE);
+    }
 
     printf("Device starting. PID=%d\n", pid);
 
-    // Creates a message queue
-    msgid = msgget((key_t)MESSAGE_QUEUE_ID, 0666 | IPC_CREAT);
-    if (msgid == -1)
+    // Opens the message queue and, if selected, attaches to the
+    // Controller's shared memory ring
+    if (transport_open(&transport, transport_kind, (key_t)MESSAGE_QUEUE_ID,
+                SHM_RING_NAME, 0) == -1)
     {
-        fprintf(stderr, "msgget failed with error: %d\n", errno);
+        fprintf(stderr, "transport_open failed with error: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    msgid = transport.msgid;
+
+    // With a queue of its own, the device's receives do not have to
+    // skip over messages addressed to other devices
+    if (dedicated_queue)
+    {
+        msgid = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+        if (msgid == -1)
+        {
+            fprintf(stderr, "msgget failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        reply_msgid = msgid;
+    }
 
     // Initial message to send
-    memset((void *)&tx_data, 0, sizeof(tx_data));
-    tx_data.type = TO_CONTROLLER;
-    strncpy(tx_data.fields.name, name, sizeof(tx_data.fields.name));
-    tx_data.fields.device_type = DEVICE_TYPE_ACTUATOR;
-    tx_data.fields.pid = pid;
+    message_register(&tx_data, pid, DEVICE_TYPE_ACTUATOR, 0, reply_msgid, name);
 
     // Send initial message to controller
     printf("Attempting to establish connection with Controller...\n");
-    if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+    if (transport_send(&transport, &tx_data) == -1)
     {
         fprintf(stderr, "msgsnd failed\n");
         exit(EXIT_FAILURE);
     }
 
     // Receive acknowledgement message from controller
-    if (msgrcv(msgid, (void *)&rx_data, rx_data_size,
-                pid, 0) == -1)
+    if (message_receive(msgid, &rx_data, pid, 0) == -1)
     {
         fprintf(stderr, "msgrcv failed with error: %d\n", errno);
         exit(EXIT_FAILURE);
     }
 
     // Check if the message received is an ack
-    if (strncmp(rx_data.fields.data, "ack", 3) != 0)
+    if (rx_data.header.kind != MESSAGE_ACK)
     {
         fprintf(stderr, "Expected ack message but received non-ack message\n");
         exit(EXIT_FAILURE);
     }
     printf("Received ack message from Controller. Connection establish.\n");
 
-    // Make note of current time
-    gettimeofday(&t1, NULL);
-    while (running)
-    {
-        // Get current time
-        gettimeofday(&t2, NULL);
+    // Deregister from the controller when interrupted. SA_RESTART is
+    // left unset so that the signal interrupts the blocking msgrcv.
+    memset((void *)&sa, 0, sizeof(sa));
+    sa.sa_handler = &program_done;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
 
-        // Compare current time to previously noted time and enter block
-        // if the time difference is greater or equal than 1 second
-        if ((t2.tv_sec - t1.tv_sec) >= 1)
+    // Commands are executed as soon as they arrive. With a minimum
+    // interval, the Actuator waits after each command before taking
+    // the next one. With coalescing, identical commands that are
+    // already queued behind the one executed are acknowledged without
+    // being executed again.
+    while (!g_program_done_flag)
+    {
+        if (!have_message && message_receive(msgid, &rx_data, pid, 0) == -1)
         {
-
-            if (msgrcv(msgid, (void *)&rx_data, rx_data_size,
-                        pid, 0) == -1)
+            if (errno == EINTR)
             {
-                fprintf(stderr, "msgrcv failed with error: %d\n", errno);
-                exit(EXIT_FAILURE);
+                continue;
             }
+            fprintf(stderr, "msgrcv failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        have_message = 0;
 
-            // If a stop message is received, stop the device
-            if (strncmp(rx_data.fields.data, "stop", 4) == 0)
-            {
-                printf("Received stop command from Controller. Stopping device.\n");
-                break;
-            }
+        // If a stop message is received, stop the device
+        if (rx_data.header.kind == MESSAGE_STOP)
+        {
+            printf("Received stop command from Controller. Stopping device.\n");
+            break;
+        }
 
-            // Threshold field is being multiplexed as sequence number
+        if (rx_data.header.kind != MESSAGE_COMMAND)
+        {
+            continue;
+        }
+
+        long long executed_at = timestamp_now();
+        if (rx_data.payload.command.trace.sampled != 0)
+        {
+            printf("Received '%s' with Sequence#=%d from Controller, %lldus after the reading\n",
+                    rx_data.payload.command.data, rx_data.payload.command.sequence_number,
+                    executed_at - rx_data.payload.command.trace.sampled);
+        }
+        else
+        {
             printf("Received '%s' with Sequence#=%d from Controller\n",
-                    rx_data.fields.data, rx_data.fields.threshold);
-
-            // Constructs and sends response back to the Controller
-            memset((void *)&tx_data, 0, sizeof(tx_data));
-            tx_data.type = TO_CONTROLLER;
-            tx_data.fields.device_type = DEVICE_TYPE_ACTUATOR;
-            tx_data.fields.threshold = rx_data.fields.threshold;
-            tx_data.fields.pid = pid;
-            strncpy(tx_data.fields.data, "ack", sizeof(tx_data.fields.data));
-
-            // Threshold field is being multiplexed as sequence number
-            printf("Sending ack message with Sequence#=%d to Controller\n",
-                    tx_data.fields.threshold);
-            if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+                    rx_data.payload.command.data, rx_data.payload.command.sequence_number);
+        }
+        executed++;
+
+        acknowledge(&transport, pid, &rx_data, &stats);
+
+        // Commands queued behind this one are left unacknowledged if
+        // the Actuator is stopped while it waits
+        if (min_interval_ms > 0 && wait_until(executed_at + min_interval_ms * 1000LL) == -1)
+        {
+            break;
+        }
+
+        if (!coalesce)
+        {
+            continue;
+        }
+
+        // Collapse the run of identical commands queued behind this one.
+        // The first different message is handled next.
+        while (message_receive(msgid, &next_data, pid, IPC_NOWAIT) == 0)
+        {
+            if (next_data.header.kind != MESSAGE_COMMAND
+                    || strcmp(next_data.payload.command.data, rx_data.payload.command.data) != 0)
             {
-                fprintf(stderr, "msgsnd failed\n");
-                exit(EXIT_FAILURE);
+                rx_data = next_data;
+                have_message = 1;
+                break;
             }
 
-            // Make note of current time
-            gettimeofday(&t1, NULL);
+            printf("Coalesced '%s' with Sequence#=%d\n",
+                    next_data.payload.command.data, next_data.payload.command.sequence_number);
+            coalesced++;
+            acknowledge(&transport, pid, &next_data, &stats);
         }
+
+        if (!have_message && errno != ENOMSG)
+        {
+            fprintf(stderr, "msgrcv failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (dedicated_queue)
+    {
+        msgctl(msgid, IPC_RMID, 0);
+    }
+
+    // The controller may already be gone, so a failure is not reported.
+    // Nor does stopping wait for room; a device that is not deregistered
+    // is removed once the controller sees it has exited.
+    if (g_program_done_flag)
+    {
+        printf("Deregistering from Controller.\n");
+        message_init(&tx_data, TO_CONTROLLER, MESSAGE_DEREGISTER, pid);
+        transport_try_send(&transport, &tx_data);
+    }
+
+    printf("Executed %lld commands, coalesced %lld.\n", executed, coalesced);
+    if (stats.command_to_ack.count > 0)
+    {
+        stats_histogram_print(stdout, "Sensor to Actuator latency", &stats.sensor_to_actuator);
+        stats_histogram_print(stdout, "  Sensor to Controller", &stats.sensor_to_controller);
+        stats_histogram_print(stdout, "  Within Controller", &stats.in_controller);
+        stats_histogram_print(stdout, "  Controller to Actuator", &stats.command_to_ack);
     }
 
     exit(EXIT_SUCCESS);
 }
+
+// Constructs and sends an ack for a command back to the Controller
+void acknowledge(struct transport *transport, pid_t pid,
+        const struct message_struct *command, struct latency_stats *stats)
+{
+    struct message_struct tx_data;
+    const struct message_trace *trace = &command->payload.command.trace;
+
+    message_command_ack(&tx_data, pid, command->payload.command.sequence_number,
+            command->payload.command.request_id, command->payload.command.timestamp, trace->sampled);
+
+    long long latency = tx_data.payload.command_ack.executed - command->payload.command.timestamp;
+    stats_histogram_add(&stats->command_to_ack, latency * 1000);
+    if (trace->sampled != 0)
+    {
+        stats_histogram_add(&stats->sensor_to_actuator,
+                (tx_data.payload.command_ack.executed - trace->sampled) * 1000);
+        stats_histogram_add(&stats->sensor_to_controller, (trace->received - trace->sampled) * 1000);
+        stats_histogram_add(&stats->in_controller,
+                (command->payload.command.timestamp - trace->received) * 1000);
+    }
+
+    printf("Sending ack message with Sequence#=%d to Controller after %lldus\n",
+            tx_data.payload.command_ack.sequence_number, latency);
+    // Only SIGINT and SIGTERM interrupt the send, as the Actuator stops
+    if (transport_send(transport, &tx_data) == -1 && errno != EINTR)
+    {
+        fprintf(stderr, "msgsnd failed\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Sleeps until an absolute time on the monotonic clock, in microseconds.
+// Returns -1 if the Actuator was told to stop before then.
+int wait_until(long long deadline)
+{
+    struct timespec ts;
+
+    ts.tv_sec = deadline / 1000000;
+    ts.tv_nsec = (deadline % 1000000) * 1000;
+    while (!g_program_done_flag)
+    {
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != EINTR)
+        {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Signal handler for SIGINT and SIGTERM
+void program_done(int signal_number)
+{
+    g_program_done_flag = 1;
+}
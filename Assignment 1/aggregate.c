@@ -0,0 +1,250 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: aggregate.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the streaming aggregates. Adding a reading touches
+ * one bucket and a few running totals. Closing an interval merges the
+ * panes of the sliding window, which costs the same however many
+ * readings they hold.
+ *
+ */
+#include "aggregate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Buckets are laid out as in stats.c: values below AGGREGATE_SUB_BUCKETS
+// have a bucket each, and every power of two above is split into
+// AGGREGATE_SUB_BUCKETS buckets. Negative values share the first.
+static unsigned int bucket_index(int value)
+{
+    if (value < AGGREGATE_SUB_BUCKETS)
+    {
+        return value < 0 ? 0 : value;
+    }
+
+    int exponent = 31 - __builtin_clz((unsigned int)value);
+    int shift = exponent - AGGREGATE_SUB_BITS;
+    unsigned int index = (shift + 1) * AGGREGATE_SUB_BUCKETS
+        + ((value >> shift) & (AGGREGATE_SUB_BUCKETS - 1));
+
+    return index < AGGREGATE_BUCKETS ? index : AGGREGATE_BUCKETS - 1;
+}
+
+// Returns the middle of the values that fall in a bucket
+static int bucket_middle(unsigned int index)
+{
+    if (index < AGGREGATE_SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    int shift = index / AGGREGATE_SUB_BUCKETS - 1;
+    int lower = (AGGREGATE_SUB_BUCKETS + index % AGGREGATE_SUB_BUCKETS) << shift;
+
+    return lower + ((1 << shift) - 1) / 2;
+}
+
+static void pane_clear(struct aggregate_pane *pane)
+{
+    memset((void *)pane, 0, sizeof(*pane));
+    pane->min = 0x7fffffff;
+    pane->max = -0x7fffffff - 1;
+}
+
+// Returns the estimated value below which the given share of a pane's
+// readings fall, kept within the pane's minimum and maximum
+static int pane_percentile(const struct aggregate_pane *pane, double share)
+{
+    long long rank = (long long)(share * pane->count + 0.5);
+    long long seen = 0;
+    int value = pane->max;
+
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    for (unsigned int i=0; i<AGGREGATE_BUCKETS; i++)
+    {
+        seen += pane->buckets[i];
+        if (seen >= rank)
+        {
+            value = bucket_middle(i);
+            break;
+        }
+    }
+
+    if (value < pane->min)
+    {
+        return pane->min;
+    }
+    return value > pane->max ? pane->max : value;
+}
+
+static void pane_stats(const struct aggregate_pane *pane, struct window_stats *stats)
+{
+    stats->count = pane->count;
+    stats->breaches = pane->breaches;
+    if (pane->count == 0)
+    {
+        stats->min = stats->max = stats->p50 = stats->p90 = stats->p99 = 0;
+        stats->mean = 0;
+        return;
+    }
+
+    stats->min = pane->min;
+    stats->max = pane->max;
+    stats->mean = (float)((double)pane->sum / pane->count);
+    stats->p50 = pane_percentile(pane, 0.50);
+    stats->p90 = pane_percentile(pane, 0.90);
+    stats->p99 = pane_percentile(pane, 0.99);
+}
+
+struct aggregate *aggregate_create(void)
+{
+    struct aggregate *aggregate = malloc(sizeof(struct aggregate));
+
+    if (aggregate == NULL)
+    {
+        return NULL;
+    }
+
+    for (int i=0; i<AGGREGATE_PANES; i++)
+    {
+        pane_clear(&aggregate->panes[i]);
+    }
+    aggregate->current = 0;
+    aggregate->started = 0;
+    aggregate->ewma = 0;
+
+    return aggregate;
+}
+
+void aggregate_destroy(struct aggregate *aggregate)
+{
+    free(aggregate);
+}
+
+// Adds a batch of readings, of which breaches reached the threshold
+void aggregate_add(struct aggregate *aggregate, const int *values, int count, int breaches)
+{
+    struct aggregate_pane *pane = &aggregate->panes[aggregate->current];
+    double ewma = aggregate->ewma;
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (!aggregate->started)
+    {
+        ewma = values[0];
+        aggregate->started = 1;
+    }
+
+    for (int i=0; i<count; i++)
+    {
+        int value = values[i];
+
+        pane->buckets[bucket_index(value)]++;
+        pane->sum += value;
+        if (value < pane->min)
+        {
+            pane->min = value;
+        }
+        if (value > pane->max)
+        {
+            pane->max = value;
+        }
+        ewma += AGGREGATE_EWMA_WEIGHT * (value - ewma);
+    }
+
+    pane->count += count;
+    pane->breaches += breaches;
+    aggregate->ewma = ewma;
+}
+
+// Fills in the count, breaches, min, max and mean of the sliding window
+// so far, without its percentiles, which would take a pass over the
+// buckets. Cheap enough to call for every batch.
+void aggregate_peek(const struct aggregate *aggregate, struct window_stats *stats)
+{
+    long long sum = 0;
+
+    memset((void *)stats, 0, sizeof(*stats));
+    for (int p=0; p<AGGREGATE_PANES; p++)
+    {
+        const struct aggregate_pane *pane = &aggregate->panes[p];
+        if (pane->count == 0)
+        {
+            continue;
+        }
+
+        if (stats->count == 0 || pane->min < stats->min)
+        {
+            stats->min = pane->min;
+        }
+        if (stats->count == 0 || pane->max > stats->max)
+        {
+            stats->max = pane->max;
+        }
+        stats->count += pane->count;
+        stats->breaches += pane->breaches;
+        sum += pane->sum;
+    }
+
+    if (stats->count > 0)
+    {
+        stats->mean = (float)((double)sum / stats->count);
+    }
+}
+
+// Ends the current interval and starts the next. Fills in the stats of
+// the interval and of the sliding window ending with it. Returns 0 if
+// the sliding window holds no readings, and 1 otherwise.
+int aggregate_close(struct aggregate *aggregate, struct device_aggregate *result)
+{
+    struct aggregate_pane sliding;
+
+    pane_clear(&sliding);
+    for (int p=0; p<AGGREGATE_PANES; p++)
+    {
+        const struct aggregate_pane *pane = &aggregate->panes[p];
+        if (pane->count == 0)
+        {
+            continue;
+        }
+
+        sliding.count += pane->count;
+        sliding.breaches += pane->breaches;
+        sliding.sum += pane->sum;
+        if (pane->min < sliding.min)
+        {
+            sliding.min = pane->min;
+        }
+        if (pane->max > sliding.max)
+        {
+            sliding.max = pane->max;
+        }
+        for (unsigned int i=0; i<AGGREGATE_BUCKETS; i++)
+        {
+            sliding.buckets[i] += pane->buckets[i];
+        }
+    }
+
+    pane_stats(&aggregate->panes[aggregate->current], &result->window);
+    pane_stats(&sliding, &result->sliding);
+    result->ewma = (float)aggregate->ewma;
+
+    // The oldest pane leaves the sliding window and is reused
+    aggregate->current = (aggregate->current + 1) % AGGREGATE_PANES;
+    pane_clear(&aggregate->panes[aggregate->current]);
+
+    return sliding.count > 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: aggregate.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Streaming aggregates of a Sensor's readings. Readings are counted
+ * into the current pane, which covers one interval, as they arrive;
+ * nothing is kept per reading. When the interval ends, the pane gives
+ * the tumbling window's stats, and the last AGGREGATE_PANES panes
+ * together give the sliding window's. Percentiles come from a small
+ * histogram with eight buckets per power of two, so they are within
+ * an eighth of the true value. An exponentially weighted mean is kept
+ * over all readings.
+ *
+ */
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include "message_queue.h"
+
+#define AGGREGATE_PANES 4           // Intervals covered by the sliding window
+#define AGGREGATE_SUB_BITS 3
+#define AGGREGATE_SUB_BUCKETS (1 << AGGREGATE_SUB_BITS)
+#define AGGREGATE_BUCKETS 128       // Values of 2^17 and above share the last bucket
+#define AGGREGATE_EWMA_WEIGHT 0.125 // Weight of each new reading
+
+// Readings of one interval
+struct aggregate_pane
+{
+    int count;
+    int breaches;
+    int min;
+    int max;
+    long long sum;
+    unsigned int buckets[AGGREGATE_BUCKETS];
+};
+
+struct aggregate
+{
+    struct aggregate_pane panes[AGGREGATE_PANES];
+    unsigned int current;
+    int started;                // Whether ewma holds a reading yet
+    double ewma;
+};
+
+struct aggregate *aggregate_create(void);
+void aggregate_destroy(struct aggregate *aggregate);
+void aggregate_add(struct aggregate *aggregate, const int *values, int count, int breaches);
+int aggregate_close(struct aggregate *aggregate, struct device_aggregate *result);
+void aggregate_peek(const struct aggregate *aggregate, struct window_stats *stats);
+
+#endif
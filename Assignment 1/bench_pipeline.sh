@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# SYSC 4001 Assignment 1
+#
+# File: bench_pipeline.sh
+# Author: Brandon To
+# Student #: 100874049
+# Created: October 17, 2026
+#
+# Description:
+# Runs the load generator against each transport and Controller mode
+# with the same offered load, so that the results can be compared line
+# by line. Extra arguments are passed to every run of the load
+# generator, eg. ./bench_pipeline.sh -r 100000 -b 16
+#
+
+set -e
+cd "$(dirname "$0")"
+
+for transport in msgqueue shm
+do
+    for workers in 1 4
+    do
+        echo "== transport=$transport workers=$workers"
+        bin/loadgen -t $transport "$@" -- bin/controller -t $transport -w $workers loadgen
+        echo
+    done
+done
@@ -0,0 +1,234 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: bench_queue.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Compares the ring buffer queue in queue.c against the linked list
+ * queue it replaced, which is kept here for reference. Two workloads
+ * are measured: a registration storm, where many devices are queued
+ * and then mapped, and steady churn, where a short queue sees devices
+ * come and go.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "queue.h"
+#include "timestamp.h"
+
+struct list_node
+{
+    int i;
+    struct list_node *next;
+};
+
+struct list_queue
+{
+    unsigned int size;
+    struct list_node *head;
+    struct list_node *tail;
+};
+
+static struct list_queue *list_queue_create()
+{
+    struct list_queue *q = (struct list_queue*)malloc(sizeof(struct list_queue));
+    q->size = 0;
+    q->head = NULL;
+    q->tail = NULL;
+
+    return q;
+}
+
+static void list_queue_add(struct list_queue *q, int i)
+{
+    struct list_node *temp = (struct list_node*)malloc(sizeof(struct list_node));
+    temp->i = i;
+    temp->next = NULL;
+
+    if (q->size == 0)
+    {
+        q->head = temp;
+        q->tail = temp;
+    }
+    else
+    {
+        q->tail->next = temp;
+        q->tail = temp;
+    }
+    q->size++;
+}
+
+static int list_queue_remove(struct list_queue *q, int *i)
+{
+    if (q->size == 0)
+    {
+        return -1;
+    }
+
+    *i = q->head->i;
+
+    struct list_node *remove = q->head;
+    q->head = q->head->next;
+    free(remove);
+    q->size--;
+
+    return 0;
+}
+
+static void list_queue_destroy(struct list_queue *q)
+{
+    int i;
+
+    while (list_queue_remove(q, &i) == 0)
+    {
+    }
+    free(q);
+}
+
+// Sum of removed items, so the compiler cannot drop the work
+static volatile long long g_sink;
+
+static void storm_ring(int devices, int rounds)
+{
+    struct queue *q = queue_create();
+    long long sum = 0;
+    int i;
+
+    for (int r=0; r<rounds; r++)
+    {
+        for (int d=0; d<devices; d++)
+        {
+            queue_add(q, d);
+        }
+        while (queue_remove(q, &i) == 0)
+        {
+            sum += i;
+        }
+    }
+
+    queue_destroy(q);
+    g_sink = sum;
+}
+
+static void storm_list(int devices, int rounds)
+{
+    struct list_queue *q = list_queue_create();
+    long long sum = 0;
+    int i;
+
+    for (int r=0; r<rounds; r++)
+    {
+        for (int d=0; d<devices; d++)
+        {
+            list_queue_add(q, d);
+        }
+        while (list_queue_remove(q, &i) == 0)
+        {
+            sum += i;
+        }
+    }
+
+    list_queue_destroy(q);
+    g_sink = sum;
+}
+
+static void churn_ring(int depth, int operations)
+{
+    struct queue *q = queue_create();
+    long long sum = 0;
+    int i;
+
+    for (int d=0; d<depth; d++)
+    {
+        queue_add(q, d);
+    }
+    for (int n=0; n<operations; n++)
+    {
+        queue_add(q, n);
+        queue_remove(q, &i);
+        sum += i;
+    }
+
+    queue_destroy(q);
+    g_sink = sum;
+}
+
+static void churn_list(int depth, int operations)
+{
+    struct list_queue *q = list_queue_create();
+    long long sum = 0;
+    int i = 0;
+
+    for (int d=0; d<depth; d++)
+    {
+        list_queue_add(q, d);
+    }
+    for (int n=0; n<operations; n++)
+    {
+        list_queue_add(q, n);
+        list_queue_remove(q, &i);
+        sum += i;
+    }
+
+    list_queue_destroy(q);
+    g_sink = sum;
+}
+
+static void report(const char *workload, const char *name, long long start, long long operations)
+{
+    long long elapsed = timestamp_now() - start;
+
+    printf("workload=%-6s queue=%-4s operations=%lld elapsed_us=%lld ns_per_op=%.2f\n",
+            workload, name, operations, elapsed, elapsed * 1000.0 / operations);
+}
+
+int main(int argc, char* argv[])
+{
+    int devices = 10000;
+    int rounds = 200;
+    int option;
+
+    while ((option = getopt(argc, argv, "d:r:")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            devices = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: bench_queue [-d DEVICES] [-r ROUNDS]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Each add and each remove counts as one operation
+    long long storm_operations = 2LL * devices * rounds;
+    long long churn_operations = 2LL * devices * rounds;
+    long long start;
+
+    start = timestamp_now();
+    storm_list(devices, rounds);
+    report("storm", "list", start, storm_operations);
+
+    start = timestamp_now();
+    storm_ring(devices, rounds);
+    report("storm", "ring", start, storm_operations);
+
+    start = timestamp_now();
+    churn_list(16, devices * rounds);
+    report("churn", "list", start, churn_operations);
+
+    start = timestamp_now();
+    churn_ring(16, devices * rounds);
+    report("churn", "ring", start, churn_operations);
+
+    exit(EXIT_SUCCESS);
+}
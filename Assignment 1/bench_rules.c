@@ -0,0 +1,222 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: bench_rules.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Measures how many rules per second are checked on the Controller's
+ * hot path. Readings arrive in batches, round robin over the Sensors,
+ * and each reading is checked against every rule of its Sensor as the
+ * Controller does, publishing the values of Sensors named in other
+ * rules' conditions. Window values are fixed per batch, as the
+ * Controller takes them once per batch from the aggregates. The single
+ * threshold rule is checked against a plain comparison of the readings.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "message_queue.h"
+#include "rules.h"
+#include "timestamp.h"
+
+#define MAX_READING 100
+
+// Stops the compiler from dropping the work being measured
+volatile long long g_sink;
+
+static const char g_threshold_rules[] =
+    "rule hot on * when reading >= 90 do \"turn off\"\n";
+
+static const char g_mixed_rules[] =
+    "# One of each kind of rule\n"
+    "rule hot on * when reading >= 90 do \"turn off\"\n"
+    "rule steady on * when reading >= 70 for 3 do \"slow down\"\n"
+    "rule latch on * when reading >= 95 clear reading < 50 do \"alarm\"\n"
+    "rule pair on * when reading >= 80 and s0.reading >= 50 do \"vent\"\n"
+    "rule trend on * when mean > 55 and ewma > 60 do \"cool\"\n";
+
+// A Sensor's rules, matched once as the Controller does on registration
+struct bench_sensor
+{
+    uint64_t mask;
+    int slot;
+};
+
+// Checks every reading against the rules and returns how many fired
+static long long run_rules(struct rule_set *set, const int *values, int count, int devices,
+        const struct bench_sensor *sensors, struct rule_state *states, long long *checked)
+{
+    long long fired = 0;
+    struct rule_input input;
+
+    memset((void *)&input, 0, sizeof(input));
+    input.threshold = 90;
+    *checked = 0;
+
+    for (int b=0; b<count; b+=MAX_BATCH_READINGS)
+    {
+        int device = (b / MAX_BATCH_READINGS) % devices;
+        uint64_t mask = sensors[device].mask;
+        int slot = sensors[device].slot;
+
+        // Stand-ins for the sliding window, which change once per batch
+        input.values[RULE_MEAN] = values[b] * 0.6f + 20;
+        input.values[RULE_MIN] = 0;
+        input.values[RULE_MAX] = MAX_READING;
+        input.values[RULE_EWMA] = values[b + 1] * 0.6f + 20;
+
+        for (int i=b; i<b + MAX_BATCH_READINGS; i++)
+        {
+            input.values[RULE_READING] = values[i];
+            if (slot >= 0)
+            {
+                rules_publish(set, slot, &input);
+            }
+            fired += __builtin_popcountll(rules_evaluate(set, mask, &states[device * RULES_MAX],
+                        &input));
+        }
+        *checked += (long long)MAX_BATCH_READINGS * __builtin_popcountll(mask);
+    }
+
+    return fired;
+}
+
+// Runs one rule set over the readings and reports it
+static long long report(const char *name, const char *text, const int *values, int count,
+        int devices, int rounds)
+{
+    struct rule_set *set = malloc(sizeof(struct rule_set));
+    struct rule_state *states = calloc((size_t)devices * RULES_MAX, sizeof(struct rule_state));
+    struct bench_sensor *sensors = malloc(devices * sizeof(struct bench_sensor));
+    char *copy = strdup(text);
+    char error[256];
+    long long checked = 0;
+    long long fired = 0;
+
+    if (set == NULL || states == NULL || sensors == NULL || copy == NULL)
+    {
+        fprintf(stderr, "Could not allocate rules\n");
+        exit(EXIT_FAILURE);
+    }
+    if (rules_parse(set, copy, error, sizeof(error)) == -1)
+    {
+        fprintf(stderr, "Could not parse %s rules: %s\n", name, error);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int d=0; d<devices; d++)
+    {
+        char sensor[16];
+        snprintf(sensor, sizeof(sensor), "s%d", d);
+        sensors[d].mask = rules_match(set, sensor);
+        sensors[d].slot = rules_slot(set, sensor);
+    }
+
+    long long start = timestamp_now();
+    for (int r=0; r<rounds; r++)
+    {
+        fired = run_rules(set, values, count, devices, sensors, states, &checked);
+        g_sink += fired;
+    }
+    long long elapsed = timestamp_now() - start;
+
+    printf("rules=%-9s per_reading=%-2d readings_per_sec=%11.0f rules_per_sec=%11.0f ns_per_rule=%5.2f fired=%lld\n",
+            name, set->rule_count, (double)count * rounds * 1e6 / elapsed,
+            (double)checked * rounds * 1e6 / elapsed, elapsed * 1e3 / ((double)checked * rounds),
+            fired);
+
+    free(copy);
+    free(sensors);
+    free(states);
+    free(set);
+
+    return fired;
+}
+
+int main(int argc, char* argv[])
+{
+    int count = 1 << 20;
+    int rounds = 20;
+    int devices = 100;
+    int option;
+
+    while ((option = getopt(argc, argv, "d:n:r:")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            devices = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: bench_rules [-d DEVICES] [-n READINGS] [-r ROUNDS]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (devices < 1 || count < 1 || rounds < 1)
+    {
+        fprintf(stderr, "DEVICES, READINGS and ROUNDS must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Whole batches only, as sent by Sensors with -b 64
+    count = (count + MAX_BATCH_READINGS - 1) / MAX_BATCH_READINGS * MAX_BATCH_READINGS;
+
+    int *values = malloc(count * sizeof(int));
+    if (values == NULL)
+    {
+        fprintf(stderr, "Could not allocate readings\n");
+        exit(EXIT_FAILURE);
+    }
+
+    srand(1);
+    long long expected = 0;
+    for (int i=0; i<count; i++)
+    {
+        values[i] = rand() % (MAX_READING + 1);
+        expected += values[i] >= 90;
+    }
+
+    long long fired = report("threshold", g_threshold_rules, values, count, devices, rounds);
+    if (fired != expected)
+    {
+        fprintf(stderr, "Threshold rule fired %lld times, expected %lld\n", fired, expected);
+        exit(EXIT_FAILURE);
+    }
+
+    report("mixed", g_mixed_rules, values, count, devices, rounds);
+
+    // As many rules as a Sensor can have, each with two conditions
+    char *many = malloc(RULES_MAX * 96);
+    if (many == NULL)
+    {
+        fprintf(stderr, "Could not allocate rules\n");
+        exit(EXIT_FAILURE);
+    }
+    many[0] = '\0';
+    for (int i=0; i<RULES_MAX; i++)
+    {
+        char line[96];
+        snprintf(line, sizeof(line), "rule r%d on * when reading >= %d and s0.reading < %d do \"r%d\"\n",
+                i, 50 + i % 50, 90 - i % 40, i);
+        strcat(many, line);
+    }
+    report("many", many, values, count, devices, rounds);
+    free(many);
+
+    free(values);
+
+    exit(EXIT_SUCCESS);
+}
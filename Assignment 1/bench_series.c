@@ -0,0 +1,176 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: bench_series.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Measures how fast readings are appended to the on-disk store and how
+ * long range queries over them take. Readings are spread evenly over
+ * the past at RATE per second in total, round robin over the Sensors
+ * in batches, as the Controller appends them. The queries then ask for
+ * one Sensor's readings over the whole span and over its last tenth,
+ * and check that every reading is found.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "message_queue.h"
+#include "series.h"
+#include "timestamp.h"
+
+#define DEVICE_ID_BASE 1000
+
+// Stops the compiler from dropping the work being measured
+volatile long long g_sink;
+
+static void count_reading(void *context, const struct reading *reading)
+{
+    (void)context;
+    g_sink += reading->value;
+}
+
+// Runs a range query for the first Sensor and reports it
+static void run_range(const char *directory, long long from, long long to, long long expected)
+{
+    long long start = timestamp_now();
+    long long found = series_range(directory, DEVICE_ID_BASE, from, to, count_reading, NULL);
+    long long elapsed = timestamp_now() - start;
+
+    printf("range span_s=%-8.1f found=%-9lld elapsed_ms=%8.2f\n",
+            (to - from) / 1e6, found, elapsed / 1e3);
+
+    if (found != expected)
+    {
+        fprintf(stderr, "Range found %lld readings, expected %lld\n", found, expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Removes the segment files and the directory
+static void remove_store(const char *directory)
+{
+    char path[SERIES_PATH_MAX + 64];
+    struct dirent *entry;
+    DIR *dir = opendir(directory);
+
+    while (dir != NULL && (entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (dir != NULL)
+    {
+        closedir(dir);
+    }
+    rmdir(directory);
+}
+
+int main(int argc, char* argv[])
+{
+    long long count = 4000000;
+    int devices = 1000;
+    int batch_size = MAX_BATCH_READINGS;
+    int rate = 50000;
+    char directory[] = "/tmp/bench_series.XXXXXX";
+    struct series_store store;
+    struct reading batch[MAX_BATCH_READINGS];
+    int option;
+
+    while ((option = getopt(argc, argv, "b:d:n:r:")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'd':
+            devices = atoi(optarg);
+            break;
+        case 'n':
+            count = atoll(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: bench_series [-b BATCH_SIZE] [-d DEVICES] [-n READINGS] [-r RATE]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (batch_size < 1 || batch_size > MAX_BATCH_READINGS || devices < 1 || rate < 1)
+    {
+        fprintf(stderr, "BATCH_SIZE must be between 1 and %d, DEVICES and RATE at least 1\n",
+                MAX_BATCH_READINGS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (mkdtemp(directory) == NULL || series_open(&store, directory, 0) == -1)
+    {
+        fprintf(stderr, "Could not create store in %s\n", directory);
+        exit(EXIT_FAILURE);
+    }
+
+    // Whole rounds of batches only, so every Sensor has as many readings
+    long long per_round = (long long)devices * batch_size;
+    count = (count + per_round - 1) / per_round * per_round;
+
+    long long span = count * 1000000LL / rate;
+    long long first = timestamp_now() - span;
+    long long index = 0;
+
+    long long start = timestamp_now();
+    while (index < count)
+    {
+        for (int d=0; d<devices; d++)
+        {
+            for (int i=0; i<batch_size; i++)
+            {
+                batch[i].timestamp = first + (index + i * devices) * 1000000LL / rate;
+                batch[i].value = (int)((index + i) % 101);
+            }
+            if (series_append(&store, DEVICE_ID_BASE + d, batch, batch_size) == -1)
+            {
+                fprintf(stderr, "Could not append readings\n");
+                remove_store(directory);
+                exit(EXIT_FAILURE);
+            }
+            index++;
+        }
+        index += per_round - devices;
+    }
+    long long elapsed = timestamp_now() - start;
+
+    printf("append readings=%lld devices=%d batch=%d readings_per_sec=%.0f fleet_rate=%d segments=%u\n",
+            count, devices, batch_size, count * 1e6 / elapsed, rate, store.sequence);
+
+    // The first Sensor's readings are every DEVICES-th reading
+    long long wall_first = first + store.wall_offset;
+    long long from = wall_first + span - span / 10;
+    long long recent = 0;
+    for (long long k=0; k<count; k+=devices)
+    {
+        if (wall_first + k * 1000000LL / rate >= from)
+        {
+            recent++;
+        }
+    }
+    series_close(&store);
+
+    run_range(directory, wall_first, wall_first + span, count / devices);
+    run_range(directory, from, wall_first + span, recent);
+
+    remove_store(directory);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,171 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: bench_threshold.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Measures how many readings per second are checked against a
+ * threshold. The per-reading path is the loop the Controller used
+ * before, which compares each timestamped reading in turn. The other
+ * paths gather a batch of values into a column and check it with each
+ * version of threshold_mask(). Every path collects the indices of the
+ * readings that reach the threshold, as the Controller does before
+ * sending commands.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "message_queue.h"
+#include "threshold.h"
+#include "timestamp.h"
+
+#define MAX_READING 100
+
+// Stops the compiler from dropping the work being measured
+volatile long long g_sink;
+
+static long long run_per_reading(const struct reading *readings, int count, int threshold,
+        int *breaches)
+{
+    long long found = 0;
+
+    for (int b=0; b<count; b+=MAX_BATCH_READINGS)
+    {
+        int n = 0;
+        for (int i=0; i<MAX_BATCH_READINGS; i++)
+        {
+            if (readings[b + i].value >= threshold)
+            {
+                breaches[n++] = i;
+            }
+        }
+        found += n;
+    }
+
+    return found;
+}
+
+static long long run_column(const struct reading *readings, int count, int threshold,
+        int *breaches)
+{
+    int values[MAX_BATCH_READINGS];
+    long long found = 0;
+
+    for (int b=0; b<count; b+=MAX_BATCH_READINGS)
+    {
+        int n = 0;
+        for (int i=0; i<MAX_BATCH_READINGS; i++)
+        {
+            values[i] = readings[b + i].value;
+        }
+
+        uint64_t mask = threshold_mask(values, MAX_BATCH_READINGS, threshold);
+        while (mask != 0)
+        {
+            breaches[n++] = __builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+        found += n;
+    }
+
+    return found;
+}
+
+static void report(const char *name, int threshold, long long readings, long long elapsed,
+        long long found)
+{
+    printf("path=%-11s threshold=%-3d readings_per_sec=%11.0f breaches=%lld\n",
+            name, threshold, readings * 1e6 / elapsed, found);
+}
+
+int main(int argc, char* argv[])
+{
+    int count = 1 << 20;
+    int rounds = 50;
+    int breaches[MAX_BATCH_READINGS];
+    int thresholds[] = { 90, 50, MAX_READING + 1 };
+    int option;
+
+    while ((option = getopt(argc, argv, "n:r:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: bench_threshold [-n READINGS] [-r ROUNDS]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Whole batches only, as sent by Sensors with -b 64
+    count = (count + MAX_BATCH_READINGS - 1) / MAX_BATCH_READINGS * MAX_BATCH_READINGS;
+
+    struct reading *readings = malloc(count * sizeof(struct reading));
+    if (readings == NULL)
+    {
+        fprintf(stderr, "Could not allocate readings\n");
+        exit(EXIT_FAILURE);
+    }
+
+    srand(1);
+    for (int i=0; i<count; i++)
+    {
+        readings[i].timestamp = i;
+        readings[i].value = rand() % (MAX_READING + 1);
+    }
+
+    for (unsigned int t=0; t<sizeof(thresholds) / sizeof(thresholds[0]); t++)
+    {
+        int threshold = thresholds[t];
+        long long expected = 0;
+        long long found = 0;
+
+        long long start = timestamp_now();
+        for (int r=0; r<rounds; r++)
+        {
+            expected = run_per_reading(readings, count, threshold, breaches);
+            g_sink += breaches[0];
+        }
+        report("per-reading", threshold, (long long)count * rounds, timestamp_now() - start,
+                expected);
+
+        for (int kernel=THRESHOLD_KERNEL_SCALAR; kernel<=THRESHOLD_KERNEL_AVX2; kernel++)
+        {
+            if (threshold_select(kernel) == -1)
+            {
+                printf("path=%-11s not supported by this CPU\n", threshold_kernel_name(kernel));
+                continue;
+            }
+
+            start = timestamp_now();
+            for (int r=0; r<rounds; r++)
+            {
+                found = run_column(readings, count, threshold, breaches);
+                g_sink += breaches[0];
+            }
+            report(threshold_kernel_name(kernel), threshold, (long long)count * rounds,
+                    timestamp_now() - start, found);
+
+            if (found != expected)
+            {
+                fprintf(stderr, "%s found %lld breaches, expected %lld\n",
+                        threshold_kernel_name(kernel), found, expected);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    free(readings);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,164 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: bench_topology.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Measures how the time for a device to receive a command grows with
+ * the number of devices, for both queue layouts. Every device but one
+ * is slow and has commands waiting for it. The remaining device is
+ * sent a command and receives it right away. On a shared queue its
+ * typed msgrcv has to skip over every waiting command first; with a
+ * queue per device it does not.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/ipc.h>
+#include <sys/msg.h>
+
+#include "message_queue.h"
+#include "timestamp.h"
+
+#define DEVICE_ID_BASE 1000
+
+static int create_queue(size_t bytes)
+{
+    struct msqid_ds info;
+    int msgid = msgget(IPC_PRIVATE, 0600);
+
+    if (msgid == -1)
+    {
+        fprintf(stderr, "msgget failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // The default limit only fits a few hundred waiting commands.
+    // Raising it past kernel.msgmnb needs CAP_SYS_RESOURCE.
+    if (msgctl(msgid, IPC_STAT, &info) == 0 && info.msg_qbytes < bytes)
+    {
+        info.msg_qbytes = bytes;
+        if (msgctl(msgid, IPC_SET, &info) == -1)
+        {
+            fprintf(stderr, "Could not raise queue size to %zu bytes. Raise kernel.msgmnb or use fewer devices.\n",
+                    bytes);
+            msgctl(msgid, IPC_RMID, 0);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return msgid;
+}
+
+static void send_command(int msgid, pid_t device_id)
+{
+    struct message_struct tx_data;
+
+    message_command(&tx_data, device_id, getpid(), 0, 0, NULL, "turn off");
+    if (message_send(msgid, &tx_data) == -1)
+    {
+        fprintf(stderr, "msgsnd failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Returns the mean time in microseconds for the last device to send
+// and receive one command, with backlog commands waiting for each of
+// the other devices
+static double run(int dedicated, int devices, int backlog, int rounds)
+{
+    struct message_struct tx_data;
+    struct message_struct rx_data;
+    int queue_count = dedicated ? devices : 1;
+    int *queues = malloc(queue_count * sizeof(int));
+    pid_t active = DEVICE_ID_BASE + devices - 1;
+
+    message_command(&tx_data, 0, getpid(), 0, 0, NULL, "turn off");
+    size_t bytes = (size_t)(devices * backlog + 1) * MESSAGE_SIZE(&tx_data);
+
+    if (queues == NULL)
+    {
+        fprintf(stderr, "Could not allocate queues\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i=0; i<queue_count; i++)
+    {
+        queues[i] = create_queue(bytes);
+    }
+
+    for (int b=0; b<backlog; b++)
+    {
+        for (int i=0; i<devices - 1; i++)
+        {
+            send_command(queues[dedicated ? i : 0], DEVICE_ID_BASE + i);
+        }
+    }
+
+    int active_queue = queues[dedicated ? devices - 1 : 0];
+    long long start = timestamp_now();
+
+    for (int r=0; r<rounds; r++)
+    {
+        send_command(active_queue, active);
+        if (message_receive(active_queue, &rx_data, active, 0) == -1)
+        {
+            fprintf(stderr, "msgrcv failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    long long elapsed = timestamp_now() - start;
+
+    for (int i=0; i<queue_count; i++)
+    {
+        msgctl(queues[i], IPC_RMID, 0);
+    }
+    free(queues);
+
+    return (double)elapsed / rounds;
+}
+
+int main(int argc, char* argv[])
+{
+    int backlog = 4;
+    int rounds = 2000;
+    int max_devices = 4096;
+    int option;
+
+    while ((option = getopt(argc, argv, "b:d:n:")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'd':
+            max_devices = atoi(optarg);
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: bench_topology [-b BACKLOG] [-d MAX_DEVICES] [-n ROUNDS]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int devices=1; devices<=max_devices; devices*=4)
+    {
+        double shared = run(0, devices, backlog, rounds);
+        double dedicated = run(1, devices, backlog, rounds);
+
+        printf("devices=%-5d waiting=%-6d shared_us=%8.2f dedicated_us=%6.2f\n",
+                devices, (devices - 1) * backlog, shared, dedicated);
+    }
+
+    exit(EXIT_SUCCESS);
+}
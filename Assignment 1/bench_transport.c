@@ -0,0 +1,132 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: bench_transport.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Measures device to Controller throughput of each transport. A
+ * number of producer processes each send readings to a single
+ * consumer, as Sensors do to the Controller's child process. A
+ * private message queue and shared memory ring are used so that the
+ * benchmark does not interfere with a running Controller.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/wait.h>
+
+#include "message_queue.h"
+#include "timestamp.h"
+#include "transport.h"
+
+#define BENCH_RING_NAME "/sysc4001_bench_ring"
+
+static void produce(struct transport *t, int messages)
+{
+    struct message_struct tx_data;
+
+    message_init(&tx_data, TO_CONTROLLER, MESSAGE_READINGS, getpid());
+    tx_data.payload.readings.count = 1;
+    tx_data.header.length = READINGS_PAYLOAD_SIZE(1);
+
+    for (int i=0; i<messages; i++)
+    {
+        tx_data.payload.readings.readings[0].timestamp = timestamp_now();
+        tx_data.payload.readings.readings[0].value = i;
+        if (transport_send(t, &tx_data) == -1)
+        {
+            fprintf(stderr, "transport_send failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void run(int kind, const char *name, int producers, int messages)
+{
+    struct transport t;
+    struct message_struct rx_data;
+    long long total = (long long)producers * messages;
+    long long latency_sum = 0;
+
+    if (transport_open(&t, kind, IPC_PRIVATE, BENCH_RING_NAME, 1) == -1)
+    {
+        fprintf(stderr, "transport_open failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // Producers must not inherit unflushed output
+    fflush(stdout);
+
+    long long start = timestamp_now();
+
+    for (int i=0; i<producers; i++)
+    {
+        switch (fork())
+        {
+        case -1:
+            fprintf(stderr, "fork failed\n");
+            exit(EXIT_FAILURE);
+        case 0:
+            produce(&t, messages);
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    for (long long i=0; i<total; i++)
+    {
+        if (transport_receive(&t, &rx_data, TO_CONTROLLER, 0) == -1)
+        {
+            fprintf(stderr, "transport_receive failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        latency_sum += timestamp_now() - rx_data.payload.readings.readings[0].timestamp;
+    }
+
+    long long elapsed = timestamp_now() - start;
+
+    while (wait(NULL) > 0)
+    {
+    }
+
+    printf("transport=%-8s producers=%d messages=%lld elapsed_us=%lld msgs_per_sec=%.0f mean_latency_us=%.1f\n",
+            name, producers, total, elapsed, total * 1e6 / elapsed, (double)latency_sum / total);
+
+    transport_close(&t, 1);
+    msgctl(t.msgid, IPC_RMID, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    int producers = 4;
+    int messages = 100000;
+    int option;
+
+    while ((option = getopt(argc, argv, "p:n:")) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            producers = atoi(optarg);
+            break;
+        case 'n':
+            messages = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: bench_transport [-p PRODUCERS] [-n MESSAGES_PER_PRODUCER]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    run(TRANSPORT_MSGQUEUE, "msgqueue", producers, messages);
+    run(TRANSPORT_SHM, "shm", producers, messages);
+
+    exit(EXIT_SUCCESS);
+}
@@ -14,9 +14,21 @@
  * clients to stdout.
  *
  * A user can enter Get or Put commands. The Get command is used to
- * request data for a specific Sensor, whereas the Put command is used
- * to trigger an action for an Actuator. The command will be sent to
- * the parent part of the Controller process.
+ * request data for one or more Sensors, whereas the Put command is
+ * used to trigger an action for one or more Actuators. Each is sent
+ * with a new request id without waiting for earlier ones, and the
+ * reply from each device is printed with that id. Map and Unmap add and remove
+ * routes from a Sensor to the Actuators its threshold breaches are
+ * sent to. Range asks for the readings a Sensor sent over the last
+ * given number of seconds, which the Controller keeps on disk, and
+ * prints a summary of them. Reload has a Controller started with a rules
+ * file load it again, without stopping. The command will be sent to the
+ * parent part of the Controller process.
+ *
+ * A Controller that aggregates readings sends, once per interval, the
+ * stats of every Sensor over that interval and over the last few,
+ * instead of an update for every breach. They are printed as they
+ * arrive.
  *
  */
 #include <stdlib.h>
@@ -34,9 +46,30 @@
 
 #include "fifo.h"
 #include "message_queue.h"
+#include "stats.h"
+#include "timestamp.h"
+
+#define RANGE_SUMMARIES 64      // Range requests that can be in flight at once
+
+// Stored readings received so far for a Range request
+struct range_summary
+{
+    unsigned int request_id;
+    long long count;
+    long long sum;
+    int min;
+    int max;
+    long long first;
+    long long last;
+};
 
 void child_handler(void);
-int process_user_input(struct message_struct *message, char *user_input);
+int process_user_input(struct message_struct *message, char *user_input,
+        unsigned int request_id);
+int process_map_input(struct message_struct *message, int unmap);
+int process_range_input(struct message_struct *message, unsigned int request_id);
+void summarize_range(const struct range_reply_payload *reply);
+void print_aggregates(const struct aggregates_payload *aggregates);
 
 void parent_handler(pid_t child_pid);
 
@@ -48,8 +81,6 @@ int main(int argc, char* argv[])
 {
     pid_t pid;
 
-    char *name;
-
     // Capture SIGINT to close cleanly
     struct sigaction sa;
     memset((void *)&sa, 0, sizeof(sa));
@@ -62,9 +93,7 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
-    name = argv[1];
-
-    printf("Cloud starting.\n");
+    printf("Cloud %s starting.\n", argv[1]);
 
     // Fork the process into child and parent process
     pid = fork();
@@ -95,6 +124,7 @@ void child_handler(void)
 
     int result;
     char user_input[MAX_DATA_LENGTH];
+    unsigned int next_request_id = 1;
 
     struct message_struct tx_data;
 
@@ -137,18 +167,24 @@ void child_handler(void)
             break;
         }
 
-        memset((void *)&tx_data, 0, sizeof(tx_data));
-
         // Process query
-        if (process_user_input(&tx_data, user_input) == -1)
+        if (process_user_input(&tx_data, user_input, next_request_id) == -1)
         {
             printf("[CHILD] Malformed query. Please try again...\n");
             continue;
         }
 
-        // Send query to controller
-        printf("[CHILD] Sending query to Controller\n");
-        if (write(fifo_fd, (void *)&tx_data, sizeof(tx_data)) == -1)
+        // Send query to controller without waiting for earlier ones to
+        // be answered
+        if (tx_data.header.kind == MESSAGE_QUERY || tx_data.header.kind == MESSAGE_RANGE)
+        {
+            printf("[CHILD] Sending request #%u to Controller\n", next_request_id++);
+        }
+        else
+        {
+            printf("[CHILD] Sending query to Controller\n");
+        }
+        if (message_write(fifo_fd, &tx_data) == -1)
         {
             fprintf(stderr, "[CHILD] write failed with error: %d\n", errno);
             exit(EXIT_FAILURE);
@@ -158,22 +194,41 @@ void child_handler(void)
     close(fifo_fd);
 }
 
-int process_user_input(struct message_struct *message, char *user_input)
+// Parses "Get PID [PID ...]" or "Put PID [PID ...] "DATA"" into a
+// query carrying the given request id
+int process_user_input(struct message_struct *message, char *user_input,
+        unsigned int request_id)
 {
     int command_required = 0;
+    char device_type;
+    pid_t device_pids[MAX_QUERY_DEVICES];
+    int count = 0;
+    char *data = "";
     char delim_space[2] = " ";
-    char delim_quote[2] = "\"";
     char* token = strtok(user_input, delim_space);
 
     if (token != NULL)
     {
-        if (strncmp(token, "Get", 3) == 0)
+        if (strncmp(token, "Map", 3) == 0 || strncmp(token, "Unmap", 5) == 0)
+        {
+            return process_map_input(message, token[0] == 'U');
+        }
+        else if (strncmp(token, "Range", 5) == 0)
+        {
+            return process_range_input(message, request_id);
+        }
+        else if (strncmp(token, "Reload", 6) == 0)
+        {
+            message_reload(message, 0, getpid());
+            return 0;
+        }
+        else if (strncmp(token, "Get", 3) == 0)
         {
-            message->fields.device_type = DEVICE_TYPE_SENSOR;
+            device_type = DEVICE_TYPE_SENSOR;
         }
         else if (strncmp(token, "Put", 3) == 0)
         {
-            message->fields.device_type = DEVICE_TYPE_ACTUATOR;
+            device_type = DEVICE_TYPE_ACTUATOR;
             command_required = 1;
         }
         else
@@ -186,43 +241,195 @@ int process_user_input(struct message_struct *message, char *user_input)
         return -1;
     }
 
-    token = strtok(NULL, delim_space);
-    if (token != NULL)
+    // The rest of the line holds the pids, then the quoted data of a Put
+    char *rest = strtok(NULL, "");
+    while (rest != NULL)
     {
-        message->fields.pid = atoi(token);
+        char *end;
+
+        while (*rest == ' ')
+        {
+            rest++;
+        }
+        if (*rest < '0' || *rest > '9')
+        {
+            break;
+        }
+        if (count == MAX_QUERY_DEVICES)
+        {
+            return -1;
+        }
+        device_pids[count++] = strtol(rest, &end, 10);
+        rest = end;
     }
-    else
+
+    if (count == 0)
     {
         return -1;
     }
 
     if (command_required)
     {
-        token = strtok(NULL, delim_quote);
-        if (token != NULL)
-        {
-            strncpy(message->fields.data, token, sizeof(message->fields.data));
-        }
-        else
+        char *closing;
+
+        if (rest == NULL || *rest != '"' || (closing = strchr(rest + 1, '"')) == NULL)
         {
             return -1;
         }
+        *closing = '\0';
+        data = rest + 1;
     }
 
+    message_query(message, 0, getpid(), request_id, device_type, device_pids, count, data);
+
     return 0;
 }
 
+// Parses the Sensor and Actuator pids of a Map or Unmap command, whose
+// name has already been consumed by strtok
+int process_map_input(struct message_struct *message, int unmap)
+{
+    char delim_space[2] = " ";
+    char *sensor_token = strtok(NULL, delim_space);
+    char *actuator_token = strtok(NULL, delim_space);
+
+    if (sensor_token == NULL || actuator_token == NULL)
+    {
+        return -1;
+    }
+
+    if (unmap)
+    {
+        message_unmap(message, 0, getpid(), atoi(sensor_token), atoi(actuator_token));
+    }
+    else
+    {
+        message_map(message, 0, getpid(), atoi(sensor_token), atoi(actuator_token), 0);
+    }
+
+    return 0;
+}
+
+// Parses the Sensor pid and number of seconds of a Range command, whose
+// name has already been consumed by strtok
+int process_range_input(struct message_struct *message, unsigned int request_id)
+{
+    char delim_space[2] = " ";
+    char *pid_token = strtok(NULL, delim_space);
+    char *seconds_token = strtok(NULL, delim_space);
+    struct timespec now;
+
+    if (pid_token == NULL || seconds_token == NULL || atoi(seconds_token) <= 0)
+    {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    long long to = (long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+    long long from = to - atoi(seconds_token) * 1000000LL;
+    message_range(message, 0, getpid(), request_id, atoi(pid_token), from, to);
+
+    return 0;
+}
+
+// Adds a batch of stored readings to the summary of its request, and
+// prints the summary once the last batch has arrived
+void summarize_range(const struct range_reply_payload *reply)
+{
+    // Summaries of requests in flight, by request id
+    static struct range_summary summaries[RANGE_SUMMARIES];
+
+    struct range_summary *summary = &summaries[reply->request_id % RANGE_SUMMARIES];
+    if (summary->request_id != reply->request_id)
+    {
+        memset((void *)summary, 0, sizeof(*summary));
+        summary->request_id = reply->request_id;
+    }
+
+    for (int i=0; i<reply->count && i<MAX_BATCH_READINGS; i++)
+    {
+        const struct reading *reading = &reply->readings[i];
+        if (summary->count == 0 || reading->value < summary->min)
+        {
+            summary->min = reading->value;
+        }
+        if (summary->count == 0 || reading->value > summary->max)
+        {
+            summary->max = reading->value;
+        }
+        if (summary->count == 0 || reading->timestamp < summary->first)
+        {
+            summary->first = reading->timestamp;
+        }
+        if (summary->count == 0 || reading->timestamp > summary->last)
+        {
+            summary->last = reading->timestamp;
+        }
+        summary->sum += reading->value;
+        summary->count++;
+    }
+
+    if (!reply->done)
+    {
+        return;
+    }
+
+    if (summary->count == 0)
+    {
+        printf("[PARENT] Request #%u: Sensor with PID=%d has no stored readings in that range.\n",
+                reply->request_id, reply->device_pid);
+    }
+    else
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        long long wall = (long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+
+        printf("[PARENT] Request #%u: Sensor with PID=%d has %lld stored readings from %.1fs to %.1fs ago, min=%d, max=%d, mean=%.1f\n",
+                reply->request_id, reply->device_pid, summary->count,
+                (wall - summary->first) / 1e6, (wall - summary->last) / 1e6,
+                summary->min, summary->max, (double)summary->sum / summary->count);
+    }
+    summary->request_id = 0;
+}
+
+// Prints the stats of one window of a Sensor's readings
+static void print_window(const char *label, int span_ms, const struct window_stats *stats)
+{
+    printf("[PARENT]   %s %dms: count=%d, breaches=%d, min=%d, mean=%.1f, max=%d, p50=%d, p90=%d, p99=%d\n",
+            label, span_ms, stats->count, stats->breaches, stats->min, stats->mean, stats->max,
+            stats->p50, stats->p90, stats->p99);
+}
+
+// Prints the aggregates of every Sensor in a batch
+void print_aggregates(const struct aggregates_payload *aggregates)
+{
+    for (int i=0; i<aggregates->count && i<MAX_AGGREGATE_DEVICES; i++)
+    {
+        const struct device_aggregate *device = &aggregates->devices[i];
+
+        printf("[PARENT] Aggregates of Sensor with PID=%d, ewma=%.1f\n", device->device_pid,
+                device->ewma);
+        print_window("Last", aggregates->interval_ms, &device->window);
+        print_window("Sliding", aggregates->interval_ms * aggregates->panes, &device->sliding);
+    }
+}
+
 void parent_handler(pid_t child_pid)
 {
     pid_t pid = getpid();
     int result;
-    struct timeval t1, t2;
 
     int fifo_fd;
-    int bytes_read = 0;
 
     struct message_struct rx_data;
 
+    // Latencies of updates caused by readings, in nanoseconds
+    static struct stats_histogram sensor_to_cloud;
+    static struct stats_histogram sensor_to_controller;
+    static struct stats_histogram in_controller;
+    static struct stats_histogram controller_to_cloud;
+
     printf("[PARENT] Started with PID=%d\n", pid);
 
     // Check for existance of fifo by attempting to access it
@@ -250,11 +457,20 @@ void parent_handler(pid_t child_pid)
     while (g_running_flag)
     {
         // Receive update from Controller
-        memset((void *)&rx_data, 0, sizeof(rx_data));
-        if((bytes_read = read(fifo_fd, (void *)&rx_data,
-                        sizeof(rx_data))) == -1)
+        if ((result = message_read(fifo_fd, &rx_data)) == -1)
         {
-            if (errno != 11)
+            if (errno == EBADMSG)
+            {
+                fprintf(stderr, "[PARENT] Dropping malformed message from Controller\n");
+                continue;
+            }
+            if (errno == EPROTO)
+            {
+                fprintf(stderr, "[PARENT] Lost track of messages from Controller. Stopping.\n");
+                g_running_flag = 0;
+                break;
+            }
+            if (errno != EAGAIN && errno != EINTR)
             {
                 fprintf(stderr, "[PARENT] read failed with error: %d\n", errno);
                 exit(EXIT_FAILURE);
@@ -262,22 +478,107 @@ void parent_handler(pid_t child_pid)
             continue;
         }
 
-        // Check for "stop" command and quit if received
-        if (strncmp(rx_data.fields.data, "stop", 4) == 0)
+        // Check for "stop" command and quit if received. The Controller
+        // closing the fifo is treated the same way.
+        if (result == 0 || rx_data.header.kind == MESSAGE_STOP)
         {
             printf("[PARENT] Received stop command from Controller. Stopping device.\n");
             g_running_flag = 0;
             break;
         }
 
-        if (strncmp(rx_data.fields.data, "error: ", 7) == 0)
+        if (rx_data.header.kind == MESSAGE_ERROR)
+        {
+            const struct error_payload *error = &rx_data.payload.error;
+            if (error->request_id != 0)
+            {
+                printf("[PARENT] Error with request #%u, device PID=%d: %s.\n",
+                        error->request_id, error->device_pid, error->data);
+            }
+            else
+            {
+                printf("[PARENT] Error with query: %s.\n", error->data);
+            }
+            continue;
+        }
+
+        if (rx_data.header.kind == MESSAGE_RANGE_REPLY)
+        {
+            summarize_range(&rx_data.payload.range_reply);
+            continue;
+        }
+
+        if (rx_data.header.kind == MESSAGE_AGGREGATES)
+        {
+            print_aggregates(&rx_data.payload.aggregates);
+            continue;
+        }
+
+        if (rx_data.header.kind == MESSAGE_RELOAD)
+        {
+            const struct reload_payload *reload = &rx_data.payload.reload;
+            printf("[PARENT] Controller reloaded %d rules, %d thresholds and %d maps.\n",
+                    reload->rule_count, reload->threshold_count, reload->map_count);
+            continue;
+        }
+
+        if (rx_data.header.kind == MESSAGE_REPLY)
+        {
+            const struct reply_payload *reply = &rx_data.payload.reply;
+            if (reply->device_type == DEVICE_TYPE_SENSOR && reply->timestamp == 0)
+            {
+                printf("[PARENT] Request #%u: Sensor with PID=%d has not taken a reading yet.\n",
+                        reply->request_id, reply->device_pid);
+            }
+            else if (reply->device_type == DEVICE_TYPE_SENSOR)
+            {
+                printf("[PARENT] Request #%u: Sensor with PID=%d has reading=%d, taken %.1fms ago.\n",
+                        reply->request_id, reply->device_pid, reply->value,
+                        (timestamp_now() - reply->timestamp) / 1e3);
+            }
+            else
+            {
+                printf("[PARENT] Request #%u: Actuator with PID=%d acknowledged the command.\n",
+                        reply->request_id, reply->device_pid);
+            }
+            continue;
+        }
+
+        if (rx_data.header.kind == MESSAGE_MAP || rx_data.header.kind == MESSAGE_UNMAP)
+        {
+            printf("[PARENT] Sensor with PID=%d is %s Actuator with PID=%d.\n",
+                    rx_data.payload.map.sensor_pid,
+                    rx_data.header.kind == MESSAGE_MAP ? "now mapped to" : "no longer mapped to",
+                    rx_data.payload.map.actuator_pid);
+            continue;
+        }
+
+        if (rx_data.header.kind != MESSAGE_UPDATE)
         {
-            printf("[PARENT] Error with query: %s.\n", rx_data.fields.data+7);
             continue;
         }
 
         printf("[PARENT] Received update from Controller. Sensor: pid=%d, name='%s', threshold=%d, reading=%d\n",
-                rx_data.fields.pid, rx_data.fields.name, rx_data.fields.threshold, rx_data.fields.sensor_reading);
+                rx_data.payload.update.device_pid, rx_data.payload.update.strings,
+                rx_data.payload.update.threshold, rx_data.payload.update.sensor_reading);
+
+        const struct message_trace *trace = &rx_data.payload.update.trace;
+        if (trace->sampled != 0)
+        {
+            long long now = timestamp_now();
+            stats_histogram_add(&sensor_to_cloud, (now - trace->sampled) * 1000);
+            stats_histogram_add(&sensor_to_controller, (trace->received - trace->sampled) * 1000);
+            stats_histogram_add(&in_controller, (trace->forwarded - trace->received) * 1000);
+            stats_histogram_add(&controller_to_cloud, (now - trace->forwarded) * 1000);
+        }
+    }
+
+    if (sensor_to_cloud.count > 0)
+    {
+        stats_histogram_print(stdout, "[PARENT] Sensor to Cloud latency", &sensor_to_cloud);
+        stats_histogram_print(stdout, "[PARENT]   Sensor to Controller", &sensor_to_controller);
+        stats_histogram_print(stdout, "[PARENT]   Within Controller", &in_controller);
+        stats_histogram_print(stdout, "[PARENT]   Controller to Cloud", &controller_to_cloud);
     }
 
     kill(child_pid, SIGINT);
@@ -21,7 +21,7 @@
  * from a Sensor proess exeeds the pre-configured threshold, the
  * child process will trigger a action by sending a command to an
  * Actuator process. The Actuator echos the message it receives. The
- * child also raises a signal and sends it to the parent process,
+ * child also notifies the parent process through an eventfd,
  * indicating the parent to read a specific mmessage from the
  * message queue. The message contains information for the sensor,
  * sensing data, and the action.
@@ -31,6 +31,32 @@
  * parent should relay any information received from the client to
  * the Cloud process.
  *
+ * Both processes log through a ring drained by a writer thread, so
+ * that a slow terminal or pipe on stdout does not stall either loop.
+ *
+ * With -C, Gets are answered from the latest reading the child has
+ * received from the Sensor, as long as it is recent enough, without a
+ * round trip to the Sensor.
+ *
+ * With -D, every reading is also appended to an on-disk store, one
+ * writer per shard, from which the Cloud can ask for the readings of
+ * a Sensor over a range of time without reaching the Sensor. Those
+ * requests are answered by a thread of their own, so that reading the
+ * segment files does not hold up any shard.
+ *
+ * With -A, the child keeps streaming aggregates of every Sensor's
+ * readings and sends them to the Cloud once per interval, in place of
+ * an update for every reading that reaches the threshold.
+ *
+ * With -R, readings are checked against rules loaded from a file in
+ * place of the Sensor's threshold, and the rules that fire decide what
+ * the Actuators are sent. The file may also set the thresholds of
+ * Sensors and route Sensors to Actuators by name. SIGHUP, or Reload
+ * from the Cloud, loads it again while the Controller runs. Each shard
+ * switches to the new rules between two of its messages, so none are
+ * held up or dropped, and the old rules are freed once every shard has
+ * let go of them.
+ *
  */
 #include <stdlib.h>
 #include <stdio.h>
@@ -40,46 +66,187 @@
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <pthread.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/msg.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "message_queue.h"
+#include "aggregate.h"
 #include "fifo.h"
+#include "log.h"
 #include "queue.h"
-
-#define MAX_DEVICES 256
-
-struct device_info
+#include "registry.h"
+#include "rules.h"
+#include "series.h"
+#include "shard.h"
+#include "stats.h"
+#include "threshold.h"
+#include "timestamp.h"
+#include "transport.h"
+
+#define SHARDS_PER_WORKER 4
+#define SHARD_INBOX_CAPACITY 256
+#define RANGE_QUEUE_CAPACITY 16     // Range requests waiting to be answered
+
+// Seconds between checks that registered devices are still running
+#define LIVENESS_INTERVAL 2
+
+// State of the child process shared by its worker threads
+struct child_state
 {
     pid_t pid;
-    char name[MAX_NAME_LENGTH];
-    char device_type;
-    int threshold;
-    int actuator_index;
+    pid_t ppid;
+    int msgid;
+    int sequence_number;
+    struct shard_pool pool;
+
+    // Protects the queues of devices waiting to be paired. A new device
+    // is routed to the oldest unpaired device of the other type; further
+    // routes are added from the Cloud. The queues hold pids, and the
+    // unpaired registry holds the queue of each device still waiting.
+    pthread_mutex_t mapping_lock;
+    struct queue *unmapped_sensor_queue;
+    struct queue *unmapped_actuator_queue;
+    struct registry *unpaired;
+
+    // Every registered device, so that maps in the rules file can find
+    // devices by name. Also protected by the mapping lock.
+    struct registry *directory;
+
+    // Reading store of each shard, or NULL if readings are not stored.
+    // A shard's store is only written by the thread handling the shard.
+    struct series_store *series;
+
+    // Rules each shard checks readings against, or NULL without -R. A
+    // shard only reads its own entry, which it replaces with its pending
+    // entry when told rules were reloaded. Pending entries are swapped
+    // atomically, since the receiving thread fills them.
+    struct rule_set **rules;
+    struct rule_set **pending_rules;
+
+    // Range requests from the Cloud waiting for the range thread, which
+    // is only started with -D. Protected by the range lock.
+    pthread_t range_thread;
+    pthread_mutex_t range_lock;
+    pthread_cond_t range_ready;
+    struct range_payload range_requests[RANGE_QUEUE_CAPACITY];
+    unsigned int range_head;
+    unsigned int range_count;
+    int range_stopping;
 };
 
 void child_handler(void);
-int get_device_index(pid_t pid, struct device_info *devices, int size);
-int get_actuator_index(pid_t pid, struct device_info *devices, int size);
+void *worker_main(void *arg);
+void post_message(pid_t device_pid, struct message_struct *message, int may_block);
+void post_query(struct message_struct *message);
+void send_message(struct message_struct *message);
+void send_to_device(int msgid, struct message_struct *message);
+void send_to_parent(struct message_struct *message);
+int next_sequence_number(void);
+void handle_message(struct shard *shard, struct message_struct *rx_data);
+int find_device(struct registry *registry, pid_t device_pid, int device_type,
+        unsigned int request_id);
+void handle_map(struct shard *shard, struct message_struct *rx_data);
+void post_map_step(int kind, int step, pid_t sensor_pid, pid_t actuator_pid,
+        int msgid, pid_t device_pid);
+void send_commands(struct device_info *device, const struct message_trace *trace,
+        const char *data);
+int take_unpaired(struct queue *queue, pid_t *device_pid, int *msgid);
+void add_unpaired(struct queue *queue, struct device_info *device);
+void pair_device(struct device_info *device);
+void pair_orphan(struct shard *shard, struct device_info *device, pid_t partner_pid);
+int register_device(struct shard *shard, struct message_struct *message);
+void remove_device(struct shard *shard, int device_index, const char *reason);
+void sweep_devices(struct shard *shard);
+int owns_queue(const struct device_info *device);
+void start_timer(int signal_number, int interval_ms, void (*handler)(int));
+void post_to_shards(struct message_struct *message);
+void request_sweep(int signal_number);
+void request_window(int signal_number);
+void close_window(struct shard *shard);
+void handle_readings(struct shard *shard, int device_index,
+        const struct readings_payload *readings);
+struct rule_set *shard_rules(struct shard *shard);
+void bind_rules(struct rule_set *rules, struct device_info *device);
+void add_mapped_routes(const struct rule_set *rules, const struct rule_set *old_rules,
+        const struct device_info *device);
+void remove_mapped_routes(const struct rule_set *rules, const struct rule_set *old_rules,
+        const struct device_info *device);
+void reload_rules(void);
+void adopt_rules(struct shard *shard);
+void release_rules(struct rule_set *rules);
+void apply_rules(struct rule_set *rules, struct device_info *device,
+        const struct reading *readings, int count, long long received);
+void handle_breach(struct device_info *device, int sensor_reading,
+        const struct message_trace *trace, const char *action);
+void store_readings(struct shard *shard, pid_t device_pid, const struct reading *readings,
+        int count);
+void post_range(const struct range_payload *range);
+void *range_main(void *arg);
+void handle_range(const struct range_payload *range);
 
 void parent_handler(void);
 
-void get_message(int signal_number);
+int forward_updates(int msgid, int fifo_fd_wr);
+int forward_queries(int fifo_fd_rd);
+int send_to_child(const struct message_struct *message);
+
 void program_done(int signal_number);
+void request_dump(int signal_number);
+void request_reload(int signal_number);
 
-sig_atomic_t g_get_message_flag = 0;
 sig_atomic_t g_program_done_flag = 0;
+sig_atomic_t g_sweep_flag = 0;
+sig_atomic_t g_window_flag = 0;
+sig_atomic_t g_dump_flag = 0;
+sig_atomic_t g_reload_flag = 0;
+
+// Seconds between dumps of the stats, or 0 to dump only on SIGUSR2
+int g_stats_interval = -1;
+
+// Carries messages addressed to the child
+struct transport g_transport;
+
+struct child_state g_child;
+int g_worker_count = 1;
+
+// Gets are answered from a Sensor's latest reading if it is no older
+// than this, in microseconds, or -1 to always ask the Sensor
+long long g_cache_max_age = -1;
+
+// Directory readings are stored in, or NULL to not store them
+char *g_series_directory = NULL;
+
+// Milliseconds between aggregates sent to the Cloud, or 0 to send an
+// update for every breach instead
+int g_aggregate_interval = 0;
+
+// File rules are loaded from, or NULL to check readings against the
+// Sensor's threshold
+char *g_rules_path = NULL;
 
-int verbose = 0;
+// Rules loaded when the Controller started, which the child's shards
+// use until the file is reloaded
+struct rule_set *g_rules = NULL;
+
+// Counts messages the child has queued for the parent
+int g_notify_fd;
+
+// Queue the child sends updates on, so that the parent does not have
+// to pick them out of the devices' traffic on the shared queue
+int g_parent_msgid;
 
 int main(int argc, char* argv[])
 {
     pid_t pid;
 
-    char *name;
+    int transport_kind = TRANSPORT_MSGQUEUE;
+    int option;
 
     // Capture SIGINT to close cleanly
     struct sigaction sa;
@@ -87,15 +254,103 @@ int main(int argc, char* argv[])
     sa.sa_handler = &program_done;
     sigaction(SIGINT, &sa, 0);
 
-    if (argc < 2)
+    // SIGUSR2 dumps the stats. It is caught even when they are disabled
+    // so that it never terminates the Controller.
+    sa.sa_handler = &request_dump;
+    sigaction(SIGUSR2, &sa, 0);
+
+    // SIGHUP reloads the rules file instead of stopping the Controller
+    sa.sa_handler = &request_reload;
+    sigaction(SIGHUP, &sa, 0);
+
+    while ((option = getopt(argc, argv, "A:C:D:L:M:R:t:w:")) != -1)
+    {
+        switch (option)
+        {
+        case 'A':
+            g_aggregate_interval = atoi(optarg);
+            if (g_aggregate_interval >= 0)
+            {
+                break;
+            }
+            fprintf(stderr, "INTERVAL_MS must not be negative\n");
+            exit(EXIT_FAILURE);
+        case 'C':
+            g_cache_max_age = atoi(optarg) * 1000LL;
+            if (g_cache_max_age >= 0)
+            {
+                break;
+            }
+            fprintf(stderr, "MAX_AGE_MS must not be negative\n");
+            exit(EXIT_FAILURE);
+        case 'D':
+            g_series_directory = optarg;
+            break;
+        case 'L':
+            g_log_level = log_parse_level(optarg);
+            if (g_log_level != -1)
+            {
+                break;
+            }
+            fprintf(stderr, "LEVEL must be one of error, warn, info or debug\n");
+            exit(EXIT_FAILURE);
+        case 'M':
+            g_stats_interval = atoi(optarg);
+            if (g_stats_interval >= 0)
+            {
+                break;
+            }
+            fprintf(stderr, "INTERVAL must not be negative\n");
+            exit(EXIT_FAILURE);
+        case 'R':
+            g_rules_path = optarg;
+            break;
+        case 'w':
+            g_worker_count = atoi(optarg);
+            if (g_worker_count >= 1)
+            {
+                break;
+            }
+            fprintf(stderr, "WORKERS must be at least 1\n");
+            exit(EXIT_FAILURE);
+        case 't':
+            transport_kind = transport_parse(optarg);
+            if (transport_kind != -1)
+            {
+                break;
+            }
+            // Fall through
+        default:
+            fprintf(stderr, "Usage: controller [-A INTERVAL_MS] [-C MAX_AGE_MS] [-D DIR] [-L LEVEL] [-M INTERVAL] [-R RULES] [-t msgqueue|shm] [-w WORKERS] NAME\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 1)
     {
-        fprintf(stderr, "Usage: controller NAME\n");
+        fprintf(stderr, "Usage: controller [-A INTERVAL_MS] [-C MAX_AGE_MS] [-D DIR] [-L LEVEL] [-M INTERVAL] [-R RULES] [-t msgqueue|shm] [-w WORKERS] NAME\n");
         exit(EXIT_FAILURE);
     }
 
-    name = argv[1];
+    if (g_rules_path != NULL)
+    {
+        char error[256];
+
+        g_rules = malloc(sizeof(struct rule_set));
+        if (g_rules == NULL || rules_load(g_rules, g_rules_path, error, sizeof(error)) == -1)
+        {
+            fprintf(stderr, "Could not load rules from %s: %s\n", g_rules_path,
+                    g_rules == NULL ? "out of memory" : error);
+            exit(EXIT_FAILURE);
+        }
+        if (g_rules->uses_window && g_aggregate_interval == 0)
+        {
+            fprintf(stderr, "Rules that check mean, min, max or ewma need -A\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    printf("Controller starting.\n");
+    log_info("Controller starting.\n");
 
     // Creates a message queue
     int msgid = msgget((key_t)MESSAGE_QUEUE_ID, 0666 | IPC_CREAT);
@@ -105,7 +360,7 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
-    printf("[CONTROLLER] Flushing message queue\n");
+    log_info("[CONTROLLER] Flushing message queue\n");
 
     // Flush message queue
     if (msgctl(msgid, IPC_RMID, 0) == -1)
@@ -114,6 +369,38 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
+    // Recreates the message queue and, if selected, the shared memory
+    // ring before forking so that both processes share them
+    if (transport_open(&g_transport, transport_kind, (key_t)MESSAGE_QUEUE_ID,
+                SHM_RING_NAME, 1) == -1)
+    {
+        fprintf(stderr, "transport_open failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // Created before forking so that the child can wake the parent
+    g_notify_fd = eventfd(0, EFD_NONBLOCK);
+    if (g_notify_fd == -1)
+    {
+        fprintf(stderr, "eventfd failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    g_parent_msgid = msgget(IPC_PRIVATE, 0600);
+    if (g_parent_msgid == -1)
+    {
+        fprintf(stderr, "msgget failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // One slot for the parent, the child's receiving thread and each
+    // of its workers
+    if (g_stats_interval >= 0 && stats_init(g_worker_count + 2) == -1)
+    {
+        fprintf(stderr, "Could not map stats\n");
+        exit(EXIT_FAILURE);
+    }
+
     // Fork the process into child and parent process
     pid = fork();
 
@@ -138,410 +425,1703 @@ int main(int argc, char* argv[])
 
 void child_handler(void)
 {
-    pid_t pid = getpid();
-    pid_t ppid = getppid();
-    int msgid;
-    int sequence_number = 1;
-
-    struct device_info devices[MAX_DEVICES];
-    struct queue *unmapped_sensor_index_queue = queue_create();
-    struct queue *unmapped_actuator_index_queue = queue_create();;
-    int current_devices_index = 0;
-
-    int result;
-
     struct message_struct rx_data;
     struct message_struct tx_data;
-    int tx_data_size = sizeof(struct message_struct) - sizeof(long);
-    int rx_data_size = sizeof(struct message_struct) - sizeof(long);
-
-    memset(devices, 0, sizeof(devices));
+    pthread_t *workers = NULL;
 
-    printf("[CHILD] Started with PID=%d\n", pid);
+    g_child.pid = getpid();
+    g_child.ppid = getppid();
 
-    // Creates a message queue
-    msgid = msgget((key_t)MESSAGE_QUEUE_ID, 0666 | IPC_CREAT);
-    if (msgid == -1)
+    // The parent passes SIGHUP on as a Reload, so the child ignores it
+    // and a SIGHUP sent to the whole group reloads the rules only once
+    signal(SIGHUP, SIG_IGN);
+    if (log_start(STDOUT_FILENO) == -1)
     {
-        fprintf(stderr, "[CHILD] msgget failed with error: %d\n", errno);
+        fprintf(stderr, "[CHILD] Could not start log writer\n");
         exit(EXIT_FAILURE);
     }
+    stats_set_slot(STATS_SLOT_CHILD);
+    g_child.sequence_number = 1;
+    g_child.unmapped_sensor_queue = queue_create();
+    g_child.unmapped_actuator_queue = queue_create();
+    g_child.unpaired = registry_create();
+    g_child.directory = registry_create();
+    if (g_child.unmapped_sensor_queue == NULL || g_child.unmapped_actuator_queue == NULL
+            || g_child.unpaired == NULL || g_child.directory == NULL)
+    {
+        fprintf(stderr, "[CHILD] Could not allocate queues\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&g_child.mapping_lock, NULL);
 
-    printf("[CHILD] Ready to receive messages\n");
-
-    // No actuators mapped to any sensors yet
-    for (int i=0; i<MAX_DEVICES; i++)
+    // A single worker handles messages on this thread with one shard
+    if (shard_pool_init(&g_child.pool, g_worker_count,
+                g_worker_count > 1 ? SHARDS_PER_WORKER : 1, SHARD_INBOX_CAPACITY) == -1)
     {
-        devices[i].actuator_index = -1;
+        fprintf(stderr, "[CHILD] Could not allocate device registry\n");
+        exit(EXIT_FAILURE);
     }
 
-    while (!g_program_done_flag)
+    if (g_series_directory != NULL)
     {
-        // Block until a message is received
-        memset((void *)&rx_data, 0, sizeof(rx_data));
-        if (msgrcv(msgid, (void *)&rx_data, rx_data_size,
-                    TO_CONTROLLER, IPC_NOWAIT) == -1)
+        g_child.series = malloc(g_child.pool.shard_count * sizeof(struct series_store));
+        for (unsigned int s=0; s<g_child.pool.shard_count; s++)
         {
-            if (errno != ENOMSG)
+            if (g_child.series == NULL || series_open(&g_child.series[s], g_series_directory, s) == -1)
             {
-                fprintf(stderr, "PID=%d [CHILD] msgrcv failed with error: %d\n", pid, errno);
+                fprintf(stderr, "[CHILD] Could not store readings in %s\n", g_series_directory);
                 exit(EXIT_FAILURE);
             }
-            continue;
         }
+    }
 
-        // If received query from Parent
-        if (rx_data.fields.pid == ppid)
+    // Every shard starts with the rules loaded at startup
+    if (g_rules != NULL)
+    {
+        g_child.rules = malloc(g_child.pool.shard_count * sizeof(struct rule_set *));
+        g_child.pending_rules = calloc(g_child.pool.shard_count, sizeof(struct rule_set *));
+        if (g_child.rules == NULL || g_child.pending_rules == NULL)
+        {
+            fprintf(stderr, "[CHILD] Could not allocate rules\n");
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned int s=0; s<g_child.pool.shard_count; s++)
         {
-            printf("[CHILD] Received query from Parent.\n");
+            g_child.rules[s] = g_rules;
+        }
+        g_rules->references = g_child.pool.shard_count;
+    }
 
-            pid_t device_pid = (pid_t)rx_data.fields.threshold;
-            int device_index = get_device_index(device_pid, devices, MAX_DEVICES);
-            if (device_index == -1)
-            {
-                memset((void *)&tx_data, 0, sizeof(tx_data));
-                printf("[CHILD] Query error: Device with PID=%d does not exist.\n", device_pid);
-                char *error_format = "error: Device with PID=%d does not exist";
-                char error_string[64];
-                sprintf(error_string, error_format, device_pid);
-                strncpy(tx_data.fields.data, error_string, sizeof(tx_data.fields.data));
+    log_info("[CHILD] Started with PID=%d\n", g_child.pid);
 
-                printf("[CHILD] Sending error message to Parent process.\n");
-                tx_data.type = ppid;
+    // Picked before any worker starts, since workers share the choice
+    log_info("[CHILD] Checking thresholds with %s\n", threshold_kernel_name(threshold_kernel()));
+    if (g_rules != NULL)
+    {
+        log_info("[CHILD] Checking readings against %d rules, with %d thresholds and %d maps\n",
+                g_rules->rule_count, g_rules->threshold_count, g_rules->map_count);
+    }
 
-                if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
-                {
-                    fprintf(stderr, "[CHILD] msgsnd failed\n");
-                    exit(EXIT_FAILURE);
-                }
+    // Creates a message queue
+    g_child.msgid = msgget((key_t)MESSAGE_QUEUE_ID, 0666 | IPC_CREAT);
+    if (g_child.msgid == -1)
+    {
+        fprintf(stderr, "[CHILD] msgget failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
 
-                // Raise signal for parent process
-                kill(ppid, SIGUSR1);
-            }
-            else
+    // Only this thread should be interrupted by SIGINT and the timers'
+    // signals, so other threads are started with them blocked
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGALRM);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    if (g_worker_count > 1)
+    {
+        workers = malloc(g_worker_count * sizeof(pthread_t));
+        for (int i=0; i<g_worker_count; i++)
+        {
+            if (workers == NULL || pthread_create(&workers[i], NULL, worker_main, (void *)(long)i) != 0)
             {
-                memset((void *)&tx_data, 0, sizeof(tx_data));
-                int device_type = rx_data.fields.device_type;
-                if (devices[device_index].device_type != device_type)
-                {
-                    if (device_type == DEVICE_TYPE_SENSOR)
-                    {
-                        printf("[CHILD] Query error: Device with PID=%d is not a Sensor.\n", device_pid);
-                        char *error_format = "error: Device with PID=%d is not a Sensor";
-                        char error_string[64];
-                        sprintf(error_string, error_format, device_pid);
-                        strncpy(tx_data.fields.data, error_string, sizeof(tx_data.fields.data));
-                    }
-                    else
-                    {
-                        printf("[CHILD] Query error: Device with PID=%d is not an Actuator.\n", device_pid);
-                        char *error_format = "error: Device with PID=%d is not an Actuator";
-                        char error_string[64];
-                        sprintf(error_string, error_format, device_pid);
-                        strncpy(tx_data.fields.data, error_string, sizeof(tx_data.fields.data));
-                    }
-                    printf("[CHILD] Sending error message to Parent process.\n");
-                    tx_data.type = ppid;
-
-                    if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
-                    {
-                        fprintf(stderr, "[CHILD] msgsnd failed\n");
-                        exit(EXIT_FAILURE);
-                    }
-
-                    // Raise signal for parent process
-                    kill(ppid, SIGUSR1);
-
-                    continue;
-                }
+                fprintf(stderr, "[CHILD] Could not start worker thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        log_info("[CHILD] Started %d worker threads\n", g_worker_count);
+    }
 
-                // Constructs and sends the query to device
-                tx_data.type = device_pid;
-                strncpy(tx_data.fields.data, rx_data.fields.data, sizeof(tx_data.fields.data));
+    if (g_series_directory != NULL)
+    {
+        pthread_mutex_init(&g_child.range_lock, NULL);
+        pthread_cond_init(&g_child.range_ready, NULL);
+        if (pthread_create(&g_child.range_thread, NULL, range_main, NULL) != 0)
+        {
+            fprintf(stderr, "[CHILD] Could not start range thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-                if (rx_data.fields.device_type == DEVICE_TYPE_SENSOR)
-                {
-                    printf("[CHILD] Sending query to Sensor with PID=%d.\n", device_pid);
-                }
-                else
-                {
-                    // Threshold field is multiplexed with sequece number
-                    tx_data.fields.threshold = sequence_number;
-                    printf("[CHILD] Sending command to Actuator with PID=%d and Sequence#=%d\n",
-                            device_pid, sequence_number++);
-                }
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
-                if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
-                {
-                    fprintf(stderr, "[CHILD] msgsnd failed\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
-            continue;
+    start_timer(SIGALRM, LIVENESS_INTERVAL * 1000, &request_sweep);
+    if (g_aggregate_interval > 0)
+    {
+        start_timer(SIGUSR1, g_aggregate_interval, &request_window);
+    }
+
+    log_info("[CHILD] Ready to receive messages\n");
+
+    while (!g_program_done_flag)
+    {
+        // Every shard checks its own devices, so no registry is touched
+        // by two threads at once
+        if (g_sweep_flag)
+        {
+            g_sweep_flag = 0;
+            message_init(&tx_data, TO_CONTROLLER, MESSAGE_SWEEP, g_child.pid);
+            post_to_shards(&tx_data);
         }
 
-        // Register device if it hasn't been registered yet
-        int received_device_index = get_device_index(rx_data.fields.pid, devices, MAX_DEVICES);
-        //printf("received_device_index = %d\n", received_device_index);
-        if (received_device_index == -1)
+        // Likewise every shard closes the window of its own Sensors
+        if (g_window_flag)
         {
-            devices[current_devices_index].pid = rx_data.fields.pid;
-            strncpy(devices[current_devices_index].name, rx_data.fields.name, sizeof(devices[current_devices_index].name));
-            devices[current_devices_index].device_type = rx_data.fields.device_type;
-            devices[current_devices_index].threshold = rx_data.fields.threshold;
-            devices[current_devices_index].actuator_index = -1;
+            g_window_flag = 0;
+            message_init(&tx_data, TO_CONTROLLER, MESSAGE_WINDOW, g_child.pid);
+            post_to_shards(&tx_data);
+        }
 
-            // Map Actuator to available Sensor
-            if (rx_data.fields.device_type == DEVICE_TYPE_ACTUATOR)
-            {
-                printf("[CHILD] Actuator with PID=%d is now registered!\n", rx_data.fields.pid);
-                int unmapped_sensor_index;
-                int result = queue_remove(unmapped_sensor_index_queue, &unmapped_sensor_index);
-                if (result == -1)
-                {
-                    printf("[CHILD] There are no available Sensors at the moment. Queuing up Actuator to be mapped to next available Sensor.\n");
-                    queue_add(unmapped_actuator_index_queue, current_devices_index);
-                }
-                else
-                {
-                    printf("[CHILD] Actuator successfully mapped to available Sensor.\n");
-                    devices[unmapped_sensor_index].actuator_index = current_devices_index;
-                }
-            }
-            // Map Sensor to available Actuator
-            else if (rx_data.fields.device_type == DEVICE_TYPE_SENSOR)
+        // Block until a message is received. SIGINT and the timers
+        // interrupt the wait with EINTR so the flags are re-checked
+        // promptly.
+        if (transport_receive(&g_transport, &rx_data, TO_CONTROLLER, 0) == -1)
+        {
+            if (errno == EPROTO)
             {
-                printf("[CHILD] Sensor with PID=%d is now registered!\n", rx_data.fields.pid);
-                int unmapped_actuator_index;
-                int result = queue_remove(unmapped_actuator_index_queue, &unmapped_actuator_index);
-                if (result == -1)
-                {
-                    printf("[CHILD] There are no available Actuators at the moment. Queuing up Sensor to be mapped to next available Actuator.\n");
-                    queue_add(unmapped_sensor_index_queue, current_devices_index);
-                }
-                else
-                {
-                    printf("[CHILD] Actuator successfully mapped to available Sensor.\n");
-                    devices[current_devices_index].actuator_index = unmapped_actuator_index;
-                }
+                log_warn("[CHILD] Dropping malformed message\n");
+                continue;
             }
-
-            current_devices_index++;
-
-            // Constructs and sends an acknowledgement message to device
-            memset((void *)&tx_data, 0, sizeof(tx_data));
-            tx_data.type = rx_data.fields.pid;
-            strncpy(tx_data.fields.data, "ack", sizeof(tx_data.fields.data));
-
-            printf("[CHILD] Sending ack to Device with PID=%d\n", rx_data.fields.pid);
-            if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+            if (errno != EINTR)
             {
-                fprintf(stderr, "[CHILD] msgsnd failed\n");
+                fprintf(stderr, "PID=%d [CHILD] msgrcv failed with error: %d\n", g_child.pid, errno);
                 exit(EXIT_FAILURE);
             }
-
             continue;
         }
 
-        // Check if the message is a response to a query
-        if (strncmp(rx_data.fields.data, "query", 5) == 0)
-        {
-            // Constructs and sends an query response to the parent
-            memset((void *)&tx_data, 0, sizeof(tx_data));
-            tx_data.type = ppid;
-            strncpy(tx_data.fields.name, devices[received_device_index].name, sizeof(tx_data.fields.name));
-            tx_data.fields.threshold = devices[received_device_index].threshold;
-            tx_data.fields.sensor_reading = rx_data.fields.sensor_reading;
-            tx_data.fields.pid = rx_data.fields.pid;
-            strncpy(tx_data.fields.data, "query", sizeof(tx_data.fields.data));
+        stats_count(STATS_MESSAGES, 1);
 
-            printf("[CHILD] Sending response to query to parent\n");
-            if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
-            {
-                fprintf(stderr, "[CHILD] msgsnd failed\n");
-                exit(EXIT_FAILURE);
-            }
+        // Kinds the child only sends itself are never taken from the
+        // queue, so no other process can trigger them
+        if (rx_data.header.pid == g_child.pid || rx_data.header.kind == MESSAGE_SWEEP
+                || rx_data.header.kind == MESSAGE_WINDOW)
+        {
+            log_warn("[CHILD] Dropping internal message of kind %d from outside\n",
+                    rx_data.header.kind);
+            continue;
+        }
 
-            // Raise signal for parent process
-            kill(ppid, SIGUSR1);
+        // Stamped here rather than when the batch is handled, so that
+        // time spent waiting in a shard's inbox is counted
+        if (rx_data.header.kind == MESSAGE_READINGS)
+        {
+            rx_data.payload.readings.received = timestamp_now();
         }
 
-        // Threshold field is being multiplexed as sequence number
-        if (rx_data.fields.device_type == DEVICE_TYPE_ACTUATOR)
+        // Parent is shutting down. This also wakes the child if the
+        // SIGINT arrived just before it blocked in msgrcv.
+        if (rx_data.header.pid == g_child.ppid && rx_data.header.kind == MESSAGE_STOP)
         {
-            printf("[CHILD] Received ack from Actuator with PID=%d and Sequence#=%d\n",
-                    (int)rx_data.fields.pid, rx_data.fields.threshold);
-            continue;
+            log_info("[CHILD] Received stop from Parent.\n");
+            break;
         }
 
-        if (verbose)
+        // Requests from the Cloud are handled by the shard of the device
+        // they target first, all other messages by the shard of their
+        // sender
+        if (rx_data.header.pid == g_child.ppid && rx_data.header.kind == MESSAGE_QUERY)
+        {
+            post_query(&rx_data);
+        }
+        else if (rx_data.header.pid == g_child.ppid && rx_data.header.kind == MESSAGE_RELOAD)
+        {
+            reload_rules();
+        }
+        else if (rx_data.header.pid == g_child.ppid && rx_data.header.kind == MESSAGE_MAP)
+        {
+            post_message(rx_data.payload.map.actuator_pid, &rx_data, 1);
+        }
+        else if (rx_data.header.pid == g_child.ppid && rx_data.header.kind == MESSAGE_UNMAP)
+        {
+            post_message(rx_data.payload.map.sensor_pid, &rx_data, 1);
+        }
+        else if (rx_data.header.pid == g_child.ppid && rx_data.header.kind == MESSAGE_RANGE)
+        {
+            post_range(&rx_data.payload.range);
+        }
+        else
         {
-            printf("[CHILD] Received reading of %d from PID=%d\n", rx_data.fields.sensor_reading, rx_data.fields.pid);
+            post_message(rx_data.header.pid, &rx_data, 1);
         }
+    }
 
-        // Check if Sensor reading is above threshold
-        if (rx_data.fields.sensor_reading >= devices[received_device_index].threshold)
+    // Let the workers finish the messages already queued, and the range
+    // thread the requests already queued
+    if (g_worker_count > 1)
+    {
+        shard_pool_stop(&g_child.pool);
+        for (int i=0; i<g_worker_count; i++)
         {
-            // Find index of mapped Actuator
-            int actuator_index = get_actuator_index(rx_data.fields.pid, devices, MAX_DEVICES);
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+    }
+    if (g_series_directory != NULL)
+    {
+        pthread_mutex_lock(&g_child.range_lock);
+        g_child.range_stopping = 1;
+        pthread_cond_signal(&g_child.range_ready);
+        pthread_mutex_unlock(&g_child.range_lock);
+        pthread_join(g_child.range_thread, NULL);
+    }
 
-            if (actuator_index == -1)
-            {
-                printf("[CHILD] This Sensor is not currently mapped to any Actuators.\n");
-            }
-            else
-            {
-                // Constructs and sends a command message to an actuator
-                memset((void *)&tx_data, 0, sizeof(tx_data));
-                tx_data.type = devices[actuator_index].pid;
-                tx_data.fields.threshold = sequence_number; // Threshold field multiplex as sequence number
-                strncpy(tx_data.fields.data, "turn off", sizeof(tx_data.fields.data));
-
-                printf("[CHILD] Sending command to Actuator with PID=%d and Sequence#=%d\n",
-                        (int)tx_data.type, sequence_number++);
-                if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
-                {
-                    fprintf(stderr, "[CHILD] msgsnd failed\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
+    // Constructs and sends stop command to all device
+    for (unsigned int s=0; s<g_child.pool.shard_count; s++)
+    {
+        struct registry *registry = g_child.pool.shards[s].registry;
 
-            // Constructs and sends an update message to the parent
-            memset((void *)&tx_data, 0, sizeof(tx_data));
-            tx_data.type = ppid;
-            strncpy(tx_data.fields.name, devices[received_device_index].name, sizeof(tx_data.fields.name));
-            tx_data.fields.threshold = devices[received_device_index].threshold;
-            tx_data.fields.sensor_reading = rx_data.fields.sensor_reading;
-            tx_data.fields.pid = rx_data.fields.pid;
-            strncpy(tx_data.fields.data, "turn off", sizeof(tx_data.fields.data));
-
-            printf("[CHILD] Sending update to parent\n");
-            if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+        for (unsigned int i=0; i<registry->device_count; i++)
+        {
+            // Skip entries of removed devices
+            if (registry->devices[i].pid == 0)
             {
-                fprintf(stderr, "[CHILD] msgsnd failed\n");
-                exit(EXIT_FAILURE);
+                continue;
             }
 
-            // Raise signal for parent process
-            kill(ppid, SIGUSR1);
+            log_info("[CHILD] Sending stop to Device with PID=%d\n", registry->devices[i].pid);
+            message_init(&tx_data, registry->devices[i].pid, MESSAGE_STOP, g_child.pid);
+            send_to_device(registry->devices[i].msgid, &tx_data);
+            aggregate_destroy(registry->devices[i].aggregate);
+            free(registry->devices[i].rule_states);
         }
     }
 
-    // Constructs and sends stop command to all device
-    memset((void *)&tx_data, 0, sizeof(tx_data));
-    strncpy(tx_data.fields.data, "stop", sizeof(tx_data.fields.data));
-    for (int i=0; i<current_devices_index; i++)
+    queue_destroy(g_child.unmapped_sensor_queue);
+    queue_destroy(g_child.unmapped_actuator_queue);
+    registry_destroy(g_child.unpaired);
+    registry_destroy(g_child.directory);
+    if (g_child.rules != NULL)
     {
-        printf("[CHILD] Sending stop to Device with PID=%d\n", devices[i].pid);
-        tx_data.type = devices[i].pid;
-        if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+        for (unsigned int s=0; s<g_child.pool.shard_count; s++)
         {
-            fprintf(stderr, "[CHILD] msgsnd failed\n");
-            exit(EXIT_FAILURE);
+            release_rules(g_child.rules[s]);
+            release_rules(g_child.pending_rules[s]);
         }
+        free(g_child.rules);
+        free(g_child.pending_rules);
     }
-
-    queue_destroy(unmapped_sensor_index_queue);
-    queue_destroy(unmapped_actuator_index_queue);
-}
-
-int get_device_index(pid_t pid, struct device_info *devices, int size)
-{
-    int index = -1;
-
-    for (int i=0; i<size; i++)
+    if (g_child.series != NULL)
     {
-        if (devices[i].pid == pid)
+        for (unsigned int s=0; s<g_child.pool.shard_count; s++)
         {
-            index = i;
-            break;
+            series_close(&g_child.series[s]);
         }
+        free(g_child.series);
     }
-
-    return index;
+    shard_pool_destroy(&g_child.pool);
 }
 
-int get_actuator_index(pid_t pid, struct device_info *devices, int size)
+// Worker thread of the child process. Handles messages from the
+// shards it owns, or steals from other shards when it is idle.
+void *worker_main(void *arg)
 {
-    int index = -1;
+    unsigned int worker = (unsigned int)(long)arg;
+    struct message_struct message;
+    struct shard *shard;
 
-    for (int i=0; i<size; i++)
+    stats_set_slot(STATS_SLOT_CHILD + 1 + worker);
+
+    while ((shard = shard_pool_take(&g_child.pool, worker, &message)) != NULL)
     {
-        if (devices[i].pid == pid)
-        {
-            index = devices[i].actuator_index;
-            break;
-        }
+        handle_message(shard, &message);
+        shard_pool_release(&g_child.pool, shard);
     }
 
-    return index;
+    return NULL;
 }
 
-void parent_handler(void)
+// Hands a message to the shard owning the device with the given pid.
+// With a single worker the message is handled right away.
+void post_message(pid_t device_pid, struct message_struct *message, int may_block)
 {
-    pid_t pid = getpid();
-    int msgid;
-    int fifo_fd_wr;
-    int fifo_fd_rd;
-
-    int result;
-    int bytes_read;
-
-    struct message_struct rx_data;
-    struct message_struct tx_data;
-    int rx_data_size = sizeof(struct message_struct) - sizeof(long);
-    int tx_data_size = sizeof(struct message_struct) - sizeof(long);
+    unsigned int index = shard_index(&g_child.pool, device_pid);
 
-    struct sigaction sa;
-    memset((void *)&sa, 0, sizeof(sa));
-    sa.sa_handler = &get_message;
-    sigaction(SIGUSR1, &sa, 0);
+    if (g_worker_count == 1)
+    {
+        handle_message(&g_child.pool.shards[index], message);
+    }
+    else if (shard_pool_push(&g_child.pool, index, message, may_block) == -1)
+    {
+        fprintf(stderr, "[CHILD] Could not queue message for PID=%d\n", device_pid);
+        exit(EXIT_FAILURE);
+    }
+}
 
-    printf("[PARENT] Started with PID=%d\n", pid);
+// Hands each device of a request from the Cloud to the shard owning
+// it, as a request for that device alone. Devices on different shards
+// are then queried in parallel and answer in any order.
+void post_query(struct message_struct *message)
+{
+    struct query_payload *query = &message->payload.query;
+    pid_t device_pids[MAX_QUERY_DEVICES];
+    int count = query->count;
 
-    // Creates a message queue
-    msgid = msgget((key_t)MESSAGE_QUEUE_ID, 0666 | IPC_CREAT);
-    if (msgid == -1)
+    if (count < 0 || count > MAX_QUERY_DEVICES)
     {
-        fprintf(stderr, "[PARENT] msgget failed with error: %d\n", errno);
-        exit(EXIT_FAILURE);
+        log_warn("[CHILD] Dropping request #%u for %d devices\n", query->request_id, count);
+        return;
     }
 
-    // Check for existance of fifo by attempting to access it
-    if (access(FIFO_1_NAME, F_OK) == -1)
+    memcpy(device_pids, query->device_pids, count * sizeof(pid_t));
+    query->count = 1;
+    for (int i=0; i<count; i++)
     {
-        // Create the fifo is it does not exist
-        result = mkfifo(FIFO_1_NAME, 0777);
-        if (result != 0)
-        {
-            fprintf(stderr, "[PARENT] Could not create fifo %s\n", FIFO_1_NAME);
-            exit(EXIT_FAILURE);
-        }
+        query->device_pids[0] = device_pids[i];
+        post_message(device_pids[i], message, 1);
     }
+}
 
-    // Opens the writing end of the fifo
-    fifo_fd_wr = open(FIFO_1_NAME, O_WRONLY);
-    if (fifo_fd_wr == -1)
+// Sends a message on the parent's queue
+void send_message(struct message_struct *message)
+{
+    if (message_send(g_parent_msgid, message) == -1)
     {
-        fprintf(stderr, "[PARENT] open failed with error: %d\n", errno);
-        //fprintf(stderr, "%s\n", strerror(errno));
+        fprintf(stderr, "[CHILD] msgsnd failed\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    // Check for existance of fifo by attempting to access it
-    if (access(FIFO_2_NAME, F_OK) == -1)
+// Sends a message on a device's queue. Hosted devices and devices
+// started with -Q have their own queue, which disappears when they
+// exit, so failing to reach one is not fatal.
+void send_to_device(int msgid, struct message_struct *message)
+{
+    if (message_send(msgid, message) == -1)
     {
-        // Create the fifo is it does not exist
-        result = mkfifo(FIFO_2_NAME, 0777);
-        if (result != 0)
+        if (errno != EINVAL && errno != EIDRM)
         {
-            fprintf(stderr, "[PARENT] Could not create fifo %s\n", FIFO_2_NAME);
+            fprintf(stderr, "[CHILD] msgsnd failed with error: %d\n", errno);
             exit(EXIT_FAILURE);
         }
+        log_warn("[CHILD] Queue of Device with PID=%d is gone\n", (int)message->type);
     }
+}
 
-    // Sleep to ensure proper synchronization of cloud's child process
-    sleep(1);
+// Sends a message to the parent and wakes it up. The eventfd counts
+// every notification, so none are lost when several arrive at once.
+void send_to_parent(struct message_struct *message)
+{
+    uint64_t one = 1;
+    uint64_t handoff_start = stats_clock();
+
+    send_message(message);
+    if (write(g_notify_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        fprintf(stderr, "[CHILD] write failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    stats_stop(STATS_HANDOFF, handoff_start);
+    stats_count(STATS_UPDATES, 1);
+}
+
+// Sequence numbers are shared by all workers
+int next_sequence_number(void)
+{
+    return __atomic_fetch_add(&g_child.sequence_number, 1, __ATOMIC_RELAXED);
+}
+
+// Handles one message on behalf of the shard owning its device
+void handle_message(struct shard *shard, struct message_struct *rx_data)
+{
+    struct registry *registry = shard->registry;
+    struct message_struct tx_data;
+    pid_t pid = g_child.pid;
+    pid_t ppid = g_child.ppid;
+
+    stats_next_message();
+
+    // If received query from Parent
+    if (rx_data->header.pid == ppid && rx_data->header.kind == MESSAGE_QUERY)
+    {
+        struct query_payload *query = &rx_data->payload.query;
+        pid_t device_pid = query->device_pids[0];
+        int device_type = query->device_type;
+
+        log_info("[CHILD] Received request #%u from Parent.\n", query->request_id);
+
+        int device_index = find_device(registry, device_pid, device_type, query->request_id);
+        if (device_index == -1)
+        {
+            return;
+        }
+
+        // A recent enough reading answers a Get without asking the Sensor
+        struct device_info *device = &registry->devices[device_index];
+        if (device_type == DEVICE_TYPE_SENSOR && g_cache_max_age >= 0 && device->last_sampled != 0
+                && timestamp_now() - device->last_sampled <= g_cache_max_age)
+        {
+            message_reply(&tx_data, ppid, pid, query->request_id, device_pid, DEVICE_TYPE_SENSOR,
+                    device->last_reading, device->last_sampled);
+            log_info("[CHILD] Answering request #%u from the latest reading of Sensor with PID=%d\n",
+                    query->request_id, device_pid);
+            stats_count(STATS_CACHE_HITS, 1);
+            send_to_parent(&tx_data);
+            return;
+        }
+
+        // Constructs and sends the query to device
+        if (device_type == DEVICE_TYPE_SENSOR)
+        {
+            message_query(&tx_data, device_pid, pid, query->request_id, device_type,
+                    &device_pid, 1, query->data);
+            log_info("[CHILD] Sending query to Sensor with PID=%d.\n", device_pid);
+        }
+        else
+        {
+            int sequence_number = next_sequence_number();
+            message_command(&tx_data, device_pid, pid, sequence_number, query->request_id, NULL,
+                    query->data);
+            log_info("[CHILD] Sending command to Actuator with PID=%d and Sequence#=%d\n",
+                    device_pid, sequence_number);
+        }
+
+        send_to_device(registry->devices[device_index].msgid, &tx_data);
+        return;
+    }
+
+    // Adds or removes a route
+    if ((rx_data->header.pid == ppid || rx_data->header.pid == pid)
+            && (rx_data->header.kind == MESSAGE_MAP || rx_data->header.kind == MESSAGE_UNMAP))
+    {
+        handle_map(shard, rx_data);
+        return;
+    }
+
+    if (rx_data->header.pid == pid && rx_data->header.kind == MESSAGE_SWEEP)
+    {
+        sweep_devices(shard);
+        return;
+    }
+
+    if (rx_data->header.pid == pid && rx_data->header.kind == MESSAGE_WINDOW)
+    {
+        close_window(shard);
+        return;
+    }
+
+    if (rx_data->header.pid == pid && rx_data->header.kind == MESSAGE_RELOAD)
+    {
+        adopt_rules(shard);
+        return;
+    }
+
+    // Register device if it hasn't been registered yet
+    uint64_t lookup_start = stats_start();
+    int received_device_index = registry_lookup(registry, rx_data->header.pid);
+    stats_stop(STATS_LOOKUP, lookup_start);
+    if (rx_data->header.kind == MESSAGE_REGISTER)
+    {
+        if (received_device_index == -1)
+        {
+            received_device_index = register_device(shard, rx_data);
+        }
+
+        // Constructs and sends an acknowledgement message to device
+        message_init(&tx_data, rx_data->header.pid, MESSAGE_ACK, pid);
+
+        log_info("[CHILD] Sending ack to Device with PID=%d\n", rx_data->header.pid);
+        send_to_device(registry->devices[received_device_index].msgid, &tx_data);
+        return;
+    }
+
+    if (received_device_index == -1)
+    {
+        log_warn("[CHILD] Dropping message from unregistered Device with PID=%d\n", rx_data->header.pid);
+        return;
+    }
+
+    struct device_info *device = &registry->devices[received_device_index];
+
+    switch (rx_data->header.kind)
+    {
+    case MESSAGE_READINGS:
+        handle_readings(shard, received_device_index, &rx_data->payload.readings);
+        break;
+    case MESSAGE_QUERY_REPLY:
+    {
+        // The reply carries the time the Sensor took its reading, so
+        // both the answer and the cache age from the sample
+        struct query_reply_payload *reply = &rx_data->payload.query_reply;
+
+        // Constructs and sends an query response to the parent
+        message_reply(&tx_data, ppid, pid, reply->request_id, device->pid,
+                DEVICE_TYPE_SENSOR, reply->sensor_reading, reply->sampled);
+
+        log_info("[CHILD] Sending reply to request #%u to parent\n", reply->request_id);
+        send_to_parent(&tx_data);
+
+        // The reading is also part of one of the Sensor's batches, which
+        // may not have been sent yet. It is stored and checked when that
+        // batch arrives, so here it only refreshes the cache, unless a
+        // batch has already brought a newer one.
+        if (reply->sampled > device->last_sampled)
+        {
+            device->last_reading = reply->sensor_reading;
+            device->last_sampled = reply->sampled;
+        }
+        break;
+    }
+    case MESSAGE_DEREGISTER:
+        remove_device(shard, received_device_index, "deregistered");
+        break;
+    case MESSAGE_COMMAND_ACK:
+        stats_count(STATS_ACKS, 1);
+        if (g_stats_own != NULL)
+        {
+            struct command_ack_payload *ack = &rx_data->payload.command_ack;
+            stats_record(STATS_ACK, (timestamp_now() - ack->command_timestamp) * 1000);
+            if (ack->sampled != 0)
+            {
+                stats_record(STATS_SENSOR_TO_ACTUATOR, (ack->executed - ack->sampled) * 1000);
+            }
+        }
+        log_info("[CHILD] Received ack from Actuator with PID=%d and Sequence#=%d after %lldus\n",
+                (int)rx_data->header.pid, rx_data->payload.command_ack.sequence_number,
+                timestamp_now() - rx_data->payload.command_ack.command_timestamp);
+
+        // A Put is answered once its Actuator has carried it out
+        if (rx_data->payload.command_ack.request_id != 0)
+        {
+            message_reply(&tx_data, ppid, pid, rx_data->payload.command_ack.request_id, device->pid,
+                    DEVICE_TYPE_ACTUATOR, 0, rx_data->payload.command_ack.executed);
+            log_info("[CHILD] Sending reply to request #%u to parent\n",
+                    rx_data->payload.command_ack.request_id);
+            send_to_parent(&tx_data);
+        }
+        break;
+    default:
+        log_warn("[CHILD] Dropping message of unknown kind %d\n", rx_data->header.kind);
+        break;
+    }
+}
+
+// Returns the index of a device of the given type in the registry. If
+// there is no such device, sends an error to the parent and returns -1.
+int find_device(struct registry *registry, pid_t device_pid, int device_type,
+        unsigned int request_id)
+{
+    struct message_struct tx_data;
+    int device_index = registry_lookup(registry, device_pid);
+    char error_string[64];
+
+    if (device_index == -1)
+    {
+        log_info("[CHILD] Query error: Device with PID=%d does not exist.\n", device_pid);
+        sprintf(error_string, "Device with PID=%d does not exist", device_pid);
+    }
+    else if (registry->devices[device_index].device_type != device_type)
+    {
+        if (device_type == DEVICE_TYPE_SENSOR)
+        {
+            log_info("[CHILD] Query error: Device with PID=%d is not a Sensor.\n", device_pid);
+            sprintf(error_string, "Device with PID=%d is not a Sensor", device_pid);
+        }
+        else
+        {
+            log_info("[CHILD] Query error: Device with PID=%d is not an Actuator.\n", device_pid);
+            sprintf(error_string, "Device with PID=%d is not an Actuator", device_pid);
+        }
+        device_index = -1;
+    }
+
+    if (device_index == -1)
+    {
+        log_info("[CHILD] Sending error message to Parent process.\n");
+        message_error(&tx_data, g_child.ppid, g_child.pid, request_id, device_pid, error_string);
+        send_to_parent(&tx_data);
+    }
+
+    return device_index;
+}
+
+// Posts one step of a route change to the shard owning a device
+void post_map_step(int kind, int step, pid_t sensor_pid, pid_t actuator_pid,
+        int msgid, pid_t device_pid)
+{
+    struct message_struct tx_data;
+
+    message_map(&tx_data, TO_CONTROLLER, g_child.pid, sensor_pid, actuator_pid, msgid);
+    tx_data.header.kind = kind;
+    tx_data.payload.map.step = step;
+    post_message(device_pid, &tx_data, 0);
+}
+
+// Routes are stored with the Sensor, and each Actuator links back to
+// the Sensors routed to it so that its routes can be removed with it.
+// A Map from the Cloud first visits the Actuator's shard to validate
+// the Actuator and learn its queue, then the Sensor's shard to add the
+// route, then the Actuator's shard again to add the link. Unmap starts
+// at the Sensor's shard. Route changes are reported back to the Cloud.
+void handle_map(struct shard *shard, struct message_struct *rx_data)
+{
+    struct registry *registry = shard->registry;
+    struct map_payload *map = &rx_data->payload.map;
+    int from_cloud = rx_data->header.pid == g_child.ppid;
+    struct message_struct tx_data;
+    int device_index;
+    int result;
+
+    if (from_cloud && rx_data->header.kind == MESSAGE_MAP)
+    {
+        device_index = find_device(registry, map->actuator_pid, DEVICE_TYPE_ACTUATOR, 0);
+        if (device_index != -1)
+        {
+            post_map_step(MESSAGE_MAP, MAP_STEP_ROUTE, map->sensor_pid, map->actuator_pid,
+                    registry->devices[device_index].msgid, map->sensor_pid);
+        }
+        return;
+    }
+
+    if (from_cloud || map->step == MAP_STEP_ROUTE)
+    {
+        // Only requests from the Cloud report a missing Sensor. Other
+        // steps may race with the Sensor being removed.
+        if (from_cloud || rx_data->header.kind == MESSAGE_MAP)
+        {
+            device_index = find_device(registry, map->sensor_pid, DEVICE_TYPE_SENSOR, 0);
+        }
+        else
+        {
+            device_index = registry_lookup(registry, map->sensor_pid);
+        }
+        if (device_index == -1)
+        {
+            return;
+        }
+
+        struct device_info *device = &registry->devices[device_index];
+        if (rx_data->header.kind == MESSAGE_MAP)
+        {
+            result = registry_add_route(device, map->actuator_pid, map->msgid);
+            if (result == -1)
+            {
+                fprintf(stderr, "[CHILD] Could not allocate route\n");
+                exit(EXIT_FAILURE);
+            }
+            if (result == 0)
+            {
+                post_map_step(MESSAGE_MAP, MAP_STEP_LINK, map->sensor_pid, map->actuator_pid,
+                        device->msgid, map->actuator_pid);
+            }
+            else if (!from_cloud)
+            {
+                // Maps in the rules file are applied from both ends
+                return;
+            }
+            log_info("[CHILD] Sensor with PID=%d is now mapped to Actuator with PID=%d\n",
+                    (int)map->sensor_pid, (int)map->actuator_pid);
+            message_map(&tx_data, g_child.ppid, g_child.pid, map->sensor_pid, map->actuator_pid, 0);
+        }
+        else
+        {
+            if (registry_remove_route(device, map->actuator_pid) == -1)
+            {
+                if (from_cloud)
+                {
+                    char error_string[96];
+                    sprintf(error_string, "Sensor with PID=%d is not mapped to Actuator with PID=%d",
+                            (int)map->sensor_pid, (int)map->actuator_pid);
+                    log_info("[CHILD] Query error: %s.\n", error_string);
+                    message_error(&tx_data, g_child.ppid, g_child.pid, 0, map->sensor_pid,
+                            error_string);
+                    send_to_parent(&tx_data);
+                }
+                return;
+            }
+            if (from_cloud)
+            {
+                post_map_step(MESSAGE_UNMAP, MAP_STEP_LINK, map->sensor_pid, map->actuator_pid,
+                        0, map->actuator_pid);
+            }
+            log_info("[CHILD] Sensor with PID=%d is no longer mapped to Actuator with PID=%d\n",
+                    (int)map->sensor_pid, (int)map->actuator_pid);
+            message_unmap(&tx_data, g_child.ppid, g_child.pid, map->sensor_pid, map->actuator_pid);
+        }
+
+        send_to_parent(&tx_data);
+        if (rx_data->header.kind == MESSAGE_UNMAP && !from_cloud)
+        {
+            pair_orphan(shard, device, map->actuator_pid);
+        }
+        return;
+    }
+
+    // MAP_STEP_LINK, on the Actuator's shard
+    device_index = registry_lookup(registry, map->actuator_pid);
+    if (rx_data->header.kind == MESSAGE_UNMAP)
+    {
+        if (device_index != -1
+                && registry_remove_route(&registry->devices[device_index], map->sensor_pid) == 0)
+        {
+            pair_orphan(shard, &registry->devices[device_index], map->sensor_pid);
+        }
+    }
+    else if (device_index == -1)
+    {
+        // The Actuator was removed before the route was linked
+        post_map_step(MESSAGE_UNMAP, MAP_STEP_ROUTE, map->sensor_pid, map->actuator_pid,
+                0, map->sensor_pid);
+    }
+    else if (registry_add_route(&registry->devices[device_index], map->sensor_pid, map->msgid) == -1)
+    {
+        fprintf(stderr, "[CHILD] Could not allocate route\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Takes the oldest device waiting in a pairing queue. Devices leave the
+// queue when they are removed, but any not in the unpaired set are
+// skipped all the same. Must be called with the mapping lock held.
+int take_unpaired(struct queue *queue, pid_t *device_pid, int *msgid)
+{
+    int candidate;
+
+    while (queue_remove(queue, &candidate) == 0)
+    {
+        int index = registry_lookup(g_child.unpaired, candidate);
+        if (index != -1)
+        {
+            *device_pid = candidate;
+            *msgid = g_child.unpaired->devices[index].msgid;
+            registry_remove(g_child.unpaired, candidate);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// Waits in a pairing queue for a device of the other type. Must be
+// called with the mapping lock held.
+void add_unpaired(struct queue *queue, struct device_info *device)
+{
+    int index = registry_insert(g_child.unpaired, device->pid);
+    if (index == -1 || queue_add(queue, device->pid) == -1)
+    {
+        fprintf(stderr, "[CHILD] Could not queue Device with PID=%d for pairing\n", device->pid);
+        exit(EXIT_FAILURE);
+    }
+    g_child.unpaired->devices[index].msgid = device->msgid;
+}
+
+// Routes a device to the oldest unpaired device of the other type or,
+// if there is none, queues it to wait for one
+void pair_device(struct device_info *device)
+{
+    int is_sensor = device->device_type == DEVICE_TYPE_SENSOR;
+    pid_t partner_pid;
+    int partner_msgid;
+
+    pthread_mutex_lock(&g_child.mapping_lock);
+    int result = take_unpaired(is_sensor ? g_child.unmapped_actuator_queue
+            : g_child.unmapped_sensor_queue, &partner_pid, &partner_msgid);
+    if (result == -1 && registry_lookup(g_child.unpaired, device->pid) == -1)
+    {
+        add_unpaired(is_sensor ? g_child.unmapped_sensor_queue : g_child.unmapped_actuator_queue,
+                device);
+    }
+    pthread_mutex_unlock(&g_child.mapping_lock);
+
+    if (result == -1)
+    {
+        log_info(is_sensor
+                ? "[CHILD] There are no available Actuators at the moment. Queuing up Sensor to be mapped to next available Actuator.\n"
+                : "[CHILD] There are no available Sensors at the moment. Queuing up Actuator to be mapped to next available Sensor.\n");
+    }
+    else if (is_sensor)
+    {
+        log_info("[CHILD] Actuator successfully mapped to available Sensor.\n");
+        post_map_step(MESSAGE_MAP, MAP_STEP_ROUTE, device->pid, partner_pid,
+                partner_msgid, device->pid);
+    }
+    else
+    {
+        // The Sensor may belong to another shard, which adds the route
+        log_info("[CHILD] Actuator successfully mapped to available Sensor.\n");
+        post_map_step(MESSAGE_MAP, MAP_STEP_ROUTE, partner_pid, device->pid,
+                device->msgid, partner_pid);
+    }
+}
+
+// Pairs a device again once the device at the other end of its last
+// route has been removed, unless the rules file maps it. Routes the
+// Cloud or a reload removed are left as they are, since the device at
+// the other end is still registered.
+void pair_orphan(struct shard *shard, struct device_info *device, pid_t partner_pid)
+{
+    struct rule_set *rules = shard_rules(shard);
+
+    if (device->route_count > 0 || (rules != NULL && (device->device_type == DEVICE_TYPE_SENSOR
+                    ? rules_mapped(rules, device->name, NULL) : rules_mapped(rules, NULL, device->name))))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&g_child.mapping_lock);
+    int removed = registry_lookup(g_child.directory, partner_pid) == -1;
+    pthread_mutex_unlock(&g_child.mapping_lock);
+
+    if (removed)
+    {
+        log_info("[CHILD] Device with PID=%d lost its last route and will be mapped again.\n",
+                device->pid);
+        pair_device(device);
+    }
+}
+
+// Adds a newly seen device to its shard's registry and maps it to the
+// devices the rules file maps it to or, if the file names none, to an
+// unmapped device of the other type, if there is one. Returns the
+// device's index in the registry.
+int register_device(struct shard *shard, struct message_struct *message)
+{
+    pid_t device_pid = message->header.pid;
+    struct register_payload *reg = &message->payload.reg;
+    struct rule_set *rules = shard_rules(shard);
+
+    int new_device_index = registry_insert(shard->registry, device_pid);
+    if (new_device_index == -1)
+    {
+        fprintf(stderr, "[CHILD] Could not register Device with PID=%d\n", device_pid);
+        exit(EXIT_FAILURE);
+    }
+
+    struct device_info *device = &shard->registry->devices[new_device_index];
+    strncpy(device->name, reg->name, sizeof(device->name) - 1);
+    device->name[sizeof(device->name) - 1] = '\0';
+    device->device_type = reg->device_type;
+    device->threshold = reg->threshold;
+    device->base_threshold = reg->threshold;
+    device->msgid = reg->reply_msgid == REPLY_SHARED_QUEUE ? g_child.msgid : reg->reply_msgid;
+    device->host_pid = reg->host_pid;
+
+    if (reg->device_type == DEVICE_TYPE_SENSOR && g_aggregate_interval > 0)
+    {
+        device->aggregate = aggregate_create();
+        if (device->aggregate == NULL)
+        {
+            fprintf(stderr, "[CHILD] Could not allocate aggregates\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    device->rule_slot = -1;
+    if (reg->device_type == DEVICE_TYPE_SENSOR)
+    {
+        bind_rules(rules, device);
+    }
+
+    pthread_mutex_lock(&g_child.mapping_lock);
+    int index = registry_insert(g_child.directory, device_pid);
+    if (index == -1)
+    {
+        fprintf(stderr, "[CHILD] Could not register Device with PID=%d\n", device_pid);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(g_child.directory->devices[index].name, device->name);
+    g_child.directory->devices[index].device_type = device->device_type;
+    g_child.directory->devices[index].msgid = device->msgid;
+    pthread_mutex_unlock(&g_child.mapping_lock);
+
+    // Devices the rules file maps are only routed as it says
+    if (rules != NULL && (reg->device_type == DEVICE_TYPE_SENSOR
+                ? rules_mapped(rules, device->name, NULL) : rules_mapped(rules, NULL, device->name)))
+    {
+        log_info("[CHILD] %s with PID=%d is now registered! Mapping it as the rules file says.\n",
+                reg->device_type == DEVICE_TYPE_SENSOR ? "Sensor" : "Actuator", device_pid);
+        add_mapped_routes(rules, NULL, device);
+    }
+    // Map Actuator to available Sensor
+    else if (reg->device_type == DEVICE_TYPE_ACTUATOR)
+    {
+        log_info("[CHILD] Actuator with PID=%d is now registered!\n", device_pid);
+        pair_device(device);
+    }
+    // Map Sensor to available Actuator
+    else if (reg->device_type == DEVICE_TYPE_SENSOR)
+    {
+        log_info("[CHILD] Sensor with PID=%d is now registered!\n", device_pid);
+        pair_device(device);
+    }
+
+    return new_device_index;
+}
+
+// Removes a device from its shard. It leaves the pairing queues and the
+// directory, linked devices in other shards are told to drop their
+// routes to it, and messages still waiting for it on the shared queue
+// are discarded. It leaves the directory first, so that a linked device
+// whose last route it was can tell the route went with the device.
+void remove_device(struct shard *shard, int device_index, const char *reason)
+{
+    struct device_info *device = &shard->registry->devices[device_index];
+    pid_t device_pid = device->pid;
+    struct message_struct rx_data;
+    int purged = 0;
+
+    pthread_mutex_lock(&g_child.mapping_lock);
+    if (registry_lookup(g_child.unpaired, device_pid) != -1)
+    {
+        queue_remove_item(device->device_type == DEVICE_TYPE_SENSOR
+                ? g_child.unmapped_sensor_queue : g_child.unmapped_actuator_queue, device_pid);
+        registry_remove(g_child.unpaired, device_pid);
+    }
+    registry_remove(g_child.directory, device_pid);
+    pthread_mutex_unlock(&g_child.mapping_lock);
+
+    for (unsigned int i=0; i<device->route_count; i++)
+    {
+        pid_t linked_pid = device->routes[i].pid;
+        if (device->device_type == DEVICE_TYPE_SENSOR)
+        {
+            post_map_step(MESSAGE_UNMAP, MAP_STEP_LINK, device_pid, linked_pid, 0, linked_pid);
+        }
+        else
+        {
+            post_map_step(MESSAGE_UNMAP, MAP_STEP_ROUTE, linked_pid, device_pid, 0, linked_pid);
+        }
+    }
+
+    if (device->msgid == g_child.msgid)
+    {
+        while (message_receive(g_child.msgid, &rx_data, device_pid, IPC_NOWAIT) == 0
+                || errno == EPROTO)
+        {
+            purged++;
+        }
+    }
+
+    aggregate_destroy(device->aggregate);
+    device->aggregate = NULL;
+    free(device->rule_states);
+    device->rule_states = NULL;
+    registry_remove(shard->registry, device_pid);
+
+    log_info("[CHILD] Device with PID=%d %s. Removed it and discarded %d pending messages.\n",
+            device_pid, reason, purged);
+}
+
+// Removes every device of this shard whose process has exited
+void sweep_devices(struct shard *shard)
+{
+    struct registry *registry = shard->registry;
+
+    for (unsigned int i=0; i<registry->device_count; i++)
+    {
+        struct device_info *device = &registry->devices[i];
+        if (device->pid == 0 || kill(device->host_pid, 0) == 0 || errno != ESRCH)
+        {
+            continue;
+        }
+
+        // A queue of its own is left behind by a device that was
+        // killed. Devices of a host share it, so it may be gone already.
+        if (owns_queue(device))
+        {
+            msgctl(device->msgid, IPC_RMID, 0);
+        }
+        remove_device(shard, i, "is no longer running");
+    }
+}
+
+// Returns whether the queue a device replies on was last read by the
+// device's own process. The queue id and host pid are only what the
+// device sent when it registered, so any other queue is left to its
+// owner rather than removed with the device.
+int owns_queue(const struct device_info *device)
+{
+    struct msqid_ds info;
+
+    if (device->msgid == g_child.msgid || device->msgid == g_parent_msgid)
+    {
+        return 0;
+    }
+    if (msgctl(device->msgid, IPC_STAT, &info) == -1)
+    {
+        return 0;
+    }
+    return info.msg_lrpid == device->host_pid;
+}
+
+// Checks a batch of readings against the Sensor's threshold. The values
+// are gathered into a column first so that the whole batch is checked
+// at once, and only the readings that reach the threshold are handled.
+// If rules are loaded, they decide what the readings trigger instead.
+void handle_readings(struct shard *shard, int device_index,
+        const struct readings_payload *readings)
+{
+    struct device_info *device = &shard->registry->devices[device_index];
+    struct rule_set *rules = shard_rules(shard);
+    int values[MAX_BATCH_READINGS];
+    int count = readings->count < MAX_BATCH_READINGS ? readings->count : MAX_BATCH_READINGS;
+
+    // A Sensor sends a batch as soon as its last reading is taken
+    if (g_stats_timing && count > 0)
+    {
+        stats_record(STATS_RECEIVE,
+                (readings->received - readings->readings[count - 1].timestamp) * 1000);
+    }
+
+    for (int i=0; i<count; i++)
+    {
+        values[i] = readings->readings[i].value;
+        log_debug("[CHILD] Received reading of %d from PID=%d\n", values[i], device->pid);
+    }
+
+    // Batches are sent in the order they are taken, so the last reading
+    // is the latest
+    if (count > 0)
+    {
+        device->last_reading = values[count - 1];
+        device->last_sampled = readings->readings[count - 1].timestamp;
+    }
+
+    uint64_t threshold_start = stats_start();
+    uint64_t mask = threshold_mask(values, count, device->threshold);
+    stats_stop(STATS_THRESHOLD, threshold_start);
+
+    uint64_t store_start = stats_start();
+    store_readings(shard, device->pid, readings->readings, count);
+    stats_stop(STATS_STORE, store_start);
+
+    int breaches = __builtin_popcountll(mask);
+    if (device->aggregate != NULL)
+    {
+        uint64_t aggregate_start = stats_start();
+        aggregate_add(device->aggregate, values, count, breaches);
+        stats_stop(STATS_AGGREGATE, aggregate_start);
+    }
+
+    stats_count(STATS_READINGS, count);
+    stats_count(STATS_BREACHES, breaches);
+    if (rules != NULL && rules->rule_count > 0)
+    {
+        apply_rules(rules, device, readings->readings, count, readings->received);
+        return;
+    }
+
+    while (mask != 0)
+    {
+        int i = __builtin_ctzll(mask);
+        struct message_trace trace = { readings->readings[i].timestamp, readings->received, 0 };
+
+        handle_breach(device, values[i], &trace, "turn off");
+        mask &= mask - 1;
+    }
+}
+
+// Checks readings against the Sensor's rules, then carries out the
+// action of every rule that fires. Window values are taken once, with
+// the whole batch already added to them. The readings are traced if
+// the time they were received is known.
+void apply_rules(struct rule_set *rules, struct device_info *device,
+        const struct reading *readings, int count, long long received)
+{
+    uint64_t fired[MAX_BATCH_READINGS];
+    struct rule_input input;
+    struct window_stats window;
+
+    memset((void *)&input, 0, sizeof(input));
+    input.threshold = device->threshold;
+    if (device->aggregate != NULL)
+    {
+        aggregate_peek(device->aggregate, &window);
+        input.values[RULE_MEAN] = window.mean;
+        input.values[RULE_MIN] = window.min;
+        input.values[RULE_MAX] = window.max;
+        input.values[RULE_EWMA] = (float)device->aggregate->ewma;
+    }
+
+    uint64_t rules_start = stats_start();
+    for (int i=0; i<count; i++)
+    {
+        input.values[RULE_READING] = readings[i].value;
+        if (device->rule_slot >= 0)
+        {
+            rules_publish(rules, device->rule_slot, &input);
+        }
+        fired[i] = rules_evaluate(rules, device->rule_mask, device->rule_states, &input);
+    }
+    stats_stop(STATS_RULES, rules_start);
+
+    for (int i=0; i<count; i++)
+    {
+        struct message_trace trace = { readings[i].timestamp, received, 0 };
+
+        while (fired[i] != 0)
+        {
+            const struct rule *rule = &rules->rules[__builtin_ctzll(fired[i])];
+
+            log_debug("[CHILD] Rule '%s' fired for Sensor with PID=%d\n", rule->name, device->pid);
+            stats_count(STATS_RULES_FIRED, 1);
+            handle_breach(device, readings[i].value, received != 0 ? &trace : NULL, rule->action);
+            fired[i] &= fired[i] - 1;
+        }
+    }
+}
+
+// Returns the rules a shard checks readings against, or NULL
+struct rule_set *shard_rules(struct shard *shard)
+{
+    return g_child.rules == NULL ? NULL : g_child.rules[shard - g_child.pool.shards];
+}
+
+// Gives a Sensor the threshold and rules that a rule set has for its
+// name. Called again when its shard adopts reloaded rules, which start
+// the Sensor's progress through its rules afresh.
+void bind_rules(struct rule_set *rules, struct device_info *device)
+{
+    free(device->rule_states);
+    device->rule_states = NULL;
+    device->rule_mask = 0;
+    device->rule_slot = -1;
+    device->threshold = device->base_threshold;
+    if (rules == NULL)
+    {
+        return;
+    }
+
+    device->threshold = rules_threshold(rules, device->name, device->base_threshold);
+    device->rule_mask = rules_match(rules, device->name);
+    device->rule_slot = rules_slot(rules, device->name);
+    if (rules->rule_count > 0)
+    {
+        device->rule_states = calloc(rules->rule_count, sizeof(struct rule_state));
+        if (device->rule_states == NULL)
+        {
+            fprintf(stderr, "[CHILD] Could not allocate rule states\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Routes a device to every registered device of the other type that
+// the rules map it to, unless old_rules did already. Routes that exist
+// are left as they are.
+void add_mapped_routes(const struct rule_set *rules, const struct rule_set *old_rules,
+        const struct device_info *device)
+{
+    int is_sensor = device->device_type == DEVICE_TYPE_SENSOR;
+
+    if (rules == NULL || rules->map_count == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&g_child.mapping_lock);
+    for (unsigned int i=0; i<g_child.directory->device_count; i++)
+    {
+        const struct device_info *other = &g_child.directory->devices[i];
+        if (other->pid == 0 || other->device_type == device->device_type)
+        {
+            continue;
+        }
+
+        const char *sensor = is_sensor ? device->name : other->name;
+        const char *actuator = is_sensor ? other->name : device->name;
+        if (!rules_mapped(rules, sensor, actuator)
+                || (old_rules != NULL && rules_mapped(old_rules, sensor, actuator)))
+        {
+            continue;
+        }
+
+        if (is_sensor)
+        {
+            post_map_step(MESSAGE_MAP, MAP_STEP_ROUTE, device->pid, other->pid,
+                    other->msgid, device->pid);
+        }
+        else
+        {
+            post_map_step(MESSAGE_MAP, MAP_STEP_ROUTE, other->pid, device->pid,
+                    device->msgid, other->pid);
+        }
+    }
+    pthread_mutex_unlock(&g_child.mapping_lock);
+}
+
+// Removes the routes of a device that old_rules mapped and the rules no
+// longer do. Routes added from the Cloud or by pairing are kept.
+void remove_mapped_routes(const struct rule_set *rules, const struct rule_set *old_rules,
+        const struct device_info *device)
+{
+    int is_sensor = device->device_type == DEVICE_TYPE_SENSOR;
+    unsigned int count = device->route_count;
+
+    if (old_rules == NULL || old_rules->map_count == 0 || count == 0)
+    {
+        return;
+    }
+
+    // With a single worker the steps are handled right away, and change
+    // the routes being looked at
+    struct route *routes = malloc(count * sizeof(struct route));
+    if (routes == NULL)
+    {
+        fprintf(stderr, "[CHILD] Could not allocate routes\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(routes, device->routes, count * sizeof(struct route));
+
+    pthread_mutex_lock(&g_child.mapping_lock);
+    for (unsigned int i=0; i<count; i++)
+    {
+        int index = registry_lookup(g_child.directory, routes[i].pid);
+        if (index == -1)
+        {
+            continue;
+        }
+
+        const char *other = g_child.directory->devices[index].name;
+        const char *sensor = is_sensor ? device->name : other;
+        const char *actuator = is_sensor ? other : device->name;
+        if (!rules_mapped(old_rules, sensor, actuator) || rules_mapped(rules, sensor, actuator))
+        {
+            continue;
+        }
+
+        pid_t sensor_pid = is_sensor ? device->pid : routes[i].pid;
+        pid_t actuator_pid = is_sensor ? routes[i].pid : device->pid;
+        post_map_step(MESSAGE_UNMAP, MAP_STEP_ROUTE, sensor_pid, actuator_pid, 0, sensor_pid);
+        post_map_step(MESSAGE_UNMAP, MAP_STEP_LINK, sensor_pid, actuator_pid, 0, actuator_pid);
+    }
+    pthread_mutex_unlock(&g_child.mapping_lock);
+
+    free(routes);
+}
+
+// Loads the rules file again and hands the new rules to every shard
+// behind the messages already queued for it. Nothing waits for the
+// shards to switch; the last one to let go of the old rules frees
+// them. If the file cannot be loaded, the shards keep the rules they
+// have and the Cloud is told why.
+void reload_rules(void)
+{
+    struct message_struct tx_data;
+    struct rule_set *rules = NULL;
+    char error[256];
+    int loaded = 0;
+
+    uint64_t reload_start = stats_clock();
+    if (g_rules_path == NULL)
+    {
+        snprintf(error, sizeof(error), "the Controller was started without -R");
+    }
+    else if ((rules = malloc(sizeof(struct rule_set))) == NULL)
+    {
+        snprintf(error, sizeof(error), "out of memory");
+    }
+    else if (rules_load(rules, g_rules_path, error, sizeof(error)) == -1)
+    {
+        // The error is filled in
+    }
+    else if (rules->uses_window && g_aggregate_interval == 0)
+    {
+        snprintf(error, sizeof(error), "rules that check mean, min, max or ewma need -A");
+    }
+    else
+    {
+        loaded = 1;
+    }
+
+    if (!loaded)
+    {
+        char error_string[MAX_DATA_LENGTH];
+
+        free(rules);
+        snprintf(error_string, sizeof(error_string), "Could not reload rules: %s", error);
+        log_error("[CHILD] %s\n", error_string);
+        message_error(&tx_data, g_child.ppid, g_child.pid, 0, 0, error_string);
+        send_to_parent(&tx_data);
+        return;
+    }
+
+    message_reload(&tx_data, g_child.ppid, g_child.pid);
+    tx_data.payload.reload.rule_count = rules->rule_count;
+    tx_data.payload.reload.threshold_count = rules->threshold_count;
+    tx_data.payload.reload.map_count = rules->map_count;
+    log_info("[CHILD] Reloaded %d rules, %d thresholds and %d maps from %s\n",
+            rules->rule_count, rules->threshold_count, rules->map_count, g_rules_path);
+
+    // Each shard holds a reference while the rules are pending. Rules
+    // still pending from an earlier reload are replaced unused.
+    rules->references = g_child.pool.shard_count;
+    for (unsigned int s=0; s<g_child.pool.shard_count; s++)
+    {
+        release_rules(__atomic_exchange_n(&g_child.pending_rules[s], rules, __ATOMIC_ACQ_REL));
+    }
+
+    // Only the counts are sent to the Cloud; the shards find the rules
+    // in their pending entries
+    send_to_parent(&tx_data);
+    message_reload(&tx_data, TO_CONTROLLER, g_child.pid);
+    post_to_shards(&tx_data);
+    stats_stop(STATS_RELOAD, reload_start);
+}
+
+// Switches a shard to its pending reloaded rules. Messages the shard
+// handled before this one were checked against the old rules and those
+// after it are checked against the new, so no batch sees a mix. Every
+// Sensor of the shard is bound to the new rules, and routes follow
+// changed maps. Nothing is pending if an earlier message of a quick
+// succession of reloads already took the latest rules.
+void adopt_rules(struct shard *shard)
+{
+    unsigned int index = shard - g_child.pool.shards;
+    struct rule_set *rules = __atomic_exchange_n(&g_child.pending_rules[index], NULL,
+            __ATOMIC_ACQ_REL);
+    struct rule_set **current = &g_child.rules[index];
+    struct rule_set *old_rules = *current;
+    struct registry *registry = shard->registry;
+
+    if (rules == NULL)
+    {
+        return;
+    }
+
+    uint64_t adopt_start = stats_clock();
+    *current = rules;
+    for (unsigned int i=0; i<registry->device_count; i++)
+    {
+        struct device_info *device = &registry->devices[i];
+        if (device->pid == 0)
+        {
+            continue;
+        }
+
+        if (device->device_type == DEVICE_TYPE_SENSOR)
+        {
+            bind_rules(rules, device);
+        }
+        remove_mapped_routes(rules, old_rules, device);
+        add_mapped_routes(rules, old_rules, device);
+    }
+
+    release_rules(old_rules);
+    stats_stop(STATS_ADOPT, adopt_start);
+}
+
+// Lets go of a shard's rules, freeing them if no other shard uses them
+void release_rules(struct rule_set *rules)
+{
+    if (rules != NULL && __atomic_sub_fetch(&rules->references, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(rules);
+    }
+}
+
+// Sends the action as a command to every Actuator the Sensor is routed
+// to and, unless the breach is only counted in the Sensor's aggregates,
+// an update to the parent. The trace of the reading, if known, travels
+// with both.
+void handle_breach(struct device_info *device, int sensor_reading,
+        const struct message_trace *trace, const char *action)
+{
+    struct message_struct tx_data;
+
+    if (device->route_count == 0)
+    {
+        log_info("[CHILD] This Sensor is not currently mapped to any Actuators.\n");
+    }
+    else
+    {
+        uint64_t dispatch_start = stats_clock();
+        send_commands(device, trace, action);
+        stats_stop(STATS_DISPATCH, dispatch_start);
+        stats_count(STATS_COMMANDS, device->route_count);
+    }
+
+    if (device->aggregate != NULL)
+    {
+        return;
+    }
+
+    // Constructs and sends an update message to the parent
+    message_update(&tx_data, g_child.ppid, g_child.pid, device->pid, device->threshold,
+            sensor_reading, trace, device->name, action);
+
+    log_info("[CHILD] Sending update to parent\n");
+    send_to_parent(&tx_data);
+}
+
+// Appends readings to the shard's store, if readings are stored. A
+// store that fails, such as when the disk is full, is given up on.
+void store_readings(struct shard *shard, pid_t device_pid, const struct reading *readings,
+        int count)
+{
+    if (g_child.series == NULL)
+    {
+        return;
+    }
+
+    struct series_store *store = &g_child.series[shard - g_child.pool.shards];
+    if (store->directory[0] != '\0' && series_append(store, device_pid, readings, count) == -1)
+    {
+        log_error("[CHILD] Could not store readings, error: %d. No longer storing readings of shard %u.\n",
+                errno, store->id);
+        series_close(store);
+        store->directory[0] = '\0';
+    }
+}
+
+// Ends the aggregation interval of every Sensor in this shard and
+// sends their aggregates to the parent, in as few messages as fit.
+// Sensors that sent nothing over the whole sliding window are left out.
+void close_window(struct shard *shard)
+{
+    struct registry *registry = shard->registry;
+    struct message_struct tx_data;
+    struct device_aggregate result;
+
+    message_aggregates(&tx_data, g_child.ppid, g_child.pid, g_aggregate_interval, AGGREGATE_PANES);
+    for (unsigned int i=0; i<registry->device_count; i++)
+    {
+        struct device_info *device = &registry->devices[i];
+        if (device->pid == 0 || device->aggregate == NULL
+                || !aggregate_close(device->aggregate, &result))
+        {
+            continue;
+        }
+
+        result.device_pid = device->pid;
+        if (message_aggregates_add(&tx_data, &result) == -1)
+        {
+            send_to_parent(&tx_data);
+            message_aggregates(&tx_data, g_child.ppid, g_child.pid, g_aggregate_interval,
+                    AGGREGATE_PANES);
+            message_aggregates_add(&tx_data, &result);
+        }
+    }
+
+    if (tx_data.payload.aggregates.count > 0)
+    {
+        log_debug("[CHILD] Sending aggregates to parent\n");
+        send_to_parent(&tx_data);
+    }
+}
+
+// Adds a stored reading to the batch being built, sending the batch to
+// the parent first if it is full
+static void add_range_reading(void *context, const struct reading *reading)
+{
+    struct message_struct *message = context;
+
+    if (message_range_reply_add(message, reading) == -1)
+    {
+        send_to_parent(message);
+        message_range_reply(message, message->type, message->header.pid,
+                message->payload.range_reply.request_id, message->payload.range_reply.device_pid);
+        message_range_reply_add(message, reading);
+    }
+}
+
+// Queues a range request for the range thread. Without -D it is
+// answered right away, since there is nothing to read. If too many
+// requests are waiting, the Cloud is sent an error rather than holding
+// up the receiving thread.
+void post_range(const struct range_payload *range)
+{
+    struct message_struct tx_data;
+
+    if (g_series_directory == NULL)
+    {
+        handle_range(range);
+        return;
+    }
+
+    pthread_mutex_lock(&g_child.range_lock);
+    int queued = g_child.range_count < RANGE_QUEUE_CAPACITY;
+    if (queued)
+    {
+        unsigned int tail = (g_child.range_head + g_child.range_count) % RANGE_QUEUE_CAPACITY;
+        g_child.range_requests[tail] = *range;
+        g_child.range_count++;
+        pthread_cond_signal(&g_child.range_ready);
+    }
+    pthread_mutex_unlock(&g_child.range_lock);
+
+    if (!queued)
+    {
+        log_warn("[CHILD] Too many range requests, rejecting request #%u\n", range->request_id);
+        message_error(&tx_data, g_child.ppid, g_child.pid, range->request_id, range->device_pid,
+                "Too many range requests");
+        send_to_parent(&tx_data);
+    }
+}
+
+// Range thread of the child process. Answers range requests one at a
+// time until the child stops and none are left.
+void *range_main(void *arg)
+{
+    struct range_payload range;
+
+    (void)arg;
+
+    pthread_mutex_lock(&g_child.range_lock);
+    for (;;)
+    {
+        while (g_child.range_count == 0 && !g_child.range_stopping)
+        {
+            pthread_cond_wait(&g_child.range_ready, &g_child.range_lock);
+        }
+        if (g_child.range_count == 0)
+        {
+            break;
+        }
+
+        range = g_child.range_requests[g_child.range_head];
+        g_child.range_head = (g_child.range_head + 1) % RANGE_QUEUE_CAPACITY;
+        g_child.range_count--;
+
+        pthread_mutex_unlock(&g_child.range_lock);
+        handle_range(&range);
+        pthread_mutex_lock(&g_child.range_lock);
+    }
+    pthread_mutex_unlock(&g_child.range_lock);
+
+    return NULL;
+}
+
+// Sends the stored readings asked for by the Cloud to the parent. They
+// are read from the segment files, which every shard publishes as it
+// writes, so no shard is involved.
+void handle_range(const struct range_payload *range)
+{
+    struct message_struct tx_data;
+    long long found = -1;
+
+    log_info("[CHILD] Received request #%u for stored readings of PID=%d.\n",
+            range->request_id, range->device_pid);
+
+    if (g_series_directory != NULL)
+    {
+        message_range_reply(&tx_data, g_child.ppid, g_child.pid, range->request_id,
+                range->device_pid);
+        found = series_range(g_series_directory, range->device_pid, range->from, range->to,
+                add_range_reading, &tx_data);
+    }
+
+    if (found == -1)
+    {
+        message_error(&tx_data, g_child.ppid, g_child.pid, range->request_id, range->device_pid,
+                g_series_directory == NULL ? "Readings are not stored" : "Could not read stored readings");
+        send_to_parent(&tx_data);
+        return;
+    }
+
+    tx_data.payload.range_reply.done = 1;
+    log_info("[CHILD] Sending %lld stored readings to parent\n", found);
+    send_to_parent(&tx_data);
+}
+
+// Sends a command to every Actuator a Sensor is routed to. Routes are
+// sorted by queue, so Actuators sharing a device host's queue are
+// adjacent and are sent one batch instead of a message each. Actuators
+// on the shared queue are separate processes and get their own message.
+void send_commands(struct device_info *device, const struct message_trace *trace,
+        const char *data)
+{
+    struct message_struct tx_data;
+    unsigned int i = 0;
+
+    while (i < device->route_count)
+    {
+        struct route *route = &device->routes[i];
+        unsigned int run = 1;
+
+        while (i + run < device->route_count && run < MAX_BATCH_COMMANDS
+                && device->routes[i + run].msgid == route->msgid)
+        {
+            run++;
+        }
+
+        if (run == 1 || route->msgid == g_child.msgid)
+        {
+            // Constructs and sends a command message to an actuator
+            int sequence_number = next_sequence_number();
+            message_command(&tx_data, route->pid, g_child.pid, sequence_number, 0, trace, data);
+
+            log_info("[CHILD] Sending command to Actuator with PID=%d and Sequence#=%d\n",
+                    (int)route->pid, sequence_number);
+            send_to_device(route->msgid, &tx_data);
+            i++;
+            continue;
+        }
+
+        message_command_batch(&tx_data, route->pid, g_child.pid, trace, data);
+        for (unsigned int j=0; j<run; j++)
+        {
+            int sequence_number = next_sequence_number();
+            message_command_batch_add(&tx_data, route[j].pid, sequence_number);
+            log_info("[CHILD] Sending command to Actuator with PID=%d and Sequence#=%d\n",
+                    (int)route[j].pid, sequence_number);
+        }
+
+        log_info("[CHILD] Sending batch of %u commands\n", run);
+        send_to_device(route->msgid, &tx_data);
+        i += run;
+    }
+}
+
+void parent_handler(void)
+{
+    pid_t pid = getpid();
+    int fifo_fd_wr;
+    int fifo_fd_rd;
+    int fifo_fd_keep;
+    int epoll_fd;
+
+    int result;
+
+    struct message_struct tx_data;
+    struct epoll_event event;
+    struct epoll_event events[2];
+
+    if (log_start(STDOUT_FILENO) == -1)
+    {
+        fprintf(stderr, "[PARENT] Could not start log writer\n");
+        exit(EXIT_FAILURE);
+    }
+    log_info("[PARENT] Started with PID=%d\n", pid);
+    stats_set_slot(STATS_SLOT_PARENT);
+
+    // Check for existance of fifo by attempting to access it
+    if (access(FIFO_1_NAME, F_OK) == -1)
+    {
+        // Create the fifo is it does not exist
+        result = mkfifo(FIFO_1_NAME, 0777);
+        if (result != 0)
+        {
+            fprintf(stderr, "[PARENT] Could not create fifo %s\n", FIFO_1_NAME);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Opens the writing end of the fifo
+    fifo_fd_wr = open(FIFO_1_NAME, O_WRONLY);
+    if (fifo_fd_wr == -1)
+    {
+        fprintf(stderr, "[PARENT] open failed with error: %d\n", errno);
+        //fprintf(stderr, "%s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Check for existance of fifo by attempting to access it
+    if (access(FIFO_2_NAME, F_OK) == -1)
+    {
+        // Create the fifo is it does not exist
+        result = mkfifo(FIFO_2_NAME, 0777);
+        if (result != 0)
+        {
+            fprintf(stderr, "[PARENT] Could not create fifo %s\n", FIFO_2_NAME);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Sleep to ensure proper synchronization of cloud's child process
+    sleep(1);
 
     // Opens the reading end of the fifo
     fifo_fd_rd = open(FIFO_2_NAME, O_RDONLY | O_NONBLOCK);
@@ -552,103 +2132,356 @@ void parent_handler(void)
         exit(EXIT_FAILURE);
     }
 
-    printf("[PARENT] Connected to Cloud via FIFO\n");
+    // Holding a writing end ourselves keeps the fifo from reporting a
+    // hang up to epoll whenever the Cloud has it closed
+    fifo_fd_keep = open(FIFO_2_NAME, O_WRONLY | O_NONBLOCK);
+    if (fifo_fd_keep == -1)
+    {
+        fprintf(stderr, "[PARENT] open failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    log_info("[PARENT] Connected to Cloud via FIFO\n");
+
+    // Waits on both the child's notifications and the Cloud's fifo
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1)
+    {
+        fprintf(stderr, "[PARENT] epoll_create1 failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    memset((void *)&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = g_notify_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, g_notify_fd, &event) == -1)
+    {
+        fprintf(stderr, "[PARENT] epoll_ctl failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    event.data.fd = fifo_fd_rd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fifo_fd_rd, &event) == -1)
+    {
+        fprintf(stderr, "[PARENT] epoll_ctl failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    long long next_dump = timestamp_now() + g_stats_interval * 1000000LL;
 
     while (!g_program_done_flag)
     {
-        if (g_get_message_flag)
+        // The child loads the rules file, so SIGHUP is passed on to it
+        if (g_reload_flag)
         {
-            // Receive update message from child
-            memset((void *)&rx_data, 0, sizeof(rx_data));
-            if (msgrcv(msgid, (void *)&rx_data, rx_data_size,
-                        pid, IPC_NOWAIT) == -1)
+            g_reload_flag = 0;
+            message_reload(&tx_data, TO_CONTROLLER, pid);
+            log_info("[PARENT] Asking Child to reload rules\n");
+            if (send_to_child(&tx_data) == -1)
             {
-                if (errno != ENOMSG)
-                {
-                    fprintf(stderr, "[PARENT] msgrcv failed with error: %d\n", errno);
-                    exit(EXIT_FAILURE);
-                }
-                continue;
+                fprintf(stderr, "[PARENT] msgsnd failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // Stats are dumped on SIGUSR2 and every interval, if enabled
+        int timeout = -1;
+        if (g_stats != NULL && g_stats_interval > 0)
+        {
+            long long now = timestamp_now();
+            if (now >= next_dump)
+            {
+                g_dump_flag = 1;
+                next_dump = now + g_stats_interval * 1000000LL;
             }
+            timeout = (next_dump - now) / 1000 + 1;
+        }
+        if (g_dump_flag)
+        {
+            g_dump_flag = 0;
+            stats_dump(stderr);
+        }
 
-            // Constructs and sends update to Cloud process
-            memset((void *)&tx_data, 0, sizeof(tx_data));
+        // Block until there is something to forward. SIGINT, SIGUSR2
+        // and SIGHUP interrupt the wait with EINTR.
+        int count = epoll_wait(epoll_fd, events, 2, timeout);
+        if (count == -1)
+        {
+            if (errno != EINTR)
+            {
+                fprintf(stderr, "[PARENT] epoll_wait failed with error: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
 
-            if (strncmp(rx_data.fields.data, "error:", 6) == 0)
+        for (int i=0; i<count; i++)
+        {
+            if (events[i].data.fd == g_notify_fd)
             {
-                printf("[PARENT] Received query error from Child. Forwarding to Cloud.\n");
-                strncpy(tx_data.fields.data, rx_data.fields.data, sizeof(tx_data.fields.data));
+                result = forward_updates(g_parent_msgid, fifo_fd_wr);
             }
             else
             {
-                strncpy(tx_data.fields.name, rx_data.fields.name, sizeof(tx_data.fields.name));
-                tx_data.fields.threshold = rx_data.fields.threshold;
-                tx_data.fields.sensor_reading = rx_data.fields.sensor_reading;
-                tx_data.fields.pid = rx_data.fields.pid;
-                printf("[PARENT] Received update from Child. Sensor: pid=%d, threshold=%d, reading=%d, command='%s'\n",
-                        rx_data.fields.pid, rx_data.fields.threshold, rx_data.fields.sensor_reading, rx_data.fields.data);
+                result = forward_queries(fifo_fd_rd);
             }
 
-            if (write(fifo_fd_wr, (void *)&tx_data, tx_data_size) == -1)
+            if (result == -1)
             {
-                fprintf(stderr, "[PARENT] write failed with error: %d\n", errno);
                 exit(EXIT_FAILURE);
             }
+        }
+    }
+
+    // Constructs and sends stop command to Child process so that it
+    // does not stay blocked waiting for device messages
+    message_init(&tx_data, TO_CONTROLLER, MESSAGE_STOP, pid);
+    log_info("[PARENT] Sending stop to Child\n");
+    if (send_to_child(&tx_data) == -1)
+    {
+        fprintf(stderr, "[PARENT] msgsnd failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Constructs and sends stop command to Cloud process
+    log_info("[PARENT] Sending stop to Cloud\n");
+    if (message_write(fifo_fd_wr, &tx_data) == -1)
+    {
+        fprintf(stderr, "[PARENT] write failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    close(epoll_fd);
+    close(fifo_fd_wr);
+    close(fifo_fd_rd);
+    close(fifo_fd_keep);
+    close(g_notify_fd);
+
+    // The child may still be sending updates until it stops
+    wait(NULL);
+    msgctl(g_parent_msgid, IPC_RMID, 0);
+
+    stats_dump(stderr);
+    stats_destroy();
+
+    transport_close(&g_transport, 1);
+}
+
+// Forwards every update and error the child has queued for the parent
+// to the Cloud process. Returns -1 on error.
+int forward_updates(int msgid, int fifo_fd_wr)
+{
+    struct message_struct rx_data;
+    uint64_t notifications;
+
+    // Resets the counter before draining, so that a message queued
+    // after this point wakes the parent again
+    if (read(g_notify_fd, &notifications, sizeof(notifications)) == -1 && errno != EAGAIN)
+    {
+        fprintf(stderr, "[PARENT] read failed with error: %d\n", errno);
+        return -1;
+    }
+
+    for (;;)
+    {
+        // Receive update message from child
+        if (message_receive(msgid, &rx_data, getpid(), IPC_NOWAIT) == -1)
+        {
+            if (errno == EPROTO)
+            {
+                continue;
+            }
+            if (errno != ENOMSG)
+            {
+                fprintf(stderr, "[PARENT] msgrcv failed with error: %d\n", errno);
+                return -1;
+            }
+            return 0;
+        }
+
+        if (rx_data.header.kind == MESSAGE_ERROR)
+        {
+            log_info("[PARENT] Received query error from Child. Forwarding to Cloud.\n");
+        }
+        else if (rx_data.header.kind == MESSAGE_RANGE_REPLY)
+        {
+            log_debug("[PARENT] Received %d stored readings for request #%u from Child. Forwarding to Cloud.\n",
+                    rx_data.payload.range_reply.count, rx_data.payload.range_reply.request_id);
+        }
+        else if (rx_data.header.kind == MESSAGE_AGGREGATES)
+        {
+            log_debug("[PARENT] Received aggregates of %d Sensors from Child. Forwarding to Cloud.\n",
+                    rx_data.payload.aggregates.count);
+        }
+        else if (rx_data.header.kind == MESSAGE_RELOAD)
+        {
+            log_info("[PARENT] Child reloaded its rules. Forwarding to Cloud.\n");
+        }
+        else if (rx_data.header.kind == MESSAGE_REPLY)
+        {
+            log_info("[PARENT] Received reply to request #%u from Child. Forwarding to Cloud.\n",
+                    rx_data.payload.reply.request_id);
+        }
+        else if (rx_data.header.kind == MESSAGE_MAP || rx_data.header.kind == MESSAGE_UNMAP)
+        {
+            log_info("[PARENT] Received route change from Child. Forwarding to Cloud.\n");
+        }
+        else
+        {
+            log_info("[PARENT] Received update from Child. Sensor: pid=%d, threshold=%d, reading=%d, command='%s'\n",
+                    rx_data.payload.update.device_pid, rx_data.payload.update.threshold,
+                    rx_data.payload.update.sensor_reading, message_update_command(&rx_data));
+        }
 
-            g_get_message_flag = 0;
+        // Forwards the update to Cloud process, noting when it left
+        if (rx_data.header.kind == MESSAGE_UPDATE && rx_data.payload.update.trace.sampled != 0)
+        {
+            rx_data.payload.update.trace.forwarded = timestamp_now();
+        }
+        uint64_t write_start = stats_clock();
+        if (message_write(fifo_fd_wr, &rx_data) == -1)
+        {
+            fprintf(stderr, "[PARENT] write failed with error: %d\n", errno);
+            return -1;
         }
+        stats_stop(STATS_FIFO_WRITE, write_start);
+        stats_count(STATS_FORWARDED, 1);
+    }
+}
+
+// Forwards every query waiting in the fifo from the Cloud process to
+// the child. Returns -1 on error.
+int forward_queries(int fifo_fd_rd)
+{
+    struct message_struct rx_data;
+    int result;
 
-        // Poll FIFO for messages from Cloud process
-        memset((void *)&rx_data, 0, sizeof(rx_data));
-        if((bytes_read = read(fifo_fd_rd, (void *)&rx_data,
-                        sizeof(rx_data))) == -1)
+    while ((result = message_read(fifo_fd_rd, &rx_data)) != 0)
+    {
+        if (result == -1)
         {
-            if (errno != 11)
+            if (errno == EAGAIN)
+            {
+                return 0;
+            }
+            // Nothing more can be read from the fifo, so the Controller
+            // shuts down as on SIGINT, stopping the child and the Cloud
+            if (errno == EPROTO)
+            {
+                fprintf(stderr, "[PARENT] Lost track of messages from Cloud. Stopping.\n");
+                g_program_done_flag = 1;
+                return 0;
+            }
+            if (errno != EBADMSG)
             {
                 fprintf(stderr, "[PARENT] read failed with error: %d\n", errno);
-                exit(EXIT_FAILURE);
+                return -1;
             }
-            //fprintf(stderr, "%s", strerror(errno));
+            fprintf(stderr, "[PARENT] Dropping malformed message from Cloud\n");
+            continue;
+        }
+
+        log_info("[PARENT] Received query from Cloud process.\n");
+
+        if (rx_data.header.kind != MESSAGE_QUERY && rx_data.header.kind != MESSAGE_MAP
+                && rx_data.header.kind != MESSAGE_UNMAP && rx_data.header.kind != MESSAGE_RANGE
+                && rx_data.header.kind != MESSAGE_RELOAD)
+        {
             continue;
         }
-        printf("[PARENT] Received query from Cloud process.\n");
 
-        // Notify child process
-        memset((void *)&tx_data, 0, tx_data_size);
-        tx_data.type = TO_CONTROLLER;
-        tx_data.fields.pid = pid;
-        tx_data.fields.device_type = rx_data.fields.device_type;
-        // Threshold multiplexed with pid of device to be queried
-        tx_data.fields.threshold = rx_data.fields.pid;
-        strncpy(tx_data.fields.data, rx_data.fields.data, sizeof(tx_data.fields.data));
+        // Forwards the query to child process as coming from the parent
+        rx_data.type = TO_CONTROLLER;
+        rx_data.header.pid = getpid();
 
-        printf("[PARENT] Sending query to Child process.\n");
-        if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+        log_info("[PARENT] Sending query to Child process.\n");
+        if (send_to_child(&rx_data) == -1)
         {
             fprintf(stderr, "[PARENT] msgsnd failed\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Sends a message to the child, waiting for room again if a signal
+// interrupts the wait. Returns -1 on error.
+int send_to_child(const struct message_struct *message)
+{
+    while (transport_send(&g_transport, message) == -1)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Hands a message to every shard, as the sweep and window ticks are
+void post_to_shards(struct message_struct *message)
+{
+    for (unsigned int s=0; s<g_child.pool.shard_count; s++)
+    {
+        if (g_worker_count == 1)
+        {
+            handle_message(&g_child.pool.shards[s], message);
+        }
+        else if (shard_pool_push(&g_child.pool, s, message, 1) == -1)
+        {
+            fprintf(stderr, "[CHILD] Could not queue message for shards\n");
             exit(EXIT_FAILURE);
         }
+    }
+}
+
+// Interrupts the child's main loop every interval_ms with the given
+// signal, whose handler sets a flag for the loop. Used to remove
+// devices that exited without deregistering and to close the
+// aggregation window.
+void start_timer(int signal_number, int interval_ms, void (*handler)(int))
+{
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    timer_t timer;
 
+    // No SA_RESTART, so that the signal interrupts the blocking receive
+    memset((void *)&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigaction(signal_number, &sa, 0);
+
+    memset((void *)&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = signal_number;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timer) == -1)
+    {
+        fprintf(stderr, "[CHILD] timer_create failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
 
-    // Constructs and sends stop command to Cloud process
-    memset((void *)&tx_data, 0, sizeof(tx_data));
-    strncpy(tx_data.fields.data, "stop", sizeof(tx_data.fields.data));
-    printf("[PARENT] Sending stop to Cloud\n");
-    if (write(fifo_fd_wr, (void *)&tx_data, tx_data_size) == -1)
+    its.it_value.tv_sec = interval_ms / 1000;
+    its.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    if (timer_settime(timer, 0, &its, NULL) == -1)
     {
-        fprintf(stderr, "[PARENT] write failed with error: %d\n", errno);
+        fprintf(stderr, "[CHILD] timer_settime failed with error: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+}
 
-    close(fifo_fd_wr);
-    close(fifo_fd_rd);
+// Signal handler for SIGALRM
+void request_sweep(int signal_number)
+{
+    g_sweep_flag = 1;
 }
 
 // Signal handler for SIGUSR1
-void get_message(int signal_number)
+void request_window(int signal_number)
 {
-    g_get_message_flag = 1;
+    g_window_flag = 1;
 }
 
 // Signal handler for SIGINT
@@ -656,3 +2489,15 @@ void program_done(int signal_number)
 {
     g_program_done_flag = 1;
 }
+
+// Signal handler for SIGUSR2
+void request_dump(int signal_number)
+{
+    g_dump_flag = 1;
+}
+
+// Signal handler for SIGHUP
+void request_reload(int signal_number)
+{
+    g_reload_flag = 1;
+}
@@ -0,0 +1,577 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: devhost.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Hosts many simulated Sensors and Actuators in a single process, for
+ * load testing the Controller with a large fleet of devices.
+ *
+ * Each hosted device has a synthetic id, which it uses in place of a
+ * pid. Ids start above the largest pid Linux hands out, so they never
+ * collide with real devices. The Controller is asked to reply on a
+ * private message queue owned by the host, where the message type is
+ * the id of the hosted device it is addressed to.
+ *
+ * A single event loop drives every device. Sensors are kept in a
+ * min-heap ordered by the time of their next sample, and a one-shot
+ * timer is armed for the earliest one. When it fires, the timer posts
+ * a wake message to the private queue, so the loop only ever blocks
+ * in msgrcv and cannot miss a wakeup. Messages to the Controller are
+ * sent without blocking; those that do not fit wait in an outbox, so
+ * the host keeps draining its own queue while the Controller is busy.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <sys/msg.h>
+
+#include "message_queue.h"
+#include "outbox.h"
+#include "timestamp.h"
+#include "transport.h"
+
+#define DEVHOST_ID_BASE (1 << 22)
+#define DEFAULT_MAX_READING 100
+#define DEFAULT_THRESHOLD 90
+#define DEFAULT_PERIOD_MS 2000
+#define OUTBOX_CAPACITY 256
+
+// Type of the messages the wake timer posts to the private queue. The
+// Controller never uses it, since hosted device ids are much larger.
+#define WAKE_TYPE TO_CONTROLLER
+
+// Retry delay for the outbox while the Controller's queue is full
+#define OUTBOX_RETRY_US 1000
+
+struct hosted_device
+{
+    pid_t id;
+    char device_type;
+    int threshold;
+    int registered;
+    int stopped;
+    int sensor_reading;
+    long long sampled;      // When sensor_reading was taken
+    long long next_sample;
+};
+
+// Min-heap of Sensor indices ordered by next_sample
+struct sample_heap
+{
+    int *items;
+    unsigned int count;
+};
+
+void program_done(int signal_number);
+void wake_host(union sigval value);
+
+sig_atomic_t g_program_done_flag = 0;
+
+struct hosted_device *g_devices;
+int g_queue_id;
+
+static int heap_before(struct sample_heap *heap, unsigned int a, unsigned int b)
+{
+    return g_devices[heap->items[a]].next_sample < g_devices[heap->items[b]].next_sample;
+}
+
+static void heap_swap(struct sample_heap *heap, unsigned int a, unsigned int b)
+{
+    int item = heap->items[a];
+    heap->items[a] = heap->items[b];
+    heap->items[b] = item;
+}
+
+static void heap_push(struct sample_heap *heap, int device_index)
+{
+    unsigned int i = heap->count++;
+    heap->items[i] = device_index;
+
+    while (i > 0 && heap_before(heap, i, (i - 1) / 2))
+    {
+        heap_swap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int heap_pop(struct sample_heap *heap)
+{
+    int top = heap->items[0];
+    unsigned int i = 0;
+
+    heap->items[0] = heap->items[--heap->count];
+    for (;;)
+    {
+        unsigned int smallest = i;
+        unsigned int left = 2 * i + 1;
+        unsigned int right = 2 * i + 2;
+
+        if (left < heap->count && heap_before(heap, left, smallest))
+        {
+            smallest = left;
+        }
+        if (right < heap->count && heap_before(heap, right, smallest))
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            break;
+        }
+        heap_swap(heap, i, smallest);
+        i = smallest;
+    }
+
+    return top;
+}
+
+// Arms the wake timer for an absolute time on the monotonic clock, in
+// microseconds. A time in the past fires at once.
+static void arm_timer(timer_t timer, long long deadline)
+{
+    struct itimerspec its;
+
+    memset((void *)&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000000;
+    its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+    {
+        its.it_value.tv_nsec = 1;
+    }
+
+    if (timer_settime(timer, TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        fprintf(stderr, "timer_settime failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int sensor_count;
+    int actuator_count;
+    int device_count;
+    int active_count;
+    int threshold = DEFAULT_THRESHOLD;
+    int max_reading = DEFAULT_MAX_READING;
+    int batch_size = 1;
+    int period_ms = DEFAULT_PERIOD_MS;
+    long base_id = DEVHOST_ID_BASE;
+    int transport_kind = TRANSPORT_MSGQUEUE;
+    int verbose = 0;
+    int option;
+
+    long long readings_sent = 0;
+    long long readings_skipped = 0;
+    long long commands_acked = 0;
+
+    struct transport transport;
+    struct outbox outbox;
+    struct sample_heap heap;
+    struct message_struct *batches = NULL;
+    struct message_struct tx_data;
+    struct message_struct rx_data;
+
+    timer_t timer;
+    struct sigevent sev;
+
+    while ((option = getopt(argc, argv, "b:i:p:t:v")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'i':
+            base_id = atol(optarg);
+            break;
+        case 'p':
+            period_ms = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 't':
+            transport_kind = transport_parse(optarg);
+            if (transport_kind != -1)
+            {
+                break;
+            }
+            // Fall through
+        default:
+            fprintf(stderr, "Usage: devhost [-b BATCH_SIZE] [-i BASE_ID] [-p PERIOD_MS] [-t msgqueue|shm] [-v] SENSORS ACTUATORS [THRESHOLD] [MAX_READING]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind < 2)
+    {
+        fprintf(stderr, "Usage: devhost [-b BATCH_SIZE] [-i BASE_ID] [-p PERIOD_MS] [-t msgqueue|shm] [-v] SENSORS ACTUATORS [THRESHOLD] [MAX_READING]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    sensor_count = atoi(argv[optind]);
+    actuator_count = atoi(argv[optind + 1]);
+    device_count = sensor_count + actuator_count;
+
+    if (argc - optind > 2)
+    {
+        threshold = atoi(argv[optind + 2]);
+    }
+
+    if (argc - optind > 3)
+    {
+        max_reading = atoi(argv[optind + 3]);
+    }
+
+    if (sensor_count < 0 || actuator_count < 0 || device_count == 0)
+    {
+        fprintf(stderr, "At least one device must be hosted\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (base_id <= WAKE_TYPE || base_id > INT_MAX - device_count)
+    {
+        fprintf(stderr, "BASE_ID(%ld) must be between %d and %d\n", base_id, WAKE_TYPE + 1,
+                INT_MAX - device_count);
+        exit(EXIT_FAILURE);
+    }
+
+    if (batch_size < 1 || batch_size > MAX_BATCH_READINGS)
+    {
+        fprintf(stderr, "BATCH_SIZE(%d) must be between 1 and %d\n", batch_size, MAX_BATCH_READINGS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (period_ms < 1)
+    {
+        fprintf(stderr, "PERIOD_MS(%d) must be at least 1\n", period_ms);
+        exit(EXIT_FAILURE);
+    }
+
+    if (threshold > max_reading)
+    {
+        fprintf(stderr, "THRESHOLD(%d) must not exceed MAX_READING(%d)\n", threshold, max_reading);
+        exit(EXIT_FAILURE);
+    }
+
+    // Capture SIGINT to close cleanly. It interrupts the blocking
+    // msgrcv, so it must not restart system calls.
+    struct sigaction sa;
+    memset((void *)&sa, 0, sizeof(sa));
+    sa.sa_handler = &program_done;
+    sigaction(SIGINT, &sa, 0);
+
+    printf("Device host starting. PID=%d, ids %ld to %ld\n", getpid(),
+            base_id, base_id + device_count - 1);
+
+    if (transport_open(&transport, transport_kind, (key_t)MESSAGE_QUEUE_ID,
+                SHM_RING_NAME, 0) == -1)
+    {
+        fprintf(stderr, "transport_open failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // The Controller replies to every hosted device on this queue
+    g_queue_id = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+    if (g_queue_id == -1)
+    {
+        fprintf(stderr, "msgget failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    memset((void *)&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_function = &wake_host;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timer) == -1)
+    {
+        fprintf(stderr, "timer_create failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    g_devices = calloc(device_count, sizeof(struct hosted_device));
+    heap.items = malloc(device_count * sizeof(int));
+    heap.count = 0;
+    int outbox_result = outbox_init(&outbox, OUTBOX_CAPACITY);
+    if (batch_size > 1)
+    {
+        batches = malloc(sensor_count * sizeof(struct message_struct));
+    }
+    if (g_devices == NULL || heap.items == NULL || outbox_result == -1
+            || (batch_size > 1 && sensor_count > 0 && batches == NULL))
+    {
+        fprintf(stderr, "Could not allocate %d devices\n", device_count);
+        exit(EXIT_FAILURE);
+    }
+
+    // Initilize random number generator
+    srand(time(NULL));
+
+    // Sensors come first, followed by Actuators. Sample times are
+    // spread over the first period so that the load is even.
+    long long start = timestamp_now();
+    long long period_us = period_ms * 1000LL;
+
+    for (int i=0; i<device_count; i++)
+    {
+        struct hosted_device *device = &g_devices[i];
+        char name[MAX_NAME_LENGTH];
+
+        device->id = base_id + i;
+        device->device_type = i < sensor_count ? DEVICE_TYPE_SENSOR : DEVICE_TYPE_ACTUATOR;
+        device->threshold = device->device_type == DEVICE_TYPE_SENSOR ? threshold : 0;
+
+        if (device->device_type == DEVICE_TYPE_SENSOR)
+        {
+            sprintf(name, "sensor-%d", device->id);
+            device->next_sample = start + period_us + period_us * i / sensor_count;
+            heap_push(&heap, i);
+
+            if (batches != NULL)
+            {
+                message_init(&batches[i], TO_CONTROLLER, MESSAGE_READINGS, device->id);
+                batches[i].payload.readings.count = 0;
+            }
+        }
+        else
+        {
+            sprintf(name, "actuator-%d", device->id);
+        }
+
+        message_register(&tx_data, device->id, device->device_type, device->threshold,
+                g_queue_id, name);
+        outbox_push(&outbox, &tx_data);
+    }
+
+    active_count = device_count;
+
+    while (!g_program_done_flag && active_count > 0)
+    {
+        long long now = timestamp_now();
+
+        // Take every sample that is due. Sensors that are not yet
+        // registered, or whose readings cannot be sent, skip a period.
+        while (heap.count > 0 && g_devices[heap.items[0]].next_sample <= now)
+        {
+            int index = heap_pop(&heap);
+            struct hosted_device *device = &g_devices[index];
+
+            if (device->stopped)
+            {
+                continue;
+            }
+
+            if (device->registered && outbox.count < (unsigned int)device_count)
+            {
+                // Generate a random number between 0 and MAX_READING
+                device->sensor_reading = rand()%(max_reading+1);
+                device->sampled = now;
+                if (verbose)
+                {
+                    printf("Sensor %d reading = %d\n", device->id, device->sensor_reading);
+                }
+
+                struct message_struct *batch = batches != NULL ? &batches[index] : &tx_data;
+                struct readings_payload *readings = &batch->payload.readings;
+                if (batches == NULL)
+                {
+                    message_init(batch, TO_CONTROLLER, MESSAGE_READINGS, device->id);
+                    readings->count = 0;
+                }
+
+                readings->readings[readings->count].timestamp = now;
+                readings->readings[readings->count].value = device->sensor_reading;
+                readings->count++;
+
+                if (readings->count == batch_size)
+                {
+                    batch->header.length = READINGS_PAYLOAD_SIZE(readings->count);
+                    outbox_push(&outbox, batch);
+                    readings->count = 0;
+                }
+                readings_sent++;
+            }
+            else if (device->registered)
+            {
+                readings_skipped++;
+            }
+
+            device->next_sample += period_us;
+            if (device->next_sample <= now)
+            {
+                device->next_sample += ((now - device->next_sample) / period_us + 1) * period_us;
+            }
+            heap_push(&heap, index);
+        }
+
+        outbox_flush(&outbox, &transport);
+
+        // Wake for the next sample, or sooner to retry the outbox
+        if (outbox.count > 0)
+        {
+            arm_timer(timer, now + OUTBOX_RETRY_US);
+        }
+        else if (heap.count > 0)
+        {
+            arm_timer(timer, g_devices[heap.items[0]].next_sample);
+        }
+
+        // Block for the next message, then handle all that are queued
+        int flags = 0;
+        for (;;)
+        {
+            if (message_receive(g_queue_id, &rx_data, 0, flags) == -1)
+            {
+                if (errno == ENOMSG || errno == EINTR)
+                {
+                    break;
+                }
+                if (errno != EPROTO)
+                {
+                    fprintf(stderr, "msgrcv failed with error: %d\n", errno);
+                    exit(EXIT_FAILURE);
+                }
+                flags = IPC_NOWAIT;
+                continue;
+            }
+            flags = IPC_NOWAIT;
+
+            if (rx_data.type == WAKE_TYPE)
+            {
+                continue;
+            }
+
+            // Acknowledge each Actuator of a batch as if it had received
+            // the command on its own
+            if (rx_data.header.kind == MESSAGE_COMMAND_BATCH)
+            {
+                struct command_batch_payload *batch = &rx_data.payload.command_batch;
+                for (int i=0; i<batch->count && i<MAX_BATCH_COMMANDS; i++)
+                {
+                    long index = batch->commands[i].actuator_pid - base_id;
+                    if (index < 0 || index >= device_count || g_devices[index].stopped)
+                    {
+                        continue;
+                    }
+                    if (verbose)
+                    {
+                        printf("Actuator %d received '%s' with Sequence#=%d from Controller\n",
+                                g_devices[index].id, batch->data, batch->commands[i].sequence_number);
+                    }
+                    message_command_ack(&tx_data, g_devices[index].id,
+                            batch->commands[i].sequence_number, 0, batch->timestamp, batch->trace.sampled);
+                    outbox_push(&outbox, &tx_data);
+                    commands_acked++;
+                }
+                continue;
+            }
+
+            long index = rx_data.type - base_id;
+            if (index < 0 || index >= device_count)
+            {
+                continue;
+            }
+
+            struct hosted_device *device = &g_devices[index];
+            if (device->stopped)
+            {
+                continue;
+            }
+
+            switch (rx_data.header.kind)
+            {
+            case MESSAGE_ACK:
+                device->registered = 1;
+                break;
+            case MESSAGE_STOP:
+                // Stopped Sensors are dropped when next taken from the heap
+                device->stopped = 1;
+                active_count--;
+                break;
+            case MESSAGE_QUERY:
+                message_query_reply(&tx_data, device->id, rx_data.payload.query.request_id,
+                        device->sensor_reading, device->sampled);
+                outbox_push(&outbox, &tx_data);
+                break;
+            case MESSAGE_COMMAND:
+                if (verbose)
+                {
+                    printf("Actuator %d received '%s' with Sequence#=%d from Controller\n",
+                            device->id, rx_data.payload.command.data,
+                            rx_data.payload.command.sequence_number);
+                }
+                message_command_ack(&tx_data, device->id, rx_data.payload.command.sequence_number,
+                        rx_data.payload.command.request_id, rx_data.payload.command.timestamp,
+                        rx_data.payload.command.trace.sampled);
+                outbox_push(&outbox, &tx_data);
+                commands_acked++;
+                break;
+            }
+        }
+    }
+
+    if (active_count == 0)
+    {
+        printf("All hosted devices were stopped by the Controller.\n");
+    }
+
+    printf("Hosted %d Sensors and %d Actuators. Readings sent=%lld, skipped=%lld, commands acked=%lld\n",
+            sensor_count, actuator_count, readings_sent, readings_skipped, commands_acked);
+
+    timer_delete(timer);
+    msgctl(g_queue_id, IPC_RMID, 0);
+
+    // The private queue is removed first, so nothing more is sent to
+    // the hosted devices while the Controller handles these
+    if (g_program_done_flag)
+    {
+        printf("Deregistering hosted devices from Controller.\n");
+        for (int i=0; i<device_count; i++)
+        {
+            if (g_devices[i].registered && !g_devices[i].stopped)
+            {
+                // Stopping does not wait for room in a full queue
+                message_init(&tx_data, TO_CONTROLLER, MESSAGE_DEREGISTER, g_devices[i].id);
+                transport_try_send(&transport, &tx_data);
+            }
+        }
+    }
+
+    transport_close(&transport, 0);
+
+    free(batches);
+    outbox_destroy(&outbox);
+    free(heap.items);
+    free(g_devices);
+
+    exit(EXIT_SUCCESS);
+}
+
+// Runs on a timer thread. Posts a message to wake the event loop; if
+// the queue is full, the loop is awake anyway.
+void wake_host(union sigval value)
+{
+    struct message_struct wake;
+
+    (void)value;
+
+    message_init(&wake, WAKE_TYPE, 0, getpid());
+    msgsnd(g_queue_id, (const void *)&wake, MESSAGE_SIZE(&wake), IPC_NOWAIT);
+}
+
+// Signal handler for SIGINT
+void program_done(int signal_number)
+{
+    g_program_done_flag = 1;
+}
@@ -0,0 +1,924 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: loadgen.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Drives the whole Sensor to Controller to Actuator to Cloud pipeline
+ * at a fixed rate and reports how it kept up. The load generator
+ * starts the Controller given after "--", takes the place of the
+ * Cloud on the fifos, and hosts the Sensors and Actuators itself, as
+ * the device host does.
+ *
+ * Readings are offered at RATE per second in total, round robin over
+ * the Sensors, whether or not the Controller keeps up. BREACH_RATIO of
+ * them reach the threshold. Readings that find the outbox full are
+ * dropped. Get and Put queries are issued QUERIES per second without
+ * waiting for earlier ones, and matched to their replies by request
+ * id. After a warmup, everything is measured over a fixed window,
+ * then the load stops and in flight messages are given time to drain
+ * before lost commands and updates are counted.
+ *
+ * Values come from a seeded generator, so two runs with the same
+ * options offer exactly the same readings.
+ *
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/msg.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "fifo.h"
+#include "message_queue.h"
+#include "outbox.h"
+#include "stats.h"
+#include "timestamp.h"
+#include "transport.h"
+
+#define LOADGEN_ID_BASE (1 << 22)
+#define THRESHOLD 50
+#define MAX_READING 100
+#define OUTBOX_CAPACITY 256
+#define OUTBOX_LIMIT 1024           // Messages waiting before readings are dropped
+#define READY_TIMEOUT_US 10000000
+#define QUERY_SLOTS 1024            // Queries in flight that can be matched to replies
+#define DRAIN_US 1000000
+#define IDLE_US 100
+#define BACKLOG_SAMPLE_US 10000
+
+struct loadgen_device
+{
+    pid_t id;
+    int registered;
+    int reading;
+    long long sampled;      // When reading was offered
+};
+
+// Totals updated by the Cloud thread and read by the main thread
+struct cloud_counts
+{
+    long long updates;          // Caused by readings, or breaches counted in aggregates
+    long long replies;          // Matched to a query in flight
+    long long errors;
+    long long messages;         // Read from the fifo
+    long long bytes;
+    int maps;
+};
+
+// Counters of the main thread, copied at the start and end of the
+// measured window
+struct device_counts
+{
+    long long offered;
+    long long sent;
+    long long dropped;
+    long long messages;
+    long long queries;
+};
+
+// Commands and updates the Controller should send for the breaches
+// offered so far. Updated by the main and device threads.
+struct expected_counts
+{
+    long long commands;
+    long long updates;
+};
+
+struct cpu_sample
+{
+    long long self;
+    long long controller;
+    long long controller_child;
+};
+
+void *devices_main(void *arg);
+void *cloud_main(void *arg);
+void controller_exited(int signal_number);
+
+sig_atomic_t g_controller_exited = 0;
+
+struct loadgen_device *g_devices;
+int g_sensor_count;
+int g_actuator_count;
+int g_fifo_rd;
+
+// Carries messages to the Controller; devices receive on g_msgid
+struct transport g_transport;
+int g_msgid;
+
+int g_registered = 0;
+long long g_commands = 0;       // Caused by readings, not Puts
+struct expected_counts g_expected;
+
+// Number of Actuators each Sensor is routed to, kept from the route
+// changes the Controller reports to the Cloud
+int *g_routes;
+
+struct cloud_counts g_cloud;
+int g_measuring = 0;
+
+// When each query in flight was sent, by request id, or 0 if the
+// slot is free
+long long g_query_sent[QUERY_SLOTS];
+
+struct stats_histogram g_sensor_to_actuator;
+struct stats_histogram g_sensor_to_cloud;
+struct stats_histogram g_get_latency;
+struct stats_histogram g_put_latency;
+
+// A small generator so that runs do not depend on the C library's
+static unsigned long long g_seed;
+
+static unsigned int next_random(void)
+{
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return (unsigned int)(g_seed >> 16);
+}
+
+static void pause_us(long us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+static long long load_counter(long long *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void add_counter(long long *counter, long long value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+// Returns the CPU time in clock ticks used by a process, or -1
+static long long cpu_ticks(pid_t pid)
+{
+    char path[64];
+    char line[1024];
+    unsigned long utime, stime;
+
+    sprintf(path, "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    char *fields = fgets(line, sizeof(line), file) != NULL ? strrchr(line, ')') : NULL;
+    fclose(file);
+
+    // utime and stime are the 12th and 13th fields after the name
+    if (fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                &utime, &stime) != 2)
+    {
+        return -1;
+    }
+
+    return (long long)(utime + stime);
+}
+
+// Returns the first child of a process, or -1
+static pid_t first_child(pid_t pid)
+{
+    char path[64];
+    int child = -1;
+
+    sprintf(path, "/proc/%d/task/%d/children", (int)pid, (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    if (fscanf(file, "%d", &child) != 1)
+    {
+        child = -1;
+    }
+    fclose(file);
+
+    return child;
+}
+
+static void sample_cpu(struct cpu_sample *sample, pid_t controller, pid_t controller_child)
+{
+    sample->self = cpu_ticks(getpid());
+    sample->controller = cpu_ticks(controller);
+    sample->controller_child = cpu_ticks(controller_child);
+}
+
+// Returns the share of one core used between two samples, or -1 if
+// the process could not be read
+static double cpu_percent(long long before, long long after, long long elapsed_us)
+{
+    if (before < 0 || after < 0)
+    {
+        return -1;
+    }
+
+    return (after - before) * 100.0 / sysconf(_SC_CLK_TCK) / (elapsed_us / 1e6);
+}
+
+static int open_fifo(const char *name, int flags)
+{
+    if (access(name, F_OK) == -1 && mkfifo(name, 0777) != 0)
+    {
+        fprintf(stderr, "Could not create fifo %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    // Blocks until the Controller opens the other end, unless it exits
+    // first
+    int fd;
+    while ((fd = open(name, flags)) == -1)
+    {
+        if (errno == EINTR && !g_controller_exited)
+        {
+            continue;
+        }
+        if (g_controller_exited)
+        {
+            fprintf(stderr, "Controller exited before opening %s\n", name);
+        }
+        else
+        {
+            fprintf(stderr, "open failed with error: %d\n", errno);
+        }
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
+// Starts the Controller with its stdout sent to log_path
+static pid_t start_controller(char *argv[], const char *log_path)
+{
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        fprintf(stderr, "fork failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0)
+    {
+        int fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+        {
+            fprintf(stderr, "Could not open %s\n", log_path);
+            _exit(EXIT_FAILURE);
+        }
+        close(fd);
+        execvp(argv[0], argv);
+        fprintf(stderr, "Could not run %s\n", argv[0]);
+        _exit(EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+// Sends a message to the Controller from the device thread
+static void send_reply(const struct message_struct *message)
+{
+    while (transport_send(&g_transport, message) == -1)
+    {
+        if (errno != EINTR)
+        {
+            fprintf(stderr, "msgsnd failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Handles a command for one hosted Actuator and acknowledges it
+static void handle_command(pid_t id, int sequence_number, unsigned int request_id,
+        long long command_timestamp, const struct message_trace *trace)
+{
+    struct message_struct tx_data;
+    long long now = timestamp_now();
+    int measuring = __atomic_load_n(&g_measuring, __ATOMIC_RELAXED);
+
+    // Commands caused by a Put are answered through the Cloud
+    if (request_id == 0)
+    {
+        add_counter(&g_commands, 1);
+        if (trace->sampled != 0 && measuring)
+        {
+            stats_histogram_add(&g_sensor_to_actuator, (now - trace->sampled) * 1000);
+        }
+    }
+
+    message_command_ack(&tx_data, id, sequence_number, request_id, command_timestamp,
+            trace->sampled);
+    send_reply(&tx_data);
+}
+
+// Marks a query in flight as answered, recording how long it took
+static void answer_query(unsigned int request_id, struct stats_histogram *latency, long long now)
+{
+    long long sent = __atomic_exchange_n(&g_query_sent[request_id % QUERY_SLOTS], 0,
+            __ATOMIC_ACQ_REL);
+
+    if (sent != 0)
+    {
+        add_counter(&g_cloud.replies, 1);
+        if (latency != NULL && __atomic_load_n(&g_measuring, __ATOMIC_RELAXED))
+        {
+            stats_histogram_add(latency, (now - sent) * 1000);
+        }
+    }
+}
+
+// Sends the next Get or Put without waiting for earlier ones to be
+// answered. Gets and Puts alternate over the Sensors and Actuators.
+static void send_query(int fifo_wr, long long now)
+{
+    static int next = 0;
+    static unsigned int request_id = 0;
+    struct message_struct tx_data;
+    pid_t id;
+
+    // Ids start at 1, since 0 marks commands not caused by a Put
+    request_id++;
+
+    int is_get = (next % 2 == 0 && g_sensor_count > 0) || g_actuator_count == 0;
+    if (is_get)
+    {
+        id = LOADGEN_ID_BASE + (next / 2) % g_sensor_count;
+        message_query(&tx_data, 0, getpid(), request_id, DEVICE_TYPE_SENSOR, &id, 1, "");
+    }
+    else
+    {
+        id = LOADGEN_ID_BASE + g_sensor_count + (next / 2) % g_actuator_count;
+        message_query(&tx_data, 0, getpid(), request_id, DEVICE_TYPE_ACTUATOR, &id, 1,
+                "loadgen put");
+    }
+    next++;
+
+    // A query still unanswered a whole lap of slots later is lost
+    __atomic_store_n(&g_query_sent[request_id % QUERY_SLOTS], now, __ATOMIC_RELEASE);
+    if (message_write(fifo_wr, &tx_data) == -1)
+    {
+        fprintf(stderr, "write failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: loadgen [-a ACTUATORS] [-b BATCH_SIZE] [-d SECONDS] [-l LOG] [-q QUERIES] [-r RATE] [-s SENSORS] [-S SEED] [-t msgqueue|shm] [-W WARMUP] [-x BREACH_RATIO] -- CONTROLLER [ARGS...]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[])
+{
+    int rate = 10000;
+    int batch_size = 1;
+    int queries_per_sec = 10;
+    int seconds = 5;
+    int warmup = 1;
+    double breach_ratio = 0.1;
+    unsigned long long seed = 1;
+    int transport_kind = TRANSPORT_MSGQUEUE;
+    const char *transport_name = "msgqueue";
+    const char *log_path = "/dev/null";
+    int option;
+
+    struct outbox outbox;
+    struct message_struct tx_data;
+    struct message_struct *batches;
+    struct device_counts counts;
+    struct device_counts begin;
+    struct device_counts end;
+    long long updates_begin = 0;
+    long long updates_end = 0;
+    long long fifo_begin[2] = { 0, 0 };
+    long long fifo_end[2] = { 0, 0 };
+    long long commands_begin = 0;
+    long long commands_end = 0;
+    struct cpu_sample cpu_begin;
+    struct cpu_sample cpu_end;
+    pthread_t cloud_thread;
+    pthread_t devices_thread;
+
+    g_sensor_count = 100;
+    g_actuator_count = 100;
+
+    while ((option = getopt(argc, argv, "a:b:d:l:q:r:s:S:t:W:x:")) != -1)
+    {
+        switch (option)
+        {
+        case 'a':
+            g_actuator_count = atoi(optarg);
+            break;
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'l':
+            log_path = optarg;
+            break;
+        case 'q':
+            queries_per_sec = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 's':
+            g_sensor_count = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'W':
+            warmup = atoi(optarg);
+            break;
+        case 'x':
+            breach_ratio = atof(optarg);
+            break;
+        case 't':
+            transport_kind = transport_parse(optarg);
+            transport_name = optarg;
+            if (transport_kind != -1)
+            {
+                break;
+            }
+            // Fall through
+        default:
+            usage();
+        }
+    }
+
+    int device_count = g_sensor_count + g_actuator_count;
+    if (argc - optind < 1 || g_sensor_count < 1 || g_actuator_count < 0 || rate < 1
+            || seconds < 1 || warmup < 0 || queries_per_sec < 0
+            || breach_ratio < 0 || breach_ratio > 1)
+    {
+        usage();
+    }
+
+    if (batch_size < 1 || batch_size > MAX_BATCH_READINGS)
+    {
+        fprintf(stderr, "BATCH_SIZE(%d) must be between 1 and %d\n", batch_size, MAX_BATCH_READINGS);
+        exit(EXIT_FAILURE);
+    }
+
+    // Zero would keep the generator at zero
+    g_seed = seed * 2654435761ULL + 1;
+
+    // The Controller is stopped with SIGINT at the end, and the fifos
+    // may close under the load generator before it notices
+    signal(SIGPIPE, SIG_IGN);
+
+    // Interrupts the blocking opens of the fifos if the Controller
+    // fails to start
+    struct sigaction sa;
+    memset((void *)&sa, 0, sizeof(sa));
+    sa.sa_handler = &controller_exited;
+    sigaction(SIGCHLD, &sa, 0);
+
+    pid_t controller = start_controller(&argv[optind], log_path);
+
+    // Opened in the same order as the Cloud, since each open blocks
+    // until the Controller has opened the other end
+    g_fifo_rd = open_fifo(FIFO_1_NAME, O_RDONLY);
+    int fifo_wr = open_fifo(FIFO_2_NAME, O_WRONLY);
+
+    // The Controller recreates its queue and ring before opening the
+    // fifos, so they are ready by now
+    if (transport_open(&g_transport, transport_kind, (key_t)MESSAGE_QUEUE_ID,
+                SHM_RING_NAME, 0) == -1)
+    {
+        fprintf(stderr, "transport_open failed with error: %d. Is the Controller using the same transport?\n",
+                errno);
+        kill(controller, SIGINT);
+        exit(EXIT_FAILURE);
+    }
+
+    g_msgid = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+    if (g_msgid == -1)
+    {
+        fprintf(stderr, "msgget failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    g_devices = calloc(device_count, sizeof(struct loadgen_device));
+    g_routes = calloc(g_sensor_count, sizeof(int));
+    batches = calloc(g_sensor_count, sizeof(struct message_struct));
+    if (g_devices == NULL || g_routes == NULL || batches == NULL
+            || outbox_init(&outbox, OUTBOX_CAPACITY) == -1)
+    {
+        fprintf(stderr, "Could not allocate %d devices\n", device_count);
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_create(&cloud_thread, NULL, cloud_main, NULL) != 0
+            || pthread_create(&devices_thread, NULL, devices_main, NULL) != 0)
+    {
+        fprintf(stderr, "Could not start threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Sensors register first, so each Actuator is paired with a Sensor
+    for (int i=0; i<device_count; i++)
+    {
+        char name[MAX_NAME_LENGTH];
+        int is_sensor = i < g_sensor_count;
+
+        g_devices[i].id = LOADGEN_ID_BASE + i;
+        sprintf(name, "%s-%d", is_sensor ? "sensor" : "actuator", g_devices[i].id);
+        message_register(&tx_data, g_devices[i].id,
+                is_sensor ? DEVICE_TYPE_SENSOR : DEVICE_TYPE_ACTUATOR,
+                is_sensor ? THRESHOLD : 0, g_msgid, name);
+        outbox_push(&outbox, &tx_data);
+
+        if (is_sensor)
+        {
+            message_init(&batches[i], TO_CONTROLLER, MESSAGE_READINGS, g_devices[i].id);
+            batches[i].payload.readings.count = 0;
+        }
+    }
+
+    // Waits for every device to be registered and paired
+    memset((void *)&counts, 0, sizeof(counts));
+    begin = counts;
+    end = counts;
+    int pairs = g_sensor_count < g_actuator_count ? g_sensor_count : g_actuator_count;
+    long long ready_deadline = timestamp_now() + READY_TIMEOUT_US;
+    int registered = 0;
+
+    while (registered < device_count || __atomic_load_n(&g_cloud.maps, __ATOMIC_RELAXED) < pairs)
+    {
+        if (timestamp_now() > ready_deadline)
+        {
+            fprintf(stderr, "Only %d of %d devices registered and %d of %d routes made\n",
+                    registered, device_count, __atomic_load_n(&g_cloud.maps, __ATOMIC_RELAXED), pairs);
+            kill(controller, SIGINT);
+            exit(EXIT_FAILURE);
+        }
+        outbox_flush(&outbox, &g_transport);
+        pause_us(1000);
+        registered = __atomic_load_n(&g_registered, __ATOMIC_RELAXED);
+    }
+
+    pid_t controller_child = first_child(controller);
+    long long load_start = timestamp_now();
+    long long window_begin = load_start + warmup * 1000000LL;
+    long long window_end = window_begin + seconds * 1000000LL;
+    long long next_query = load_start;
+    long long next_backlog = window_begin;
+    long long backlog_sum = 0;
+    long long backlog_samples = 0;
+    int backlog_max = 0;
+    unsigned int outbox_max = 0;
+    unsigned int breach_cutoff = (unsigned int)(breach_ratio * 65536);
+    int next_sensor = 0;
+    int measuring = 0;
+
+    for (;;)
+    {
+        long long now = timestamp_now();
+
+        if (!measuring && now >= window_begin)
+        {
+            measuring = 1;
+            begin = counts;
+            updates_begin = load_counter(&g_cloud.updates);
+            fifo_begin[0] = load_counter(&g_cloud.messages);
+            fifo_begin[1] = load_counter(&g_cloud.bytes);
+            commands_begin = load_counter(&g_commands);
+            sample_cpu(&cpu_begin, controller, controller_child);
+            __atomic_store_n(&g_measuring, 1, __ATOMIC_RELAXED);
+        }
+        else if (measuring && now >= window_end)
+        {
+            __atomic_store_n(&g_measuring, 0, __ATOMIC_RELAXED);
+            end = counts;
+            updates_end = load_counter(&g_cloud.updates);
+            fifo_end[0] = load_counter(&g_cloud.messages);
+            fifo_end[1] = load_counter(&g_cloud.bytes);
+            commands_end = load_counter(&g_commands);
+            sample_cpu(&cpu_end, controller, controller_child);
+            window_end = now;
+            break;
+        }
+
+        // Offers every reading that is due by now
+        long long due = (now - load_start) * rate / 1000000;
+        while (counts.offered < due)
+        {
+            int index = next_sensor;
+            struct loadgen_device *device = &g_devices[index];
+            next_sensor = (next_sensor + 1) % g_sensor_count;
+            counts.offered++;
+
+            int reading;
+            if (next_random() % 65536 < breach_cutoff)
+            {
+                reading = THRESHOLD + next_random() % (MAX_READING - THRESHOLD + 1);
+            }
+            else
+            {
+                reading = next_random() % THRESHOLD;
+            }
+
+            // Read by the device thread to answer a Get
+            __atomic_store_n(&device->reading, reading, __ATOMIC_RELAXED);
+            __atomic_store_n(&device->sampled, now, __ATOMIC_RELAXED);
+
+            if (outbox.count >= OUTBOX_LIMIT)
+            {
+                counts.dropped++;
+                continue;
+            }
+
+            struct readings_payload *readings = &batches[index].payload.readings;
+            readings->readings[readings->count].timestamp = now;
+            readings->readings[readings->count].value = reading;
+            readings->count++;
+            counts.sent++;
+            if (reading >= THRESHOLD)
+            {
+                add_counter(&g_expected.updates, 1);
+                add_counter(&g_expected.commands, __atomic_load_n(&g_routes[index], __ATOMIC_RELAXED));
+            }
+
+            if (readings->count == batch_size)
+            {
+                batches[index].header.length = READINGS_PAYLOAD_SIZE(readings->count);
+                outbox_push(&outbox, &batches[index]);
+                readings->count = 0;
+                counts.messages++;
+            }
+        }
+
+        if (queries_per_sec > 0 && now >= next_query)
+        {
+            send_query(fifo_wr, now);
+            counts.queries++;
+            next_query = now + 1000000 / queries_per_sec;
+        }
+
+        if (outbox.count > outbox_max)
+        {
+            outbox_max = outbox.count;
+        }
+        outbox_flush(&outbox, &g_transport);
+
+        if (measuring && now >= next_backlog)
+        {
+            int backlog = transport_backlog(&g_transport);
+            if (backlog > backlog_max)
+            {
+                backlog_max = backlog;
+            }
+            backlog_sum += backlog;
+            backlog_samples++;
+            next_backlog = now + BACKLOG_SAMPLE_US;
+        }
+
+        pause_us(IDLE_US);
+    }
+
+    // Readings still held in a partial batch are sent along with the
+    // outbox, then everything in flight is given time to arrive
+    for (int i=0; i<g_sensor_count; i++)
+    {
+        if (batches[i].payload.readings.count > 0)
+        {
+            batches[i].header.length = READINGS_PAYLOAD_SIZE(batches[i].payload.readings.count);
+            outbox_push(&outbox, &batches[i]);
+        }
+    }
+    long long drain_end = timestamp_now() + DRAIN_US;
+    while (timestamp_now() < drain_end)
+    {
+        outbox_flush(&outbox, &g_transport);
+        pause_us(IDLE_US);
+    }
+
+    // The Controller's parent stops its child, which stops the devices,
+    // and then tells the Cloud thread to stop
+    kill(controller, SIGINT);
+    pthread_join(cloud_thread, NULL);
+    waitpid(controller, NULL, 0);
+
+    // The device thread may be blocked in msgrcv, or in msgsnd on the
+    // Controller's queue, which nobody drains now
+    msgctl(g_msgid, IPC_RMID, 0);
+    pthread_cancel(devices_thread);
+    pthread_join(devices_thread, NULL);
+
+    double window = (window_end - window_begin) / 1e6;
+
+    printf("config transport=%s sensors=%d actuators=%d rate=%d breach_ratio=%.3f batch=%d queries=%d seconds=%d warmup=%d seed=%llu\n",
+            transport_name, g_sensor_count, g_actuator_count, rate, breach_ratio, batch_size,
+            queries_per_sec, seconds, warmup, seed);
+    printf("throughput readings_per_sec=%.0f messages_per_sec=%.0f commands_per_sec=%.0f updates_per_sec=%.0f queries_per_sec=%.1f\n",
+            (end.sent - begin.sent) / window, (end.messages - begin.messages) / window,
+            (commands_end - commands_begin) / window, (updates_end - updates_begin) / window,
+            (end.queries - begin.queries) / window);
+    printf("drops readings_offered=%lld readings_dropped=%lld commands_lost=%lld updates_lost=%lld queries_lost=%lld errors=%lld\n",
+            end.offered - begin.offered, end.dropped - begin.dropped,
+            load_counter(&g_expected.commands) - load_counter(&g_commands),
+            load_counter(&g_expected.updates) - load_counter(&g_cloud.updates),
+            counts.queries - load_counter(&g_cloud.replies), load_counter(&g_cloud.errors));
+    printf("fifo messages_per_sec=%.0f bytes_per_sec=%.0f\n",
+            (fifo_end[0] - fifo_begin[0]) / window, (fifo_end[1] - fifo_begin[1]) / window);
+    printf("backlog controller_mean=%.1f controller_max=%d outbox_max=%u\n",
+            backlog_samples > 0 ? (double)backlog_sum / backlog_samples : 0.0, backlog_max, outbox_max);
+    printf("cpu loadgen=%.1f%% controller_parent=%.1f%% controller_child=%.1f%%\n",
+            cpu_percent(cpu_begin.self, cpu_end.self, window_end - window_begin),
+            cpu_percent(cpu_begin.controller, cpu_end.controller, window_end - window_begin),
+            cpu_percent(cpu_begin.controller_child, cpu_end.controller_child, window_end - window_begin));
+    stats_histogram_print(stdout, "latency sensor_to_actuator", &g_sensor_to_actuator);
+    stats_histogram_print(stdout, "latency sensor_to_cloud", &g_sensor_to_cloud);
+    stats_histogram_print(stdout, "latency get", &g_get_latency);
+    stats_histogram_print(stdout, "latency put", &g_put_latency);
+
+    transport_close(&g_transport, 0);
+    close(fifo_wr);
+    close(g_fifo_rd);
+    outbox_destroy(&outbox);
+    free(batches);
+    free(g_routes);
+    free(g_devices);
+
+    exit(EXIT_SUCCESS);
+}
+
+// Plays the hosted devices' part. Blocks on the private queue, so a
+// command is timed as soon as it is delivered, and replies right away.
+void *devices_main(void *arg)
+{
+    struct message_struct rx_data;
+    struct message_struct tx_data;
+    int device_count = g_sensor_count + g_actuator_count;
+
+    (void)arg;
+
+    for (;;)
+    {
+        if (message_receive(g_msgid, &rx_data, 0, 0) == -1)
+        {
+            if (errno == EINTR || errno == EPROTO)
+            {
+                continue;
+            }
+            // The queue is removed once the Controller has stopped
+            if (errno == EIDRM || errno == EINVAL)
+            {
+                return NULL;
+            }
+            fprintf(stderr, "msgrcv failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        if (rx_data.header.kind == MESSAGE_COMMAND_BATCH)
+        {
+            struct command_batch_payload *batch = &rx_data.payload.command_batch;
+            for (int i=0; i<batch->count && i<MAX_BATCH_COMMANDS; i++)
+            {
+                handle_command(batch->commands[i].actuator_pid, batch->commands[i].sequence_number,
+                        0, batch->timestamp, &batch->trace);
+            }
+            continue;
+        }
+
+        long index = rx_data.type - LOADGEN_ID_BASE;
+        if (index < 0 || index >= device_count)
+        {
+            continue;
+        }
+
+        struct loadgen_device *device = &g_devices[index];
+        switch (rx_data.header.kind)
+        {
+        case MESSAGE_ACK:
+            if (!device->registered)
+            {
+                device->registered = 1;
+                __atomic_fetch_add(&g_registered, 1, __ATOMIC_RELAXED);
+            }
+            break;
+        case MESSAGE_QUERY:
+        {
+            int reading = __atomic_load_n(&device->reading, __ATOMIC_RELAXED);
+            message_query_reply(&tx_data, device->id, rx_data.payload.query.request_id, reading,
+                    __atomic_load_n(&device->sampled, __ATOMIC_RELAXED));
+            send_reply(&tx_data);
+            break;
+        }
+        case MESSAGE_COMMAND:
+            handle_command(device->id, rx_data.payload.command.sequence_number,
+                    rx_data.payload.command.request_id, rx_data.payload.command.timestamp,
+                    &rx_data.payload.command.trace);
+            break;
+        }
+    }
+}
+
+// Plays the Cloud's part. Reads updates, query replies and route
+// changes until the Controller stops.
+void *cloud_main(void *arg)
+{
+    struct message_struct rx_data;
+    int result;
+
+    (void)arg;
+
+    while ((result = message_read(g_fifo_rd, &rx_data)) != 0)
+    {
+        if (result == -1)
+        {
+            if (errno == EBADMSG || errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "read failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+
+        long long now = timestamp_now();
+        int measuring = __atomic_load_n(&g_measuring, __ATOMIC_RELAXED);
+
+        add_counter(&g_cloud.messages, 1);
+        add_counter(&g_cloud.bytes, MESSAGE_SIZE(&rx_data));
+
+        switch (rx_data.header.kind)
+        {
+        case MESSAGE_STOP:
+            return NULL;
+        case MESSAGE_ERROR:
+            add_counter(&g_cloud.errors, 1);
+            if (rx_data.payload.error.request_id != 0)
+            {
+                answer_query(rx_data.payload.error.request_id, NULL, now);
+            }
+            break;
+        case MESSAGE_REPLY:
+            answer_query(rx_data.payload.reply.request_id,
+                    rx_data.payload.reply.device_type == DEVICE_TYPE_SENSOR ? &g_get_latency : &g_put_latency,
+                    now);
+            break;
+        case MESSAGE_MAP:
+        case MESSAGE_UNMAP:
+        {
+            long index = rx_data.payload.map.sensor_pid - LOADGEN_ID_BASE;
+            if (index >= 0 && index < g_sensor_count)
+            {
+                __atomic_fetch_add(&g_routes[index], rx_data.header.kind == MESSAGE_MAP ? 1 : -1,
+                        __ATOMIC_RELAXED);
+                __atomic_fetch_add(&g_cloud.maps, rx_data.header.kind == MESSAGE_MAP ? 1 : -1,
+                        __ATOMIC_RELAXED);
+            }
+            break;
+        }
+        case MESSAGE_AGGREGATES:
+        {
+            // An aggregating Controller sends no update per breach, but
+            // counts every breach in one window
+            const struct aggregates_payload *aggregates = &rx_data.payload.aggregates;
+            for (int i=0; i<aggregates->count && i<MAX_AGGREGATE_DEVICES; i++)
+            {
+                add_counter(&g_cloud.updates, aggregates->devices[i].window.breaches);
+            }
+            break;
+        }
+        case MESSAGE_UPDATE:
+        {
+            const struct message_trace *trace = &rx_data.payload.update.trace;
+            add_counter(&g_cloud.updates, 1);
+            if (measuring && trace->sampled != 0)
+            {
+                stats_histogram_add(&g_sensor_to_cloud, (now - trace->sampled) * 1000);
+            }
+            break;
+        }
+        }
+    }
+
+    return NULL;
+}
+
+// Signal handler for SIGCHLD
+void controller_exited(int signal_number)
+{
+    g_controller_exited = 1;
+}
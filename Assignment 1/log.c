@@ -0,0 +1,343 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: log.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the logging ring and its writer thread. Any
+ * thread may add a record; only the writer removes them. Each record
+ * carries a sequence number that tells whether it is free for the
+ * producer that claimed its position, or filled and ready to be
+ * written, so neither side takes a lock. When the ring is empty the
+ * writer parks on an eventfd, and the producer that next fills a record
+ * wakes it.
+ *
+ */
+#include "log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#define LOG_BATCH_SIZE 65536
+
+struct log_record
+{
+    unsigned long sequence;
+    int length;
+    char text[LOG_LINE_MAX];
+};
+
+int g_log_level = LOG_LEVEL_INFO;
+
+static struct log_record *g_ring = NULL;
+static unsigned long g_head = 0;        // Next position to claim, shared by producers
+static unsigned long g_tail = 0;        // Next position to write, owned by the writer
+static unsigned long g_dropped = 0;
+static int g_log_fd = STDOUT_FILENO;
+static int g_stopping = 0;
+static int g_parked = 0;                // Set by the writer before it waits
+static int g_wake_fd = -1;
+static pthread_t g_writer;
+
+static const char *g_level_names[] = { "error", "warn", "info", "debug" };
+
+// Returns the level with the given name, or -1 if there is none
+int log_parse_level(const char *name)
+{
+    for (int level=LOG_LEVEL_ERROR; level<=LOG_LEVEL_DEBUG; level++)
+    {
+        if (strcmp(name, g_level_names[level]) == 0)
+        {
+            return level;
+        }
+    }
+
+    return -1;
+}
+
+// Writes all of a buffer, retrying writes cut short by signals
+static void write_all(const char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(g_log_fd, buffer, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        buffer += written;
+        length -= written;
+    }
+}
+
+// Wakes the writer if it is parked. Called after a record is filled,
+// and by log_stop(). The fence orders the caller's store before the
+// load of g_parked, as the writer's fence orders its store of g_parked
+// before it looks at the ring again.
+static void wake_writer(void)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&g_parked, __ATOMIC_RELAXED)
+            && __atomic_exchange_n(&g_parked, 0, __ATOMIC_RELAXED))
+    {
+        while (write(g_wake_fd, &one, sizeof(one)) == -1 && errno == EINTR)
+        {
+        }
+    }
+}
+
+// Formats a line, ending it with a newline if it had to be truncated
+static int format_line(char *text, const char *format, va_list args)
+{
+    int length = vsnprintf(text, LOG_LINE_MAX, format, args);
+
+    if (length < 0)
+    {
+        return 0;
+    }
+    if (length >= LOG_LINE_MAX)
+    {
+        length = LOG_LINE_MAX - 1;
+        text[length - 1] = '\n';
+    }
+
+    return length;
+}
+
+void log_message(int level, const char *format, ...)
+{
+    va_list args;
+    struct log_record *record;
+
+    (void)level;
+
+    // Not started or already stopped, so the line is written directly
+    if (g_ring == NULL || __atomic_load_n(&g_stopping, __ATOMIC_ACQUIRE))
+    {
+        char text[LOG_LINE_MAX];
+        va_start(args, format);
+        int length = format_line(text, format, args);
+        va_end(args);
+        write_all(text, length);
+        return;
+    }
+
+    unsigned long position = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        record = &g_ring[position & (LOG_RING_CAPACITY - 1)];
+        unsigned long sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+        long difference = (long)(sequence - position);
+
+        if (difference == 0)
+        {
+            // On failure position is reloaded with the current head
+            if (__atomic_compare_exchange_n(&g_head, &position, position + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The writer is a whole ring behind
+            __atomic_fetch_add(&g_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            position = __atomic_load_n(&g_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    va_start(args, format);
+    record->length = format_line(record->text, format, args);
+    va_end(args);
+
+    __atomic_store_n(&record->sequence, position + 1, __ATOMIC_RELEASE);
+    wake_writer();
+}
+
+// Returns whether the next record to write has been filled
+static int record_ready(void)
+{
+    struct log_record *record = &g_ring[g_tail & (LOG_RING_CAPACITY - 1)];
+    return __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) == g_tail + 1;
+}
+
+// Blocks until a producer fills a record or the log is stopped. The
+// writer says it is parked, then looks once more, so a record filled in
+// between is either seen here or wakes it.
+static void park_writer(void)
+{
+    uint64_t count;
+
+    __atomic_store_n(&g_parked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (record_ready() || __atomic_load_n(&g_stopping, __ATOMIC_RELAXED))
+    {
+        // A producer that saw the flag has written, or is about to
+        // write, to the eventfd. That is read on the next park.
+        __atomic_store_n(&g_parked, 0, __ATOMIC_RELAXED);
+        return;
+    }
+
+    while (read(g_wake_fd, &count, sizeof(count)) == -1 && errno == EINTR)
+    {
+    }
+}
+
+// Moves filled records into the batch, writing it out whenever it is
+// full. Returns the number of records taken.
+static int drain(char *batch, size_t *used)
+{
+    int taken = 0;
+
+    for (;;)
+    {
+        if (!record_ready())
+        {
+            break;
+        }
+        struct log_record *record = &g_ring[g_tail & (LOG_RING_CAPACITY - 1)];
+
+        if (*used + record->length > LOG_BATCH_SIZE)
+        {
+            write_all(batch, *used);
+            *used = 0;
+        }
+        memcpy(batch + *used, record->text, record->length);
+        *used += record->length;
+
+        // Frees the record for the producer one lap ahead
+        __atomic_store_n(&record->sequence, g_tail + LOG_RING_CAPACITY, __ATOMIC_RELEASE);
+        g_tail++;
+        taken++;
+    }
+
+    return taken;
+}
+
+static void *writer_main(void *arg)
+{
+    static char batch[LOG_BATCH_SIZE];
+    unsigned long reported = 0;
+    size_t used = 0;
+
+    (void)arg;
+
+    for (;;)
+    {
+        int stopping = __atomic_load_n(&g_stopping, __ATOMIC_ACQUIRE);
+        int taken = drain(batch, &used);
+
+        unsigned long dropped = __atomic_load_n(&g_dropped, __ATOMIC_RELAXED);
+        if (dropped != reported && used + LOG_LINE_MAX <= LOG_BATCH_SIZE)
+        {
+            used += snprintf(batch + used, LOG_LINE_MAX, "[LOG] Dropped %lu lines while the log was full\n",
+                    dropped - reported);
+            reported = dropped;
+        }
+
+        if (used > 0)
+        {
+            write_all(batch, used);
+            used = 0;
+        }
+
+        // Lines added before the stop was seen have all been drained
+        if (stopping)
+        {
+            break;
+        }
+        if (taken == 0)
+        {
+            park_writer();
+        }
+    }
+
+    return NULL;
+}
+
+// Starts the writer thread of this process. Called after fork(), since
+// only the forking thread survives it. Lines are written to fd.
+int log_start(int fd)
+{
+    sigset_t mask, old_mask;
+
+    if (g_ring != NULL)
+    {
+        return 0;
+    }
+
+    g_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (g_wake_fd == -1)
+    {
+        return -1;
+    }
+
+    g_ring = malloc(LOG_RING_CAPACITY * sizeof(struct log_record));
+    if (g_ring == NULL)
+    {
+        close(g_wake_fd);
+        g_wake_fd = -1;
+        return -1;
+    }
+    for (unsigned long i=0; i<LOG_RING_CAPACITY; i++)
+    {
+        g_ring[i].sequence = i;
+    }
+    g_head = 0;
+    g_tail = 0;
+    g_parked = 0;
+    g_log_fd = fd;
+
+    // The writer never handles signals meant for the process
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+    int result = pthread_create(&g_writer, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (result != 0)
+    {
+        free(g_ring);
+        g_ring = NULL;
+        close(g_wake_fd);
+        g_wake_fd = -1;
+        return -1;
+    }
+
+    atexit(log_stop);
+
+    return 0;
+}
+
+// Writes out every line added so far and stops the writer. Lines added
+// afterwards are written directly.
+void log_stop(void)
+{
+    if (g_ring == NULL || __atomic_exchange_n(&g_stopping, 1, __ATOMIC_ACQ_REL))
+    {
+        return;
+    }
+
+    wake_writer();
+    pthread_join(g_writer, NULL);
+}
@@ -0,0 +1,47 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: log.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Leveled logging that never blocks the caller on output. Lines are
+ * formatted into a fixed ring of records shared by all threads of a
+ * process and written out in batches by a background thread. When the
+ * ring is full a line is dropped and counted rather than waited for.
+ * Before log_start() is called, lines are written directly.
+ *
+ */
+#ifndef LOG_H_
+#define LOG_H_
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_DEBUG 3
+
+#define LOG_RING_CAPACITY 4096  // Records, must be a power of two
+#define LOG_LINE_MAX 240        // Longer lines are truncated
+
+// Lines above this level are not formatted at all
+extern int g_log_level;
+
+int log_parse_level(const char *name);
+int log_start(int fd);
+void log_stop(void);
+void log_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define log_enabled(level) ((level) <= g_log_level)
+
+#define log_error(...) \
+    do { if (log_enabled(LOG_LEVEL_ERROR)) log_message(LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+#define log_warn(...) \
+    do { if (log_enabled(LOG_LEVEL_WARN)) log_message(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#define log_info(...) \
+    do { if (log_enabled(LOG_LEVEL_INFO)) log_message(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#define log_debug(...) \
+    do { if (log_enabled(LOG_LEVEL_DEBUG)) log_message(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+#endif
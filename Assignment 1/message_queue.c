@@ -0,0 +1,507 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: message_queue.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Construction, sending and receiving of messages in the versioned
+ * wire format described in message_queue.h.
+ *
+ */
+#include "message_queue.h"
+#include "timestamp.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/msg.h>
+
+#define HEADER_SIZE (offsetof(struct message_struct, payload) - offsetof(struct message_struct, header))
+
+// Copies a string into a fixed size field and returns the number of
+// bytes used, including the terminating NUL
+static size_t copy_string(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (length > size - 1)
+    {
+        length = size - 1;
+    }
+    memcpy(dst, src, length);
+    dst[length] = '\0';
+
+    return length + 1;
+}
+
+// Layout every message of a kind must have to be handled
+struct kind_layout
+{
+    unsigned short min_length;  // Smallest payload
+    unsigned char ends_in_string; // Whether the last payload byte must be a NUL
+};
+
+// Payloads ending in strings hold at least their terminating NULs.
+// Kinds not listed have no payload to check.
+static const struct kind_layout g_layouts[] =
+{
+    [MESSAGE_REGISTER] = { offsetof(struct register_payload, name) + 1, 1 },
+    [MESSAGE_READINGS] = { READINGS_PAYLOAD_SIZE(0), 0 },
+    [MESSAGE_QUERY] = { offsetof(struct query_payload, data) + 1, 1 },
+    [MESSAGE_QUERY_REPLY] = { sizeof(struct query_reply_payload), 0 },
+    [MESSAGE_COMMAND] = { offsetof(struct command_payload, data) + 1, 1 },
+    [MESSAGE_COMMAND_ACK] = { sizeof(struct command_ack_payload), 0 },
+    [MESSAGE_UPDATE] = { offsetof(struct update_payload, strings) + 2, 1 },
+    [MESSAGE_ERROR] = { offsetof(struct error_payload, data) + 1, 1 },
+    [MESSAGE_MAP] = { sizeof(struct map_payload), 0 },
+    [MESSAGE_UNMAP] = { sizeof(struct map_payload), 0 },
+    [MESSAGE_COMMAND_BATCH] = { offsetof(struct command_batch_payload, data) + 1, 1 },
+    [MESSAGE_REPLY] = { sizeof(struct reply_payload), 0 },
+    [MESSAGE_RANGE] = { sizeof(struct range_payload), 0 },
+    [MESSAGE_RANGE_REPLY] = { RANGE_REPLY_PAYLOAD_SIZE(0), 0 },
+    [MESSAGE_AGGREGATES] = { AGGREGATES_PAYLOAD_SIZE(0), 0 },
+    [MESSAGE_RELOAD] = { sizeof(struct reload_payload), 0 },
+};
+
+#define KIND_COUNT (sizeof(g_layouts) / sizeof(g_layouts[0]))
+
+// Returns whether the count of a variable sized payload is in range and
+// its entries were all received
+static int count_fits(const struct message_struct *message)
+{
+    size_t length = message->header.length;
+    int count;
+
+    switch (message->header.kind)
+    {
+    case MESSAGE_READINGS:
+        count = message->payload.readings.count;
+        return count >= 0 && count <= MAX_BATCH_READINGS && length >= READINGS_PAYLOAD_SIZE(count);
+    case MESSAGE_RANGE_REPLY:
+        count = message->payload.range_reply.count;
+        return count >= 0 && count <= MAX_BATCH_READINGS
+            && length >= RANGE_REPLY_PAYLOAD_SIZE(count);
+    case MESSAGE_AGGREGATES:
+        count = message->payload.aggregates.count;
+        return count >= 0 && count <= MAX_AGGREGATE_DEVICES
+            && length >= AGGREGATES_PAYLOAD_SIZE(count);
+    case MESSAGE_QUERY:
+        count = message->payload.query.count;
+        return count >= 0 && count <= MAX_QUERY_DEVICES;
+    case MESSAGE_COMMAND_BATCH:
+        count = message->payload.command_batch.count;
+        return count >= 0 && count <= MAX_BATCH_COMMANDS;
+    default:
+        return 1;
+    }
+}
+
+// Checks that a received message has a known version, that its length
+// matches the number of bytes received, and that its payload is large
+// enough for its kind. Returns -1 with errno set to EPROTO otherwise.
+int message_validate(const struct message_struct *message, size_t size)
+{
+    if (size < HEADER_SIZE || size > MAX_MESSAGE_SIZE
+            || message->header.version != MESSAGE_VERSION
+            || message->header.length != size - HEADER_SIZE)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t length = message->header.length;
+    if (message->header.kind < KIND_COUNT)
+    {
+        const struct kind_layout *layout = &g_layouts[message->header.kind];
+        if (length < layout->min_length
+                || (layout->ends_in_string && ((const char *)&message->payload)[length - 1] != '\0'))
+        {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+
+    if (!count_fits(message))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Reads exactly size bytes, retrying if the fifo is momentarily empty.
+// Returns 0 if the writer closed the fifo before anything was read.
+static ssize_t read_fully(int fd, void *buffer, size_t size)
+{
+    size_t total = 0;
+
+    while (total < size)
+    {
+        ssize_t result = read(fd, (char *)buffer + total, size - total);
+        if (result == 0)
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+            errno = EPROTO;
+            return -1;
+        }
+        if (result == -1)
+        {
+            // Writes of a whole message are atomic, so once part of it
+            // has been read the rest is already in the fifo
+            if (total > 0 && (errno == EAGAIN || errno == EINTR))
+            {
+                continue;
+            }
+            return -1;
+        }
+        total += result;
+    }
+
+    return total;
+}
+
+// Copies a trace, or clears it if there is none
+static void copy_trace(struct message_trace *dst, const struct message_trace *src)
+{
+    if (src == NULL)
+    {
+        memset((void *)dst, 0, sizeof(*dst));
+    }
+    else
+    {
+        *dst = *src;
+    }
+}
+
+// Sets up the header of a message with an empty payload
+void message_init(struct message_struct *message, long type, int kind, pid_t pid)
+{
+    message->type = type;
+    message->header.version = MESSAGE_VERSION;
+    message->header.kind = kind;
+    message->header.length = 0;
+    message->header.pid = pid;
+}
+
+void message_register(struct message_struct *message, pid_t pid,
+        char device_type, int threshold, int reply_msgid, const char *name)
+{
+    struct register_payload *reg = &message->payload.reg;
+
+    message_init(message, TO_CONTROLLER, MESSAGE_REGISTER, pid);
+    reg->device_type = device_type;
+    reg->threshold = threshold;
+    reg->reply_msgid = reply_msgid;
+    reg->host_pid = getpid();
+    message->header.length = offsetof(struct register_payload, name)
+        + copy_string(reg->name, name, sizeof(reg->name));
+}
+
+// Builds a request for up to MAX_QUERY_DEVICES devices of one type
+void message_query(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, char device_type, const pid_t *device_pids, int count,
+        const char *data)
+{
+    struct query_payload *query = &message->payload.query;
+
+    if (count > MAX_QUERY_DEVICES)
+    {
+        count = MAX_QUERY_DEVICES;
+    }
+
+    message_init(message, type, MESSAGE_QUERY, pid);
+    query->request_id = request_id;
+    query->device_type = device_type;
+    query->count = count;
+    memcpy(query->device_pids, device_pids, count * sizeof(pid_t));
+    message->header.length = offsetof(struct query_payload, data)
+        + copy_string(query->data, data, sizeof(query->data));
+}
+
+void message_query_reply(struct message_struct *message, pid_t pid,
+        unsigned int request_id, int sensor_reading, long long sampled)
+{
+    message_init(message, TO_CONTROLLER, MESSAGE_QUERY_REPLY, pid);
+    message->payload.query_reply.request_id = request_id;
+    message->payload.query_reply.sensor_reading = sensor_reading;
+    message->payload.query_reply.sampled = sampled;
+    message->header.length = sizeof(struct query_reply_payload);
+}
+
+void message_command(struct message_struct *message, long type, pid_t pid,
+        int sequence_number, unsigned int request_id, const struct message_trace *trace,
+        const char *data)
+{
+    struct command_payload *command = &message->payload.command;
+
+    message_init(message, type, MESSAGE_COMMAND, pid);
+    command->sequence_number = sequence_number;
+    command->request_id = request_id;
+    command->timestamp = timestamp_now();
+    copy_trace(&command->trace, trace);
+    message->header.length = offsetof(struct command_payload, data)
+        + copy_string(command->data, data, sizeof(command->data));
+}
+
+// Starts an empty batch of the same command for several Actuators
+void message_command_batch(struct message_struct *message, long type, pid_t pid,
+        const struct message_trace *trace, const char *data)
+{
+    struct command_batch_payload *batch = &message->payload.command_batch;
+
+    message_init(message, type, MESSAGE_COMMAND_BATCH, pid);
+    batch->count = 0;
+    batch->timestamp = timestamp_now();
+    copy_trace(&batch->trace, trace);
+    message->header.length = offsetof(struct command_batch_payload, data)
+        + copy_string(batch->data, data, sizeof(batch->data));
+}
+
+// Adds an Actuator to a batch. Returns -1 if the batch is full.
+int message_command_batch_add(struct message_struct *message, pid_t actuator_pid,
+        int sequence_number)
+{
+    struct command_batch_payload *batch = &message->payload.command_batch;
+
+    if (batch->count == MAX_BATCH_COMMANDS)
+    {
+        return -1;
+    }
+
+    batch->commands[batch->count].actuator_pid = actuator_pid;
+    batch->commands[batch->count].sequence_number = sequence_number;
+    batch->count++;
+
+    return 0;
+}
+
+// Acknowledges a command just executed, echoing its request id, the
+// time it was sent and the time the reading behind it was taken
+void message_command_ack(struct message_struct *message, pid_t pid,
+        int sequence_number, unsigned int request_id, long long command_timestamp,
+        long long sampled)
+{
+    message_init(message, TO_CONTROLLER, MESSAGE_COMMAND_ACK, pid);
+    message->payload.command_ack.sequence_number = sequence_number;
+    message->payload.command_ack.request_id = request_id;
+    message->payload.command_ack.command_timestamp = command_timestamp;
+    message->payload.command_ack.sampled = sampled;
+    message->payload.command_ack.executed = timestamp_now();
+    message->header.length = sizeof(struct command_ack_payload);
+}
+
+void message_update(struct message_struct *message, long type, pid_t pid,
+        pid_t device_pid, int threshold, int sensor_reading,
+        const struct message_trace *trace, const char *name, const char *command)
+{
+    struct update_payload *update = &message->payload.update;
+    size_t used;
+
+    message_init(message, type, MESSAGE_UPDATE, pid);
+    update->device_pid = device_pid;
+    update->threshold = threshold;
+    update->sensor_reading = sensor_reading;
+    copy_trace(&update->trace, trace);
+    used = copy_string(update->strings, name, MAX_NAME_LENGTH);
+    used += copy_string(update->strings + used, command, sizeof(update->strings) - used);
+    message->header.length = offsetof(struct update_payload, strings) + used;
+}
+
+void message_reply(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid, char device_type, int value,
+        long long timestamp)
+{
+    message_init(message, type, MESSAGE_REPLY, pid);
+    message->payload.reply.request_id = request_id;
+    message->payload.reply.device_pid = device_pid;
+    message->payload.reply.device_type = device_type;
+    message->payload.reply.value = value;
+    message->payload.reply.timestamp = timestamp;
+    message->header.length = sizeof(struct reply_payload);
+}
+
+void message_range(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid, long long from, long long to)
+{
+    message_init(message, type, MESSAGE_RANGE, pid);
+    message->payload.range.request_id = request_id;
+    message->payload.range.device_pid = device_pid;
+    message->payload.range.from = from;
+    message->payload.range.to = to;
+    message->header.length = sizeof(struct range_payload);
+}
+
+// Starts an empty batch of stored readings that is not yet done
+void message_range_reply(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid)
+{
+    struct range_reply_payload *reply = &message->payload.range_reply;
+
+    message_init(message, type, MESSAGE_RANGE_REPLY, pid);
+    reply->request_id = request_id;
+    reply->device_pid = device_pid;
+    reply->done = 0;
+    reply->count = 0;
+    message->header.length = RANGE_REPLY_PAYLOAD_SIZE(0);
+}
+
+// Adds a reading to a batch. Returns -1 if the batch is full.
+int message_range_reply_add(struct message_struct *message, const struct reading *reading)
+{
+    struct range_reply_payload *reply = &message->payload.range_reply;
+
+    if (reply->count == MAX_BATCH_READINGS)
+    {
+        return -1;
+    }
+
+    reply->readings[reply->count++] = *reading;
+    message->header.length = RANGE_REPLY_PAYLOAD_SIZE(reply->count);
+
+    return 0;
+}
+
+// Starts an empty batch of aggregates
+void message_aggregates(struct message_struct *message, long type, pid_t pid,
+        int interval_ms, int panes)
+{
+    message_init(message, type, MESSAGE_AGGREGATES, pid);
+    message->payload.aggregates.interval_ms = interval_ms;
+    message->payload.aggregates.panes = panes;
+    message->payload.aggregates.count = 0;
+    message->header.length = AGGREGATES_PAYLOAD_SIZE(0);
+}
+
+// Adds a Sensor's aggregates to a batch. Returns -1 if the batch is full.
+int message_aggregates_add(struct message_struct *message, const struct device_aggregate *aggregate)
+{
+    struct aggregates_payload *aggregates = &message->payload.aggregates;
+
+    if (aggregates->count == MAX_AGGREGATE_DEVICES)
+    {
+        return -1;
+    }
+
+    aggregates->devices[aggregates->count++] = *aggregate;
+    message->header.length = AGGREGATES_PAYLOAD_SIZE(aggregates->count);
+
+    return 0;
+}
+
+// Asks for the rules file to be reloaded, with nothing loaded yet
+void message_reload(struct message_struct *message, long type, pid_t pid)
+{
+    message_init(message, type, MESSAGE_RELOAD, pid);
+    memset((void *)&message->payload.reload, 0, sizeof(message->payload.reload));
+    message->header.length = sizeof(struct reload_payload);
+}
+
+void message_error(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid, const char *data)
+{
+    struct error_payload *error = &message->payload.error;
+
+    message_init(message, type, MESSAGE_ERROR, pid);
+    error->request_id = request_id;
+    error->device_pid = device_pid;
+    message->header.length = offsetof(struct error_payload, data)
+        + copy_string(error->data, data, sizeof(error->data));
+}
+
+void message_map(struct message_struct *message, long type, pid_t pid,
+        pid_t sensor_pid, pid_t actuator_pid, int msgid)
+{
+    message_init(message, type, MESSAGE_MAP, pid);
+    message->payload.map.sensor_pid = sensor_pid;
+    message->payload.map.actuator_pid = actuator_pid;
+    message->payload.map.msgid = msgid;
+    message->payload.map.step = MAP_STEP_CLOUD;
+    message->header.length = sizeof(struct map_payload);
+}
+
+void message_unmap(struct message_struct *message, long type, pid_t pid,
+        pid_t sensor_pid, pid_t actuator_pid)
+{
+    message_map(message, type, pid, sensor_pid, actuator_pid, 0);
+    message->header.kind = MESSAGE_UNMAP;
+}
+
+// Returns the command string of an update, which follows the name
+const char *message_update_command(const struct message_struct *message)
+{
+    const char *name = message->payload.update.strings;
+    return name + strlen(name) + 1;
+}
+
+int message_send(int msgid, const struct message_struct *message)
+{
+    return msgsnd(msgid, (const void *)message, MESSAGE_SIZE(message), 0);
+}
+
+// Receives a message of the given type. Returns -1 with errno set to
+// EPROTO if the message is malformed or of another version.
+int message_receive(int msgid, struct message_struct *message, long type, int flags)
+{
+    ssize_t size = msgrcv(msgid, (void *)message, MAX_MESSAGE_SIZE, type, flags);
+    if (size == -1)
+    {
+        return -1;
+    }
+
+    return message_validate(message, size);
+}
+
+int message_write(int fd, const struct message_struct *message)
+{
+    // A single write keeps the message atomic on the fifo
+    if (write(fd, (const void *)&message->header, MESSAGE_SIZE(message)) == -1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Reads one message from a fifo. Returns 1 if a message was read, 0 if
+// the writer closed the fifo and -1 on error. A whole message that is
+// malformed fails with EBADMSG and the next one can still be read. A
+// header of another version or length, or a message cut short, fails
+// with EPROTO: the reader no longer knows where messages start, so the
+// fifo cannot be read any further.
+int message_read(int fd, struct message_struct *message)
+{
+    ssize_t result = read_fully(fd, (void *)&message->header, HEADER_SIZE);
+    if (result <= 0)
+    {
+        return result;
+    }
+
+    if (message->header.version != MESSAGE_VERSION
+            || message->header.length > MAX_MESSAGE_SIZE - HEADER_SIZE)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (message->header.length > 0
+            && read_fully(fd, (void *)&message->payload, message->header.length) <= 0)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if (message_validate(message, HEADER_SIZE + message->header.length) == -1)
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    return 1;
+}
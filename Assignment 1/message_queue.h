@@ -9,30 +9,354 @@
  * Description:
  * Data related to message queue that is common to multiple processes.
  *
+ * Every message starts with a small versioned header carrying a kind
+ * tag and the length of the payload that follows it. Payloads are
+ * typed per kind and only their used bytes are sent, so a message is
+ * only as large as its contents. The same layout is used on the
+ * message queue and on the FIFOs. Received messages too short for
+ * their kind, or whose counts exceed what they hold, are rejected.
+ *
+ * Requests from the Cloud carry an id chosen by the Cloud, which is
+ * echoed in every reply and error they cause. A request may name
+ * several devices; each one is answered separately, in whatever order
+ * the devices respond, so many requests can be in flight at once.
+ *
  */
+#ifndef MESSAGE_QUEUE_H_
+#define MESSAGE_QUEUE_H_
+
+#include <stddef.h>
 #include <sys/types.h>
 
 #define MESSAGE_QUEUE_ID 1234
 
 #define TO_CONTROLLER 1
 
+#define MESSAGE_VERSION 11
+
 #define MAX_NAME_LENGTH 64
 #define MAX_DATA_LENGTH 512
 
 #define DEVICE_TYPE_SENSOR 1
 #define DEVICE_TYPE_ACTUATOR 2
 
+#define MAX_BATCH_READINGS 64
+#define MAX_BATCH_COMMANDS 32
+#define MAX_QUERY_DEVICES 64
+#define MAX_AGGREGATE_DEVICES 12
+
+// Message kinds
+#define MESSAGE_REGISTER 1      // Device -> Controller
+#define MESSAGE_ACK 2           // Controller -> Device
+#define MESSAGE_READINGS 3      // Sensor -> Controller
+#define MESSAGE_QUERY 4         // Cloud -> Controller -> Device
+#define MESSAGE_QUERY_REPLY 5   // Sensor -> Controller
+#define MESSAGE_COMMAND 6       // Controller -> Actuator
+#define MESSAGE_COMMAND_ACK 7   // Actuator -> Controller
+#define MESSAGE_UPDATE 8        // Controller -> Cloud
+#define MESSAGE_ERROR 9         // Controller -> Cloud
+#define MESSAGE_STOP 10
+#define MESSAGE_MAP 11          // Cloud -> Controller, routes a Sensor to an Actuator
+#define MESSAGE_UNMAP 12        // Cloud -> Controller, removes a route
+#define MESSAGE_COMMAND_BATCH 13 // Controller -> Actuators sharing a queue
+#define MESSAGE_DEREGISTER 14   // Device -> Controller, sent when exiting
+#define MESSAGE_SWEEP 15        // Controller internal, checks devices are alive
+#define MESSAGE_REPLY 16        // Controller -> Cloud, answers one device of a request
+#define MESSAGE_RANGE 17        // Cloud -> Controller, asks for stored readings
+#define MESSAGE_RANGE_REPLY 18  // Controller -> Cloud, a batch of stored readings
+#define MESSAGE_WINDOW 19       // Controller internal, ends an aggregation interval
+#define MESSAGE_AGGREGATES 20   // Controller -> Cloud, aggregates of several Sensors
+#define MESSAGE_RELOAD 21       // Cloud -> Controller -> Cloud, reloads the rules file
+
+// Steps of a route change between the Controller's shards. Requests
+// from the Cloud start at MAP_STEP_CLOUD.
+#define MAP_STEP_CLOUD 0
+#define MAP_STEP_ROUTE 1        // Update the Sensor's route
+#define MAP_STEP_LINK 2         // Update the Actuator's link back to the Sensor
+
+// Devices that pass this as their reply queue are answered on the
+// shared message queue
+#define REPLY_SHARED_QUEUE -1
+
+struct message_header
+{
+    unsigned char version;
+    unsigned char kind;
+    unsigned short length;  // Number of payload bytes that follow
+    pid_t pid;              // Sender
+};
+
+// A single timestamped sensor sample
+struct reading
+{
+    long long timestamp;
+    int value;
+};
+
+// Timestamps of the hops taken by the reading that caused a command or
+// an update. All are monotonic microseconds, 0 where unknown, such as
+// for commands sent from the Cloud.
+struct message_trace
+{
+    long long sampled;      // Sensor took the reading
+    long long received;     // Controller's child received it
+    long long forwarded;    // Controller's parent forwarded the update
+};
+
+struct register_payload
+{
+    char device_type;
+    int threshold;
+    int reply_msgid;    // Queue the Controller sends to this device on
+    pid_t host_pid;     // Process running the device, checked for liveness
+    char name[MAX_NAME_LENGTH];
+};
+
+struct readings_payload
+{
+    int count;
+    long long received;     // Set by the Controller's child on receipt
+    struct reading readings[MAX_BATCH_READINGS];
+};
+
+// Gets the reading of each Sensor listed, or sends data to each
+// Actuator listed. The Controller passes it on to each device with
+// only that device listed.
+struct query_payload
+{
+    unsigned int request_id;
+    char device_type;
+    int count;
+    pid_t device_pids[MAX_QUERY_DEVICES];
+    char data[MAX_DATA_LENGTH];
+};
+
+struct query_reply_payload
+{
+    unsigned int request_id;
+    int sensor_reading;
+    long long sampled;      // When the reading was taken, 0 before the first
+};
+
+struct command_payload
+{
+    int sequence_number;
+    unsigned int request_id;    // Of the Put that caused it, 0 for a breach
+    long long timestamp;    // When the Controller sent the command
+    struct message_trace trace;
+    char data[MAX_DATA_LENGTH];
+};
+
+// One command addressed to several Actuators that read the same queue
+struct command_batch_payload
+{
+    int count;
+    long long timestamp;
+    struct message_trace trace;
+    struct
+    {
+        pid_t actuator_pid;
+        int sequence_number;
+    } commands[MAX_BATCH_COMMANDS];
+    char data[MAX_DATA_LENGTH];
+};
+
+// Echoes the timestamps of the command, so that the Controller can
+// measure command to ack and Sensor to Actuator latency
+struct command_ack_payload
+{
+    int sequence_number;
+    unsigned int request_id;
+    long long command_timestamp;
+    long long sampled;      // When the reading behind the command was taken
+    long long executed;     // When the Actuator executed the command
+};
+
+// Holds the Sensor name followed by the command that caused the
+// update, each NUL terminated
+struct update_payload
+{
+    pid_t device_pid;
+    int threshold;
+    int sensor_reading;
+    struct message_trace trace;
+    char strings[MAX_NAME_LENGTH + MAX_DATA_LENGTH];
+};
+
+// Answers one device of a request. For a Get, value is the Sensor's
+// reading; a Put is answered once the Actuator has acknowledged it.
+// The timestamp tells when the reading was taken or the command
+// carried out, in monotonic microseconds.
+struct reply_payload
+{
+    unsigned int request_id;
+    pid_t device_pid;
+    char device_type;
+    int value;
+    long long timestamp;
+};
+
+// Asks for the stored readings of a Sensor taken between from and to,
+// inclusive, in wall clock microseconds. The Sensor need not be running.
+struct range_payload
+{
+    unsigned int request_id;
+    pid_t device_pid;
+    long long from;
+    long long to;
+};
+
+// Stored readings are sent in batches. The last batch of a request is
+// marked done, and may be empty.
+struct range_reply_payload
+{
+    unsigned int request_id;
+    pid_t device_pid;
+    int done;
+    int count;
+    struct reading readings[MAX_BATCH_READINGS];
+};
+
+// Summary of a Sensor's readings over a window. Percentiles are
+// estimated to within an eighth of the value.
+struct window_stats
+{
+    int count;
+    int breaches;
+    int min;
+    int max;
+    float mean;
+    int p50;
+    int p90;
+    int p99;
+};
+
+struct device_aggregate
+{
+    pid_t device_pid;
+    float ewma;                 // Weighted mean of all readings so far
+    struct window_stats window; // Readings of the last interval
+    struct window_stats sliding; // Readings of the last few intervals
+};
+
+// Aggregates sent every interval in place of an update per breach
+struct aggregates_payload
+{
+    int interval_ms;
+    int panes;                  // Intervals covered by the sliding window
+    int count;
+    struct device_aggregate devices[MAX_AGGREGATE_DEVICES];
+};
+
+// Request id and device are 0 for errors not caused by a request
+struct error_payload
+{
+    unsigned int request_id;
+    pid_t device_pid;
+    char data[MAX_DATA_LENGTH];
+};
+
+// Counts what a reload of the rules file loaded
+struct reload_payload
+{
+    int rule_count;
+    int threshold_count;
+    int map_count;
+};
+
+struct map_payload
+{
+    pid_t sensor_pid;
+    pid_t actuator_pid;
+    int msgid;          // Queue of the device being linked to
+    int step;
+};
+
 struct message_struct
 {
     long type;
-    struct message_fields
+    struct message_header header;
+    union message_payload
     {
-        char name[MAX_NAME_LENGTH];
-        char device_type;
-        int threshold;
-        int sensor_reading;
-        pid_t pid;
-        char data[MAX_DATA_LENGTH];
-    } fields;
+        struct register_payload reg;
+        struct readings_payload readings;
+        struct query_payload query;
+        struct query_reply_payload query_reply;
+        struct command_payload command;
+        struct command_batch_payload command_batch;
+        struct command_ack_payload command_ack;
+        struct update_payload update;
+        struct reply_payload reply;
+        struct range_payload range;
+        struct range_reply_payload range_reply;
+        struct aggregates_payload aggregates;
+        struct error_payload error;
+        struct map_payload map;
+        struct reload_payload reload;
+    } payload;
 };
 
+// Number of bytes of a message after its type, as passed to msgsnd
+#define MESSAGE_SIZE(message) \
+    (offsetof(struct message_struct, payload) - offsetof(struct message_struct, header) \
+     + (message)->header.length)
+
+#define MAX_MESSAGE_SIZE (sizeof(struct message_struct) - sizeof(long))
+
+#define READINGS_PAYLOAD_SIZE(count) \
+    (offsetof(struct readings_payload, readings) + (count) * sizeof(struct reading))
+
+#define RANGE_REPLY_PAYLOAD_SIZE(count) \
+    (offsetof(struct range_reply_payload, readings) + (count) * sizeof(struct reading))
+
+#define AGGREGATES_PAYLOAD_SIZE(count) \
+    (offsetof(struct aggregates_payload, devices) + (count) * sizeof(struct device_aggregate))
+
+void message_init(struct message_struct *message, long type, int kind, pid_t pid);
+void message_register(struct message_struct *message, pid_t pid,
+        char device_type, int threshold, int reply_msgid, const char *name);
+void message_query(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, char device_type, const pid_t *device_pids, int count,
+        const char *data);
+void message_query_reply(struct message_struct *message, pid_t pid,
+        unsigned int request_id, int sensor_reading, long long sampled);
+void message_command(struct message_struct *message, long type, pid_t pid,
+        int sequence_number, unsigned int request_id, const struct message_trace *trace,
+        const char *data);
+void message_command_batch(struct message_struct *message, long type, pid_t pid,
+        const struct message_trace *trace, const char *data);
+int message_command_batch_add(struct message_struct *message, pid_t actuator_pid,
+        int sequence_number);
+void message_command_ack(struct message_struct *message, pid_t pid,
+        int sequence_number, unsigned int request_id, long long command_timestamp,
+        long long sampled);
+void message_update(struct message_struct *message, long type, pid_t pid,
+        pid_t device_pid, int threshold, int sensor_reading,
+        const struct message_trace *trace, const char *name, const char *command);
+void message_reply(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid, char device_type, int value,
+        long long timestamp);
+void message_range(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid, long long from, long long to);
+void message_range_reply(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid);
+int message_range_reply_add(struct message_struct *message, const struct reading *reading);
+void message_aggregates(struct message_struct *message, long type, pid_t pid,
+        int interval_ms, int panes);
+int message_aggregates_add(struct message_struct *message, const struct device_aggregate *aggregate);
+void message_reload(struct message_struct *message, long type, pid_t pid);
+void message_error(struct message_struct *message, long type, pid_t pid,
+        unsigned int request_id, pid_t device_pid, const char *data);
+void message_map(struct message_struct *message, long type, pid_t pid,
+        pid_t sensor_pid, pid_t actuator_pid, int msgid);
+void message_unmap(struct message_struct *message, long type, pid_t pid,
+        pid_t sensor_pid, pid_t actuator_pid);
+const char *message_update_command(const struct message_struct *message);
+
+int message_validate(const struct message_struct *message, size_t size);
+int message_send(int msgid, const struct message_struct *message);
+int message_receive(int msgid, struct message_struct *message, long type, int flags);
+int message_write(int fd, const struct message_struct *message);
+int message_read(int fd, struct message_struct *message);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: outbox.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the outbox, a ring of messages that doubles in
+ * size when full.
+ *
+ */
+#include "outbox.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+int outbox_init(struct outbox *outbox, unsigned int capacity)
+{
+    outbox->messages = malloc(capacity * sizeof(struct message_struct));
+    outbox->head = 0;
+    outbox->count = 0;
+    outbox->capacity = capacity;
+
+    return outbox->messages == NULL ? -1 : 0;
+}
+
+void outbox_push(struct outbox *outbox, const struct message_struct *message)
+{
+    if (outbox->count == outbox->capacity)
+    {
+        unsigned int new_capacity = outbox->capacity * 2;
+        struct message_struct *new_messages = malloc(new_capacity * sizeof(struct message_struct));
+        if (new_messages == NULL)
+        {
+            fprintf(stderr, "Could not grow outbox\n");
+            exit(EXIT_FAILURE);
+        }
+        for (unsigned int i=0; i<outbox->count; i++)
+        {
+            new_messages[i] = outbox->messages[(outbox->head + i) % outbox->capacity];
+        }
+        free(outbox->messages);
+        outbox->messages = new_messages;
+        outbox->head = 0;
+        outbox->capacity = new_capacity;
+    }
+
+    outbox->messages[(outbox->head + outbox->count) % outbox->capacity] = *message;
+    outbox->count++;
+}
+
+// Sends as much of the outbox as the Controller's queue accepts
+void outbox_flush(struct outbox *outbox, struct transport *transport)
+{
+    while (outbox->count > 0)
+    {
+        if (transport_try_send(transport, &outbox->messages[outbox->head]) == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN)
+            {
+                fprintf(stderr, "msgsnd failed with error: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+            return;
+        }
+        outbox->head = (outbox->head + 1) % outbox->capacity;
+        outbox->count--;
+    }
+}
+
+void outbox_destroy(struct outbox *outbox)
+{
+    free(outbox->messages);
+    outbox->messages = NULL;
+}
@@ -0,0 +1,35 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: outbox.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Messages waiting for room in the Controller's queue, for processes
+ * that host many devices. Messages are sent without blocking; those
+ * that do not fit stay in the outbox, so the process keeps draining
+ * its own queue while the Controller is busy.
+ *
+ */
+#ifndef OUTBOX_H_
+#define OUTBOX_H_
+
+#include "message_queue.h"
+#include "transport.h"
+
+struct outbox
+{
+    struct message_struct *messages;
+    unsigned int head;
+    unsigned int count;
+    unsigned int capacity;
+};
+
+int outbox_init(struct outbox *outbox, unsigned int capacity);
+void outbox_push(struct outbox *outbox, const struct message_struct *message);
+void outbox_flush(struct outbox *outbox, struct transport *transport);
+void outbox_destroy(struct outbox *outbox);
+
+#endif
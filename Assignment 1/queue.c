@@ -15,33 +15,66 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#define QUEUE_INITIAL_CAPACITY 16
+
 struct queue *queue_create()
 {
     struct queue *q = (struct queue*)malloc(sizeof(struct queue));
+    if (q == NULL)
+    {
+        return NULL;
+    }
+
+    q->items = (int*)malloc(QUEUE_INITIAL_CAPACITY * sizeof(int));
+    if (q->items == NULL)
+    {
+        free(q);
+        return NULL;
+    }
+
     q->size = 0;
-    q->head = NULL;
-    q->tail = NULL;
+    q->head = 0;
+    q->capacity = QUEUE_INITIAL_CAPACITY;
 
     return q;
 }
 
-void queue_add(struct queue *q, int i)
+// Doubles the capacity of the queue, unwrapping its items to the start
+// of the new buffer
+static int queue_grow(struct queue *q)
 {
-    struct node *temp = (struct node*)malloc(sizeof(struct node));
-    temp->i = i;
-    temp->next = NULL;
+    unsigned int new_capacity = q->capacity * 2;
+    int *new_items = (int*)malloc(new_capacity * sizeof(int));
+    if (new_items == NULL)
+    {
+        return -1;
+    }
 
-    if (q->size == 0)
+    for (unsigned int j=0; j<q->size; j++)
     {
-        q->head = temp;
-        q->tail = temp;
+        new_items[j] = q->items[(q->head + j) & (q->capacity - 1)];
     }
-    else
+
+    free(q->items);
+    q->items = new_items;
+    q->head = 0;
+    q->capacity = new_capacity;
+
+    return 0;
+}
+
+// Returns -1 if the queue was full and could not grow
+int queue_add(struct queue *q, int i)
+{
+    if (q->size == q->capacity && queue_grow(q) == -1)
     {
-        q->tail->next = temp;
-        q->tail = temp;
+        return -1;
     }
+
+    q->items[(q->head + q->size) & (q->capacity - 1)] = i;
     q->size++;
+
+    return 0;
 }
 
 int queue_remove(struct queue *q, int *i)
@@ -51,45 +84,51 @@ int queue_remove(struct queue *q, int *i)
         return -1;
     }
 
-    *i = q->head->i;
-
-    struct node *remove = q->head;
-    q->head = q->head->next;
-    free(remove);
+    *i = q->items[q->head];
+    q->head = (q->head + 1) & (q->capacity - 1);
     q->size--;
 
     return 0;
 }
 
-void queue_destroy(struct queue *q)
+// Removes the first occurrence of an item, keeping the others in
+// order. Returns -1 if the item is not in the queue.
+int queue_remove_item(struct queue *q, int i)
 {
-    if (q->size > 0)
+    unsigned int j = 0;
+
+    while (j < q->size && q->items[(q->head + j) & (q->capacity - 1)] != i)
     {
-        struct node *remove = q->head;
-        struct node *temp;
+        j++;
+    }
+    if (j == q->size)
+    {
+        return -1;
+    }
 
-        while (remove->next != NULL)
-        {
-            temp = remove;
-            remove = remove->next;
-            free(temp);
-        }
-        free(remove);
+    for (; j+1<q->size; j++)
+    {
+        q->items[(q->head + j) & (q->capacity - 1)] = q->items[(q->head + j + 1) & (q->capacity - 1)];
     }
+    q->size--;
+
+    return 0;
+}
+
+void queue_destroy(struct queue *q)
+{
+    free(q->items);
+    free(q);
 }
 
 void queue_print(struct queue *q)
 {
     if (q->size > 0)
     {
-        struct node *temp = q->head;
-        while (temp->next != NULL)
+        for (unsigned int j=0; j<q->size; j++)
         {
-            printf("%d ", temp->i);
-            temp = temp->next;
+            printf("%d ", q->items[(q->head + j) & (q->capacity - 1)]);
         }
-        printf("%d ", temp->i);
         printf("\n");
     }
 }
-
@@ -7,28 +7,26 @@
  * Created: October 6, 2015
  *
  * Description:
- * An integer queue.
+ * An integer queue, stored in a ring buffer that doubles in size when
+ * full. Adding and removing do not allocate once the buffer is large
+ * enough.
  *
  */
 #ifndef QUEUE_H_
 #define QUEUE_H_
 
-struct node
-{
-    int i;
-    struct node *next;
-};
-
 struct queue
 {
     unsigned int size;
-    struct node *head;
-    struct node *tail;
+    unsigned int head;
+    unsigned int capacity;  // Always a power of two
+    int *items;
 };
 
 struct queue *queue_create();
-void queue_add(struct queue *q, int i);
+int queue_add(struct queue *q, int i);
 int queue_remove(struct queue *q, int *i);
+int queue_remove_item(struct queue *q, int i);
 void queue_destroy(struct queue *q);
 void queue_print(struct queue *q);
 
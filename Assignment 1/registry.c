@@ -0,0 +1,287 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: registry.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the device registry. Pids are hashed into a
+ * linear probing table that holds only (pid, index) pairs, so a
+ * lookup touches one or two cache lines regardless of how many
+ * devices are registered. Both the table and the device array grow
+ * by doubling. Indices of removed devices are kept on a stack and
+ * handed out again first, so the registry does not grow under churn.
+ *
+ */
+#include "registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define REGISTRY_INITIAL_SLOTS 64
+#define REGISTRY_INITIAL_DEVICES 32
+
+static unsigned int hash_pid(pid_t pid, unsigned int mask)
+{
+    unsigned int h = (unsigned int)pid * 2654435769u;
+    return (h ^ (h >> 16)) & mask;
+}
+
+// Doubles the slot table and rehashes every live entry
+static int grow_slots(struct registry *r)
+{
+    unsigned int old_capacity = r->slot_mask + 1;
+    unsigned int new_mask = (old_capacity << 1) - 1;
+    struct registry_slot *old_slots = r->slots;
+    struct registry_slot *new_slots = calloc(new_mask + 1, sizeof(struct registry_slot));
+    if (new_slots == NULL)
+    {
+        return -1;
+    }
+
+    for (unsigned int i=0; i<old_capacity; i++)
+    {
+        if (old_slots[i].pid != 0)
+        {
+            unsigned int j = hash_pid(old_slots[i].pid, new_mask);
+            while (new_slots[j].pid != 0)
+            {
+                j = (j + 1) & new_mask;
+            }
+            new_slots[j] = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+    r->slots = new_slots;
+    r->slot_mask = new_mask;
+
+    return 0;
+}
+
+static int grow_devices(struct registry *r)
+{
+    unsigned int new_capacity = r->device_capacity << 1;
+    struct device_info *new_devices = realloc(r->devices, new_capacity * sizeof(struct device_info));
+    if (new_devices == NULL)
+    {
+        return -1;
+    }
+    r->devices = new_devices;
+
+    int *new_free_indices = realloc(r->free_indices, new_capacity * sizeof(int));
+    if (new_free_indices == NULL)
+    {
+        return -1;
+    }
+    r->free_indices = new_free_indices;
+    r->device_capacity = new_capacity;
+
+    return 0;
+}
+
+struct registry *registry_create()
+{
+    struct registry *r = (struct registry*)malloc(sizeof(struct registry));
+    if (r == NULL)
+    {
+        return NULL;
+    }
+
+    r->slots = calloc(REGISTRY_INITIAL_SLOTS, sizeof(struct registry_slot));
+    r->slot_mask = REGISTRY_INITIAL_SLOTS - 1;
+    r->size = 0;
+    r->devices = malloc(REGISTRY_INITIAL_DEVICES * sizeof(struct device_info));
+    r->device_capacity = REGISTRY_INITIAL_DEVICES;
+    r->device_count = 0;
+    r->free_indices = malloc(REGISTRY_INITIAL_DEVICES * sizeof(int));
+    r->free_count = 0;
+
+    if (r->slots == NULL || r->devices == NULL || r->free_indices == NULL)
+    {
+        registry_destroy(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+// Returns the index of the device with the given pid, or -1 if it is
+// not registered
+int registry_lookup(struct registry *r, pid_t pid)
+{
+    unsigned int i = hash_pid(pid, r->slot_mask);
+
+    while (r->slots[i].pid != 0)
+    {
+        if (r->slots[i].pid == pid)
+        {
+            return r->slots[i].index;
+        }
+        i = (i + 1) & r->slot_mask;
+    }
+
+    return -1;
+}
+
+// Registers a device and returns its index in devices. The entry is
+// zeroed apart from its pid, so it has no routes. Returns -1 if
+// the pid is already registered or memory could not be allocated.
+int registry_insert(struct registry *r, pid_t pid)
+{
+    if (pid == 0 || registry_lookup(r, pid) != -1)
+    {
+        return -1;
+    }
+
+    // Keep the load factor at or below one half
+    if ((r->size + 1) * 2 > r->slot_mask + 1 && grow_slots(r) == -1)
+    {
+        return -1;
+    }
+
+    int index;
+    if (r->free_count > 0)
+    {
+        index = r->free_indices[--r->free_count];
+    }
+    else
+    {
+        if (r->device_count == r->device_capacity && grow_devices(r) == -1)
+        {
+            return -1;
+        }
+        index = r->device_count++;
+    }
+
+    memset((void *)&r->devices[index], 0, sizeof(struct device_info));
+    r->devices[index].pid = pid;
+
+    unsigned int i = hash_pid(pid, r->slot_mask);
+    while (r->slots[i].pid != 0)
+    {
+        i = (i + 1) & r->slot_mask;
+    }
+    r->slots[i].pid = pid;
+    r->slots[i].index = index;
+    r->size++;
+
+    return index;
+}
+
+// Removes a device and returns the index it occupied, or -1 if it was
+// not registered. The entry is cleared, its routes are freed and its
+// index is handed out to the next device inserted.
+int registry_remove(struct registry *r, pid_t pid)
+{
+    unsigned int i = hash_pid(pid, r->slot_mask);
+
+    while (r->slots[i].pid != pid)
+    {
+        if (r->slots[i].pid == 0)
+        {
+            return -1;
+        }
+        i = (i + 1) & r->slot_mask;
+    }
+
+    int index = r->slots[i].index;
+    r->devices[index].pid = 0;
+    free(r->devices[index].routes);
+    r->devices[index].routes = NULL;
+    r->devices[index].route_count = 0;
+    r->devices[index].route_capacity = 0;
+    r->free_indices[r->free_count++] = index;
+    r->size--;
+
+    // Backward shift deletion: pull later entries of the probe run into
+    // the hole so that lookups never need tombstones
+    unsigned int hole = i;
+    unsigned int j = (i + 1) & r->slot_mask;
+    while (r->slots[j].pid != 0)
+    {
+        unsigned int home = hash_pid(r->slots[j].pid, r->slot_mask);
+        if (((j - home) & r->slot_mask) >= ((j - hole) & r->slot_mask))
+        {
+            r->slots[hole] = r->slots[j];
+            hole = j;
+        }
+        j = (j + 1) & r->slot_mask;
+    }
+    r->slots[hole].pid = 0;
+
+    return index;
+}
+
+void registry_destroy(struct registry *r)
+{
+    if (r->devices != NULL)
+    {
+        for (unsigned int i=0; i<r->device_count; i++)
+        {
+            free(r->devices[i].routes);
+        }
+    }
+    free(r->slots);
+    free(r->devices);
+    free(r->free_indices);
+    free(r);
+}
+
+// Adds a route to a device. Returns 0 if it was added, 1 if it already
+// existed and -1 if memory could not be allocated.
+int registry_add_route(struct device_info *device, pid_t pid, int msgid)
+{
+    unsigned int position = device->route_count;
+
+    for (unsigned int i=0; i<device->route_count; i++)
+    {
+        if (device->routes[i].pid == pid)
+        {
+            return 1;
+        }
+        if (position == device->route_count && device->routes[i].msgid > msgid)
+        {
+            position = i;
+        }
+    }
+
+    if (device->route_count == device->route_capacity)
+    {
+        unsigned int new_capacity = device->route_capacity == 0 ? 4 : device->route_capacity << 1;
+        struct route *new_routes = realloc(device->routes, new_capacity * sizeof(struct route));
+        if (new_routes == NULL)
+        {
+            return -1;
+        }
+        device->routes = new_routes;
+        device->route_capacity = new_capacity;
+    }
+
+    memmove((void *)&device->routes[position + 1], (const void *)&device->routes[position],
+            (device->route_count - position) * sizeof(struct route));
+    device->routes[position].pid = pid;
+    device->routes[position].msgid = msgid;
+    device->route_count++;
+
+    return 0;
+}
+
+// Removes a route from a device. Returns -1 if there was no such route.
+int registry_remove_route(struct device_info *device, pid_t pid)
+{
+    for (unsigned int i=0; i<device->route_count; i++)
+    {
+        if (device->routes[i].pid == pid)
+        {
+            memmove((void *)&device->routes[i], (const void *)&device->routes[i + 1],
+                    (device->route_count - i - 1) * sizeof(struct route));
+            device->route_count--;
+            return 0;
+        }
+    }
+
+    return -1;
+}
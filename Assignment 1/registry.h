@@ -0,0 +1,96 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: registry.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * A registry of devices known to the Controller, indexed by pid.
+ *
+ */
+#ifndef REGISTRY_H_
+#define REGISTRY_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "message_queue.h"
+
+// A Sensor's route to an Actuator its threshold breaches are sent to,
+// or the reverse link from an Actuator to a Sensor routed to it
+struct route
+{
+    pid_t pid;
+    int msgid;
+};
+
+struct aggregate;
+struct rule_state;
+
+struct device_info
+{
+    pid_t pid;
+    char name[MAX_NAME_LENGTH];
+    char device_type;
+    int threshold;
+    int base_threshold; // Threshold the Sensor registered with
+    int msgid;          // Queue this device is sent messages on
+    pid_t host_pid;     // Process that runs the device
+
+    // Latest reading of a Sensor and when it was taken, in monotonic
+    // microseconds, or 0 if none has arrived yet
+    int last_reading;
+    long long last_sampled;
+
+    // Aggregates of a Sensor's readings, or NULL if they are not kept
+    struct aggregate *aggregate;
+
+    // Rules that apply to a Sensor, its progress through each, and its
+    // slot if conditions name it, or -1
+    uint64_t rule_mask;
+    struct rule_state *rule_states;
+    int rule_slot;
+
+    // Routes of a Sensor, kept sorted by queue so that commands for
+    // Actuators sharing a queue are next to each other. For an
+    // Actuator, the Sensors routed to it.
+    struct route *routes;
+    unsigned int route_count;
+    unsigned int route_capacity;
+};
+
+// Open addressing hash slot mapping a pid to an index in devices.
+// A pid of 0 marks an empty slot.
+struct registry_slot
+{
+    pid_t pid;
+    int index;
+};
+
+struct registry
+{
+    struct registry_slot *slots;
+    unsigned int slot_mask;
+    unsigned int size;
+
+    struct device_info *devices;
+    unsigned int device_capacity;
+    unsigned int device_count;
+
+    // Indices of removed devices, reused before the array grows
+    int *free_indices;
+    unsigned int free_count;
+};
+
+struct registry *registry_create();
+int registry_lookup(struct registry *r, pid_t pid);
+int registry_insert(struct registry *r, pid_t pid);
+int registry_remove(struct registry *r, pid_t pid);
+void registry_destroy(struct registry *r);
+
+int registry_add_route(struct device_info *device, pid_t pid, int msgid);
+int registry_remove_route(struct device_info *device, pid_t pid);
+
+#endif
@@ -0,0 +1,641 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: rules.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the rules. Parsing fills in the tables of a rule
+ * set: every rule points at a run of conditions in one flat array,
+ * and every Sensor named in a condition gets a slot for its latest
+ * values. Checking a reading then only walks those arrays.
+ *
+ */
+#include "rules.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct rule_parser
+{
+    struct rule_set *set;
+    char *cursor;               // Rest of the line being parsed
+    int line;
+    char *error;
+    size_t error_size;
+};
+
+static const char *g_operand_names[RULE_OPERAND_COUNT] =
+{
+    "reading", "mean", "min", "max", "ewma"
+};
+
+static const char *g_op_names[] =
+{
+    ">", ">=", "<", "<=", "==", "!="
+};
+
+// Describes what went wrong on the current line. Returns -1.
+static int parse_error(struct rule_parser *parser, const char *format, ...)
+{
+    va_list args;
+    int length = snprintf(parser->error, parser->error_size, "line %d: ", parser->line);
+
+    if (length >= 0 && (size_t)length < parser->error_size)
+    {
+        va_start(args, format);
+        vsnprintf(parser->error + length, parser->error_size - length, format, args);
+        va_end(args);
+    }
+
+    return -1;
+}
+
+// Returns the next word of the line, or the text between a pair of
+// quotes, and moves past it. Returns NULL at the end of the line.
+static char *next_token(struct rule_parser *parser)
+{
+    char *p = parser->cursor;
+    char *start;
+
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+    {
+        p++;
+    }
+    if (*p == '\0')
+    {
+        parser->cursor = p;
+        return NULL;
+    }
+
+    if (*p == '"')
+    {
+        start = ++p;
+        while (*p != '\0' && *p != '"')
+        {
+            p++;
+        }
+    }
+    else
+    {
+        start = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+        {
+            p++;
+        }
+    }
+
+    if (*p != '\0')
+    {
+        *p++ = '\0';
+    }
+    parser->cursor = p;
+
+    return start;
+}
+
+// Returns the slot of a Sensor named in a condition, adding it if it
+// is new, or -1 if there are too many
+static int find_slot(struct rule_set *set, const char *name)
+{
+    int slot = rules_slot(set, name);
+
+    if (slot == -1 && set->slot_count < RULES_SLOTS_MAX)
+    {
+        slot = set->slot_count++;
+        strncpy(set->slots[slot].name, name, MAX_NAME_LENGTH - 1);
+    }
+
+    return slot;
+}
+
+// Parses "[SENSOR.]VALUE OP NUMBER|threshold" into the next condition
+static int parse_condition(struct rule_parser *parser)
+{
+    struct rule_set *set = parser->set;
+    char *operand = next_token(parser);
+    char *op = next_token(parser);
+    char *value = next_token(parser);
+    char *end;
+
+    if (value == NULL)
+    {
+        return parse_error(parser, "expected a condition such as \"reading >= 80\"");
+    }
+    if (set->condition_count == RULES_CONDITIONS_MAX)
+    {
+        return parse_error(parser, "more than %d conditions", RULES_CONDITIONS_MAX);
+    }
+
+    struct rule_condition *condition = &set->conditions[set->condition_count];
+    condition->slot = -1;
+
+    char *dot = strrchr(operand, '.');
+    if (dot != NULL)
+    {
+        *dot = '\0';
+        int slot = find_slot(set, operand);
+        if (slot == -1)
+        {
+            return parse_error(parser, "more than %d Sensors named in conditions", RULES_SLOTS_MAX);
+        }
+        condition->slot = slot;
+        operand = dot + 1;
+    }
+
+    condition->operand = RULE_OPERAND_COUNT;
+    for (int i=0; i<RULE_OPERAND_COUNT; i++)
+    {
+        if (strcmp(operand, g_operand_names[i]) == 0)
+        {
+            condition->operand = i;
+        }
+    }
+    if (condition->operand == RULE_OPERAND_COUNT)
+    {
+        return parse_error(parser, "unknown value '%s', expected reading, mean, min, max or ewma",
+                operand);
+    }
+
+    condition->op = sizeof(g_op_names) / sizeof(g_op_names[0]);
+    for (unsigned int i=0; i<sizeof(g_op_names) / sizeof(g_op_names[0]); i++)
+    {
+        if (strcmp(op, g_op_names[i]) == 0)
+        {
+            condition->op = i;
+        }
+    }
+    if (condition->op == sizeof(g_op_names) / sizeof(g_op_names[0]))
+    {
+        return parse_error(parser, "unknown comparison '%s'", op);
+    }
+
+    if (strcmp(value, "threshold") == 0)
+    {
+        condition->against_threshold = 1;
+    }
+    else
+    {
+        condition->value = strtof(value, &end);
+        if (*end != '\0')
+        {
+            return parse_error(parser, "'%s' is not a number", value);
+        }
+    }
+
+    if (condition->operand != RULE_READING)
+    {
+        set->uses_window = 1;
+    }
+    set->condition_count++;
+
+    return 0;
+}
+
+// Parses COND [and COND ...]. Leaves the word after them in *word.
+static int parse_conditions(struct rule_parser *parser, unsigned short *first,
+        unsigned short *count, char **word)
+{
+    *first = parser->set->condition_count;
+    do
+    {
+        if (parse_condition(parser) == -1)
+        {
+            return -1;
+        }
+        *word = next_token(parser);
+    }
+    while (*word != NULL && strcmp(*word, "and") == 0);
+
+    *count = parser->set->condition_count - *first;
+
+    return 0;
+}
+
+// Parses one rule from the start of the line
+static int parse_rule(struct rule_parser *parser)
+{
+    struct rule_set *set = parser->set;
+    char *name = next_token(parser);
+    char *word;
+
+    if (set->rule_count == RULES_MAX)
+    {
+        return parse_error(parser, "more than %d rules", RULES_MAX);
+    }
+    if (name == NULL || strlen(name) >= RULE_NAME_LENGTH)
+    {
+        return parse_error(parser, "expected a rule name of at most %d characters",
+                RULE_NAME_LENGTH - 1);
+    }
+
+    struct rule *rule = &set->rules[set->rule_count];
+    strcpy(rule->name, name);
+    rule->debounce = 1;
+
+    word = next_token(parser);
+    char *sensor = next_token(parser);
+    if (word == NULL || strcmp(word, "on") != 0 || sensor == NULL
+            || strlen(sensor) >= MAX_NAME_LENGTH)
+    {
+        return parse_error(parser, "expected \"on SENSOR\" after the rule name");
+    }
+    if (strcmp(sensor, "*") != 0)
+    {
+        strcpy(rule->sensor, sensor);
+    }
+
+    word = next_token(parser);
+    if (word == NULL || strcmp(word, "when") != 0)
+    {
+        return parse_error(parser, "expected \"when\" after the Sensor");
+    }
+    if (parse_conditions(parser, &rule->first, &rule->count, &word) == -1)
+    {
+        return -1;
+    }
+
+    if (word != NULL && strcmp(word, "for") == 0)
+    {
+        char *end;
+        char *readings = next_token(parser);
+        long debounce = readings != NULL ? strtol(readings, &end, 10) : 0;
+        if (readings == NULL || *end != '\0' || debounce < 1)
+        {
+            return parse_error(parser, "expected a number of readings of at least 1 after \"for\"");
+        }
+        rule->debounce = debounce;
+        word = next_token(parser);
+    }
+
+    if (word != NULL && strcmp(word, "clear") == 0)
+    {
+        if (parse_conditions(parser, &rule->clear_first, &rule->clear_count, &word) == -1)
+        {
+            return -1;
+        }
+    }
+
+    char *action = next_token(parser);
+    if (word == NULL || strcmp(word, "do") != 0 || action == NULL)
+    {
+        return parse_error(parser, "expected \"do \\\"ACTION\\\"\" at the end of the rule");
+    }
+    if (strlen(action) >= MAX_DATA_LENGTH)
+    {
+        return parse_error(parser, "action is longer than %d characters", MAX_DATA_LENGTH - 1);
+    }
+    strcpy(rule->action, action);
+
+    if (next_token(parser) != NULL)
+    {
+        return parse_error(parser, "unexpected text after the action");
+    }
+
+    set->rule_count++;
+
+    return 0;
+}
+
+// Parses "threshold SENSOR VALUE" after its first word
+static int parse_threshold(struct rule_parser *parser)
+{
+    struct rule_set *set = parser->set;
+    char *sensor = next_token(parser);
+    char *value = next_token(parser);
+    char *end;
+
+    if (set->threshold_count == RULES_THRESHOLDS_MAX)
+    {
+        return parse_error(parser, "more than %d thresholds", RULES_THRESHOLDS_MAX);
+    }
+    if (value == NULL || strlen(sensor) >= MAX_NAME_LENGTH || next_token(parser) != NULL)
+    {
+        return parse_error(parser, "expected \"threshold SENSOR VALUE\"");
+    }
+
+    struct rule_threshold *threshold = &set->thresholds[set->threshold_count];
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0')
+    {
+        return parse_error(parser, "'%s' is not a whole number", value);
+    }
+    strcpy(threshold->sensor, sensor);
+    threshold->threshold = parsed;
+    set->threshold_count++;
+
+    return 0;
+}
+
+// Parses "map SENSOR ACTUATOR" after its first word
+static int parse_map(struct rule_parser *parser)
+{
+    struct rule_set *set = parser->set;
+    char *sensor = next_token(parser);
+    char *actuator = next_token(parser);
+
+    if (set->map_count == RULES_MAPS_MAX)
+    {
+        return parse_error(parser, "more than %d maps", RULES_MAPS_MAX);
+    }
+    if (actuator == NULL || strlen(sensor) >= MAX_NAME_LENGTH
+            || strlen(actuator) >= MAX_NAME_LENGTH || next_token(parser) != NULL)
+    {
+        return parse_error(parser, "expected \"map SENSOR ACTUATOR\"");
+    }
+
+    strcpy(set->maps[set->map_count].sensor, sensor);
+    strcpy(set->maps[set->map_count].actuator, actuator);
+    set->map_count++;
+
+    return 0;
+}
+
+// Compiles the rules in text, which is changed in the process. Blank
+// lines and lines starting with # are skipped. Returns -1 and
+// describes the first error if a rule cannot be parsed.
+int rules_parse(struct rule_set *set, char *text, char *error, size_t error_size)
+{
+    struct rule_parser parser = { set, text, 0, error, error_size };
+
+    memset((void *)set, 0, sizeof(*set));
+
+    while (parser.cursor != NULL)
+    {
+        char *line = parser.cursor;
+        char *newline = strchr(line, '\n');
+        if (newline != NULL)
+        {
+            *newline = '\0';
+        }
+        parser.line++;
+
+        char *word = next_token(&parser);
+        int result = 0;
+        if (word == NULL || word[0] == '#')
+        {
+            result = 0;
+        }
+        else if (strcmp(word, "rule") == 0)
+        {
+            result = parse_rule(&parser);
+        }
+        else if (strcmp(word, "threshold") == 0)
+        {
+            result = parse_threshold(&parser);
+        }
+        else if (strcmp(word, "map") == 0)
+        {
+            result = parse_map(&parser);
+        }
+        else
+        {
+            result = parse_error(&parser, "expected \"rule\", \"threshold\" or \"map\" at the start of the line");
+        }
+        if (result == -1)
+        {
+            return -1;
+        }
+
+        parser.cursor = newline != NULL ? newline + 1 : NULL;
+    }
+
+    return 0;
+}
+
+// Compiles the rules in a file. Returns -1 and describes the error if
+// the file cannot be read or a rule cannot be parsed.
+int rules_load(struct rule_set *set, const char *path, char *error, size_t error_size)
+{
+    FILE *file = fopen(path, "r");
+    char *text = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    size_t result;
+
+    if (file == NULL)
+    {
+        snprintf(error, error_size, "could not open %s", path);
+        return -1;
+    }
+
+    do
+    {
+        if (length + 1 >= capacity)
+        {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            char *grown = realloc(text, capacity);
+            if (grown == NULL)
+            {
+                free(text);
+                fclose(file);
+                snprintf(error, error_size, "could not allocate memory for %s", path);
+                return -1;
+            }
+            text = grown;
+        }
+        result = fread(text + length, 1, capacity - length - 1, file);
+        length += result;
+    }
+    while (result > 0);
+
+    int failed = ferror(file);
+    fclose(file);
+    if (failed)
+    {
+        free(text);
+        snprintf(error, error_size, "could not read %s", path);
+        return -1;
+    }
+
+    text[length] = '\0';
+    int parsed = rules_parse(set, text, error, error_size);
+    free(text);
+
+    return parsed;
+}
+
+// Returns a mask of the rules that apply to a Sensor with this name
+uint64_t rules_match(const struct rule_set *set, const char *sensor)
+{
+    uint64_t mask = 0;
+
+    for (int i=0; i<set->rule_count; i++)
+    {
+        if (set->rules[i].sensor[0] == '\0' || strcmp(set->rules[i].sensor, sensor) == 0)
+        {
+            mask |= 1ULL << i;
+        }
+    }
+
+    return mask;
+}
+
+// Returns the slot of a Sensor named in a condition, or -1 if no
+// condition names it
+int rules_slot(const struct rule_set *set, const char *sensor)
+{
+    for (int i=0; i<set->slot_count; i++)
+    {
+        if (strcmp(set->slots[i].name, sensor) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Returns the threshold the set gives Sensors with this name, or the
+// given one if it gives none
+int rules_threshold(const struct rule_set *set, const char *sensor, int threshold)
+{
+    for (int i=0; i<set->threshold_count; i++)
+    {
+        if (strcmp(set->thresholds[i].sensor, sensor) == 0)
+        {
+            threshold = set->thresholds[i].threshold;
+        }
+    }
+
+    return threshold;
+}
+
+// Returns whether the set routes Sensors with one name to Actuators
+// with the other. A NULL name matches any.
+int rules_mapped(const struct rule_set *set, const char *sensor, const char *actuator)
+{
+    for (int i=0; i<set->map_count; i++)
+    {
+        if ((sensor == NULL || strcmp(set->maps[i].sensor, sensor) == 0)
+                && (actuator == NULL || strcmp(set->maps[i].actuator, actuator) == 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Makes a Sensor's latest values visible to conditions that name it
+void rules_publish(struct rule_set *set, int slot, const struct rule_input *input)
+{
+    struct rule_slot *target = &set->slots[slot];
+
+    for (int i=0; i<RULE_OPERAND_COUNT; i++)
+    {
+        __atomic_store(&target->values[i], &input->values[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&target->valid, 1, __ATOMIC_RELEASE);
+}
+
+// Returns whether every condition in a run holds. A condition on a
+// Sensor that has not sent a reading yet does not.
+static int conditions_hold(const struct rule_set *set, unsigned int first, unsigned int count,
+        const struct rule_input *input)
+{
+    const struct rule_condition *condition = &set->conditions[first];
+
+    for (unsigned int i=0; i<count; i++, condition++)
+    {
+        float left;
+        float right = condition->against_threshold ? (float)input->threshold : condition->value;
+        int result;
+
+        if (condition->slot < 0)
+        {
+            left = input->values[condition->operand];
+        }
+        else
+        {
+            const struct rule_slot *slot = &set->slots[(int)condition->slot];
+            if (!__atomic_load_n(&slot->valid, __ATOMIC_ACQUIRE))
+            {
+                return 0;
+            }
+            __atomic_load(&slot->values[condition->operand], &left, __ATOMIC_RELAXED);
+        }
+
+        switch (condition->op)
+        {
+        case RULE_GT:
+            result = left > right;
+            break;
+        case RULE_GE:
+            result = left >= right;
+            break;
+        case RULE_LT:
+            result = left < right;
+            break;
+        case RULE_LE:
+            result = left <= right;
+            break;
+        case RULE_EQ:
+            result = left == right;
+            break;
+        default:
+            result = left != right;
+            break;
+        }
+
+        if (!result)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Checks one reading against the rules in mask, advancing the Sensor's
+// state in each. Returns a mask of the rules that fire.
+uint64_t rules_evaluate(const struct rule_set *set, uint64_t mask, struct rule_state *states,
+        const struct rule_input *input)
+{
+    uint64_t fired = 0;
+
+    while (mask != 0)
+    {
+        int i = __builtin_ctzll(mask);
+        const struct rule *rule = &set->rules[i];
+        struct rule_state *state = &states[i];
+        mask &= mask - 1;
+
+        if (state->latched)
+        {
+            if (conditions_hold(set, rule->clear_first, rule->clear_count, input))
+            {
+                state->latched = 0;
+            }
+            continue;
+        }
+
+        if (!conditions_hold(set, rule->first, rule->count, input))
+        {
+            state->streak = 0;
+            continue;
+        }
+
+        if (state->streak < rule->debounce)
+        {
+            state->streak++;
+        }
+        if (state->streak < rule->debounce)
+        {
+            continue;
+        }
+
+        fired |= 1ULL << i;
+        if (rule->clear_count > 0)
+        {
+            state->latched = 1;
+            state->streak = 0;
+        }
+    }
+
+    return fired;
+}
@@ -0,0 +1,154 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: rules.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Rules that decide when a Sensor's readings trigger its Actuators and
+ * what they are sent. Rules are written one per line:
+ *
+ *   rule NAME on SENSOR when COND [and COND ...] [for N]
+ *       [clear COND [and COND ...]] do "ACTION"
+ *
+ * SENSOR is a Sensor's name, or * for every Sensor. A COND compares a
+ * value of the Sensor, or of another Sensor named as NAME.value, with
+ * a number or the Sensor's threshold, as in "reading >= 80" or
+ * "pump.mean < threshold". The values are reading, and mean, min, max
+ * and ewma over the Controller's sliding window. With "for N", the
+ * conditions must hold for N readings in a row. With "clear", the rule
+ * fires once and then not again until the clear conditions hold.
+ *
+ * The same file may also set the threshold of Sensors by name, and
+ * route Sensors to Actuators by name:
+ *
+ *   threshold SENSOR VALUE
+ *   map SENSOR ACTUATOR
+ *
+ * Rules are compiled into flat tables when they are loaded. Checking
+ * a reading runs through the conditions of the Sensor's rules without
+ * allocating anything. A loaded set is never changed, other than the
+ * slots, so it can be replaced by a newly loaded one while in use.
+ *
+ */
+#ifndef RULES_H_
+#define RULES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "message_queue.h"
+
+#define RULES_MAX 64                // One bit of a mask each
+#define RULES_CONDITIONS_MAX 256
+#define RULES_SLOTS_MAX 32          // Sensors named in conditions
+#define RULES_THRESHOLDS_MAX 64
+#define RULES_MAPS_MAX 64
+#define RULE_NAME_LENGTH 32
+
+// Values of a Sensor that conditions compare
+enum rule_operand
+{
+    RULE_READING,
+    RULE_MEAN,
+    RULE_MIN,
+    RULE_MAX,
+    RULE_EWMA,
+    RULE_OPERAND_COUNT
+};
+
+enum rule_op
+{
+    RULE_GT,
+    RULE_GE,
+    RULE_LT,
+    RULE_LE,
+    RULE_EQ,
+    RULE_NE
+};
+
+struct rule_condition
+{
+    unsigned char operand;
+    unsigned char op;
+    unsigned char against_threshold; // Compared with the threshold, not value
+    signed char slot;           // Sensor named in the condition, or -1 for this one
+    float value;
+};
+
+struct rule
+{
+    char name[RULE_NAME_LENGTH];
+    char sensor[MAX_NAME_LENGTH]; // Empty for every Sensor
+    unsigned short first;       // Conditions that make the rule fire
+    unsigned short count;
+    unsigned short clear_first; // Conditions that rearm it, if it latches
+    unsigned short clear_count;
+    unsigned int debounce;      // Readings in a row the conditions must hold for
+    char action[MAX_DATA_LENGTH];
+};
+
+// Latest values of a Sensor named in a condition. Written by the shard
+// that owns the Sensor and read by any other.
+struct rule_slot
+{
+    char name[MAX_NAME_LENGTH];
+    int valid;
+    float values[RULE_OPERAND_COUNT];
+};
+
+struct rule_threshold
+{
+    char sensor[MAX_NAME_LENGTH];
+    int threshold;
+};
+
+struct rule_map
+{
+    char sensor[MAX_NAME_LENGTH];
+    char actuator[MAX_NAME_LENGTH];
+};
+
+struct rule_set
+{
+    int rule_count;
+    int condition_count;
+    int slot_count;
+    int threshold_count;
+    int map_count;
+    int uses_window;            // Whether any condition needs the sliding window
+    int references;             // Users of the set, the last of which frees it
+    struct rule rules[RULES_MAX];
+    struct rule_condition conditions[RULES_CONDITIONS_MAX];
+    struct rule_slot slots[RULES_SLOTS_MAX];
+    struct rule_threshold thresholds[RULES_THRESHOLDS_MAX];
+    struct rule_map maps[RULES_MAPS_MAX];
+};
+
+// A Sensor's progress through one rule
+struct rule_state
+{
+    unsigned int streak;        // Readings in a row the conditions held for
+    int latched;                // Fired, and waiting for the clear conditions
+};
+
+// What the rules see of the Sensor a reading came from
+struct rule_input
+{
+    float values[RULE_OPERAND_COUNT];
+    int threshold;
+};
+
+int rules_parse(struct rule_set *set, char *text, char *error, size_t error_size);
+int rules_load(struct rule_set *set, const char *path, char *error, size_t error_size);
+uint64_t rules_match(const struct rule_set *set, const char *sensor);
+int rules_slot(const struct rule_set *set, const char *sensor);
+int rules_threshold(const struct rule_set *set, const char *sensor, int threshold);
+int rules_mapped(const struct rule_set *set, const char *sensor, const char *actuator);
+void rules_publish(struct rule_set *set, int slot, const struct rule_input *input);
+uint64_t rules_evaluate(const struct rule_set *set, uint64_t mask, struct rule_state *states,
+        const struct rule_input *input);
+
+#endif
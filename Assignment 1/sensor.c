@@ -19,14 +19,23 @@
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
 
-#include <sys/time.h>
 #include <sys/msg.h>
 
 #include "message_queue.h"
+#include "transport.h"
+#include "timestamp.h"
 
 #define DEFAULT_MAX_READING 100
 #define DEFAULT_THRESHOLD 90
+#define DEFAULT_PERIOD_MS 2000
+
+void sample_due(int signal_number);
+void program_done(int signal_number);
+int send_to_controller(struct transport *transport, const struct message_struct *message);
+
+sig_atomic_t g_program_done_flag = 0;
 
 int main(int argc, char* argv[])
 {
@@ -37,31 +46,81 @@ int main(int argc, char* argv[])
     int threshold = DEFAULT_THRESHOLD;
     int max_reading = DEFAULT_MAX_READING;
     int sensor_reading;
+    long long sampled;
+    int batch_size = 1;
+    int period_ms = DEFAULT_PERIOD_MS;
+    int transport_kind = TRANSPORT_MSGQUEUE;
+    int dedicated_queue = 0;
+    int reply_msgid = REPLY_SHARED_QUEUE;
+    int option;
+
+    struct transport transport;
 
-    int running = 1;
-    struct timeval t1, t2;
+    long long period_us;
+    long long next_sample;
+    timer_t timer;
+    struct sigevent sev;
+    struct itimerspec its;
+    struct sigaction sa;
 
     struct message_struct tx_data;
     struct message_struct rx_data;
-    int tx_data_size = sizeof(struct message_struct) - sizeof(long);
-    int rx_data_size = sizeof(struct message_struct) - sizeof(long);
+    struct message_struct batch;
+
+    while ((option = getopt(argc, argv, "Qb:p:t:")) != -1)
+    {
+        switch (option)
+        {
+        case 'Q':
+            dedicated_queue = 1;
+            break;
+        case 'b':
+            batch_size = atoi(optarg);
+            break;
+        case 'p':
+            period_ms = atoi(optarg);
+            break;
+        case 't':
+            transport_kind = transport_parse(optarg);
+            if (transport_kind != -1)
+            {
+                break;
+            }
+            // Fall through
+        default:
+            fprintf(stderr, "Usage: sensor [-Q] [-b BATCH_SIZE] [-p PERIOD_MS] [-t msgqueue|shm] NAME [THRESHOLD] [MAX_READING]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    if (argc < 2)
+    if (argc - optind < 1)
     {
-        fprintf(stderr, "Usage: sensor NAME [THRESHOLD] [MAX_READING]\n");
+        fprintf(stderr, "Usage: sensor [-Q] [-b BATCH_SIZE] [-p PERIOD_MS] [-t msgqueue|shm] NAME [THRESHOLD] [MAX_READING]\n");
         exit(EXIT_FAILURE);
     }
 
-    name = argv[1];
+    name = argv[optind];
+
+    if (argc - optind > 1)
+    {
+        threshold = atoi(argv[optind + 1]);
+    }
+
+    if (argc - optind > 2)
+    {
+        max_reading = atoi(argv[optind + 2]);
+    }
 
-    if (argc > 2)
+    if (batch_size < 1 || batch_size > MAX_BATCH_READINGS)
     {
-        threshold = atoi(argv[2]);
+        fprintf(stderr, "BATCH_SIZE(%d) must be between 1 and %d\n", batch_size, MAX_BATCH_READINGS);
+        exit(EXIT_FAILURE);
     }
 
-    if (argc > 3)
+    if (period_ms < 1)
     {
-        max_reading = atoi(argv[3]);
+        fprintf(stderr, "PERIOD_MS(%d) must be at least 1\n", period_ms);
+        exit(EXIT_FAILURE);
     }
 
     if (threshold > max_reading)
@@ -72,39 +131,49 @@ int main(int argc, char* argv[])
 
     printf("Device starting. PID=%d\n", pid);
 
-    // Creates a message queue
-    msgid = msgget((key_t)MESSAGE_QUEUE_ID, 0666 | IPC_CREAT);
-    if (msgid == -1)
+    // Opens the message queue and, if selected, attaches to the
+    // Controller's shared memory ring
+    if (transport_open(&transport, transport_kind, (key_t)MESSAGE_QUEUE_ID,
+                SHM_RING_NAME, 0) == -1)
     {
-        fprintf(stderr, "msgget failed with error: %d\n", errno);
+        fprintf(stderr, "transport_open failed with error: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    msgid = transport.msgid;
+
+    // With a queue of its own, the device's receives do not have to
+    // skip over messages addressed to other devices
+    if (dedicated_queue)
+    {
+        msgid = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
+        if (msgid == -1)
+        {
+            fprintf(stderr, "msgget failed with error: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        reply_msgid = msgid;
+    }
 
     // Initial message to send
-    tx_data.type = TO_CONTROLLER;
-    strncpy(tx_data.fields.name, name, sizeof(tx_data.fields.name));
-    tx_data.fields.device_type = DEVICE_TYPE_SENSOR;
-    tx_data.fields.threshold = threshold;
-    tx_data.fields.pid = pid;
+    message_register(&tx_data, pid, DEVICE_TYPE_SENSOR, threshold, reply_msgid, name);
 
     // Send initial message to controller
     printf("Attempting to establish connection with Controller...\n");
-    if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+    if (transport_send(&transport, &tx_data) == -1)
     {
         fprintf(stderr, "msgsnd failed\n");
         exit(EXIT_FAILURE);
     }
 
     // Receive acknowledgement message from controller
-    if (msgrcv(msgid, (void *)&rx_data, rx_data_size,
-                pid, 0) == -1)
+    if (message_receive(msgid, &rx_data, pid, 0) == -1)
     {
         fprintf(stderr, "msgrcv failed with error: %d\n", errno);
         exit(EXIT_FAILURE);
     }
 
     // Check if the message received is an ack
-    if (strncmp(rx_data.fields.data, "ack", 3) != 0)
+    if (rx_data.header.kind != MESSAGE_ACK)
     {
         fprintf(stderr, "Expected ack message but received non-ack message\n");
         exit(EXIT_FAILURE);
@@ -114,83 +183,168 @@ int main(int argc, char* argv[])
     // Initilize random number generator
     srand(time(NULL));
 
-    // Make note of current time
-    gettimeofday(&t1, NULL);
-    while (running)
+    // Readings are accumulated here and sent once batch_size are ready
+    message_init(&batch, TO_CONTROLLER, MESSAGE_READINGS, pid);
+    batch.payload.readings.count = 0;
+
+    // The timer's signal interrupts the blocking msgrcv below with
+    // EINTR, so it must not restart system calls
+    memset((void *)&sa, 0, sizeof(sa));
+    sa.sa_handler = &sample_due;
+    sigaction(SIGALRM, &sa, 0);
+
+    // Deregister from the controller when interrupted
+    sa.sa_handler = &program_done;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+
+    // Fires every period on the monotonic clock
+    memset((void *)&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGALRM;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timer) == -1)
     {
-        // Get current time
-        gettimeofday(&t2, NULL);
+        fprintf(stderr, "timer_create failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // The first deadline is noted before the timer starts, so every
+    // tick lands at or after the deadline it is meant for
+    period_us = period_ms * 1000LL;
+    next_sample = timestamp_now() + period_us;
 
-        // Compare current time to previously noted time and enter block
-        // if the time difference is greater or equal than 2 seconds
-        if ((t2.tv_sec - t1.tv_sec) >= 2)
+    its.it_value.tv_sec = period_ms / 1000;
+    its.it_value.tv_nsec = (period_ms % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    if (timer_settime(timer, 0, &its, NULL) == -1)
+    {
+        fprintf(stderr, "timer_settime failed with error: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    sensor_reading = 0;
+    sampled = 0;
+
+    while (!g_program_done_flag)
+    {
+        // Take a sample once its deadline has passed. Deadlines are
+        // tracked separately from the timer so that a tick that lands
+        // just before msgrcv only delays a sample, and missed periods
+        // are skipped rather than sampled in a burst.
+        long long now = timestamp_now();
+        if (now >= next_sample)
         {
             // Generate a random number between 0 and MAX_READING
             sensor_reading = rand()%(max_reading+1);
+            sampled = now;
             printf("Sensor reading = %d\n", sensor_reading);
 
             if (sensor_reading >= threshold)
             {
                 printf("Sensor reading exceeded THRESHOLD(%d)!\n", threshold);
-                //running = 0;
             }
 
-            // Constructs and sends update message to controller
-            memset((void *)&tx_data, 0, sizeof(tx_data));
-            tx_data.type = TO_CONTROLLER;
-            tx_data.fields.sensor_reading = sensor_reading;
-            tx_data.fields.pid = pid;
+            // Adds the reading to the batch and sends the batch to the
+            // controller once it is full
+            struct readings_payload *readings = &batch.payload.readings;
+            readings->readings[readings->count].timestamp = now;
+            readings->readings[readings->count].value = sensor_reading;
+            readings->count++;
 
-            if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
+            if (readings->count == batch_size)
             {
-                fprintf(stderr, "msgsnd failed\n");
-                exit(EXIT_FAILURE);
+                batch.header.length = READINGS_PAYLOAD_SIZE(readings->count);
+                if (send_to_controller(&transport, &batch) == -1 && !g_program_done_flag)
+                {
+                    fprintf(stderr, "msgsnd failed\n");
+                    exit(EXIT_FAILURE);
+                }
+                readings->count = 0;
             }
 
-            // Make note of current time
-            gettimeofday(&t1, NULL);
+            next_sample += period_us;
+            if (next_sample <= now)
+            {
+                next_sample += ((now - next_sample) / period_us + 1) * period_us;
+            }
         }
 
-        // Poll for stop message
-        int result = msgrcv(msgid, (void *)&rx_data, rx_data_size,
-                pid, IPC_NOWAIT);
-        if (result == -1)
+        // Block until a message arrives or the timer fires
+        if (message_receive(msgid, &rx_data, pid, 0) == -1)
         {
-            // Error code ENOMSG(42) corresponds to no message received
-            if (errno != ENOMSG)
+            if (errno != EINTR)
             {
                 fprintf(stderr, "msgrcv failed with error: %d\n", errno);
                 exit(EXIT_FAILURE);
             }
+            continue;
         }
-        else if (result > 0)
+
+        // If a stop messge is received, stop the device
+        if (rx_data.header.kind == MESSAGE_STOP)
         {
-            // If a stop messge is received, stop the device
-            if (strncmp(rx_data.fields.data, "stop", 3) == 0)
-            {
-                printf("Received stop command from Controller. Stopping device.\n");
-                break;
-            }
-            // If a query message is received, respond
-            else
-            {
-                // Constructs and sends update message to controller
-                memset((void *)&tx_data, 0, sizeof(tx_data));
-                tx_data.type = TO_CONTROLLER;
-                tx_data.fields.sensor_reading = sensor_reading;
-                tx_data.fields.pid = pid;
-                strncpy(tx_data.fields.data, "query", sizeof(tx_data.fields.data));
-
-                if (msgsnd(msgid, (void *)&tx_data, tx_data_size, 0) == -1)
-                {
-                    fprintf(stderr, "msgsnd failed\n");
-                    exit(EXIT_FAILURE);
-                }
+            printf("Received stop command from Controller. Stopping device.\n");
+            break;
+        }
+        // If a query message is received, respond
+        else if (rx_data.header.kind == MESSAGE_QUERY)
+        {
+            // Constructs and sends query reply to controller
+            message_query_reply(&tx_data, pid, rx_data.payload.query.request_id,
+                    sensor_reading, sampled);
 
+            if (send_to_controller(&transport, &tx_data) == -1 && !g_program_done_flag)
+            {
+                fprintf(stderr, "msgsnd failed\n");
+                exit(EXIT_FAILURE);
             }
         }
+    }
 
+    timer_delete(timer);
+
+    if (dedicated_queue)
+    {
+        msgctl(msgid, IPC_RMID, 0);
+    }
+
+    // The controller may already be gone, so a failure is not reported.
+    // Nor does stopping wait for room; a device that is not deregistered
+    // is removed once the controller sees it has exited.
+    if (g_program_done_flag)
+    {
+        printf("Deregistering from Controller.\n");
+        message_init(&tx_data, TO_CONTROLLER, MESSAGE_DEREGISTER, pid);
+        transport_try_send(&transport, &tx_data);
     }
 
     exit(EXIT_SUCCESS);
 }
+
+// Sends a message to the Controller. The timer interrupts a wait for
+// room with EINTR, after which the message is sent again, unless the
+// Sensor is stopping. Returns -1 on error or when stopping.
+int send_to_controller(struct transport *transport, const struct message_struct *message)
+{
+    while (transport_send(transport, message) == -1)
+    {
+        if (errno != EINTR || g_program_done_flag)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Signal handler for SIGALRM. Only interrupts the blocking msgrcv; the
+// main loop decides whether a sample is due.
+void sample_due(int signal_number)
+{
+}
+
+// Signal handler for SIGINT and SIGTERM
+void program_done(int signal_number)
+{
+    g_program_done_flag = 1;
+}
@@ -0,0 +1,314 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: series.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the on-disk reading store. A segment file is named
+ * after the start of its window, so that listing the directory in name
+ * order lists the segments in time order. Files are sized for a full
+ * segment up front but left sparse, so a segment that is closed early
+ * only takes up the pages that were written.
+ *
+ */
+#include "series.h"
+#include "timestamp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SERIES_HEADER_SIZE 64
+
+static size_t segment_size(unsigned int capacity)
+{
+    return SERIES_HEADER_SIZE + (size_t)capacity * (sizeof(long long) + sizeof(pid_t) + sizeof(int));
+}
+
+// Points a segment's columns into its mapped file
+static void segment_map(struct series_segment *segment, void *memory, unsigned int capacity,
+        size_t size)
+{
+    char *base = memory;
+
+    segment->header = memory;
+    segment->timestamps = (long long *)(base + SERIES_HEADER_SIZE);
+    segment->pids = (pid_t *)(segment->timestamps + capacity);
+    segment->values = (int *)(segment->pids + capacity);
+    segment->size = size;
+}
+
+static void segment_unmap(struct series_segment *segment)
+{
+    if (segment->header != NULL)
+    {
+        munmap((void *)segment->header, segment->size);
+        segment->header = NULL;
+    }
+}
+
+// Creates and maps a new segment for the window starting at
+// window_start. Returns -1 on error.
+static int segment_create(struct series_store *store, long long window_start)
+{
+    char path[SERIES_PATH_MAX + 64];
+    size_t size = segment_size(SERIES_SEGMENT_CAPACITY);
+
+    snprintf(path, sizeof(path), "%s/%020lld-%d-%u-%u.seg", store->directory, window_start,
+            (int)getpid(), store->id, store->sequence++);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (ftruncate(fd, size) == -1)
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        unlink(path);
+        return -1;
+    }
+
+    segment_map(&store->segment, memory, SERIES_SEGMENT_CAPACITY, size);
+
+    struct series_header *header = store->segment.header;
+    header->capacity = SERIES_SEGMENT_CAPACITY;
+    header->count = 0;
+    header->window_start = window_start;
+    header->min_timestamp = window_start + SERIES_WINDOW_US;
+    header->max_timestamp = window_start;
+    header->min_pid = 0x7fffffff;
+    header->max_pid = 0;
+    header->min_value = 0x7fffffff;
+    header->max_value = -0x7fffffff - 1;
+    __atomic_store_n(&header->magic, SERIES_MAGIC, __ATOMIC_RELEASE);
+
+    store->window_end = window_start + SERIES_WINDOW_US;
+
+    return 0;
+}
+
+// Prepares a writer with the given id to add segments to a directory,
+// which is created if needed. Returns -1 on error.
+int series_open(struct series_store *store, const char *directory, unsigned int id)
+{
+    struct timespec wall;
+
+    if (strlen(directory) >= sizeof(store->directory)
+            || (mkdir(directory, 0777) == -1 && errno != EEXIST))
+    {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &wall);
+    strcpy(store->directory, directory);
+    store->id = id;
+    store->sequence = 0;
+    store->wall_offset = (long long)wall.tv_sec * 1000000LL + wall.tv_nsec / 1000 - timestamp_now();
+    store->window_end = 0;
+    store->segment.header = NULL;
+
+    return 0;
+}
+
+// Appends the readings of one Sensor, taken in monotonic time, and
+// publishes them to readers. A new segment is started when the current
+// one is full or a reading falls past its window; readings that arrive
+// late stay in the current segment. Returns -1 on error.
+int series_append(struct series_store *store, pid_t pid, const struct reading *readings,
+        int count)
+{
+    struct series_segment *segment = &store->segment;
+    struct series_header *header = segment->header;
+    unsigned int n = header != NULL ? header->count : 0;
+
+    for (int i=0; i<count; i++)
+    {
+        long long timestamp = readings[i].timestamp + store->wall_offset;
+        int value = readings[i].value;
+
+        if (header == NULL || n == header->capacity || timestamp >= store->window_end)
+        {
+            if (header != NULL)
+            {
+                __atomic_store_n(&header->count, n, __ATOMIC_RELEASE);
+                segment_unmap(segment);
+            }
+            if (segment_create(store, timestamp - timestamp % SERIES_WINDOW_US) == -1)
+            {
+                return -1;
+            }
+            header = segment->header;
+            n = 0;
+        }
+
+        segment->timestamps[n] = timestamp;
+        segment->pids[n] = pid;
+        segment->values[n] = value;
+        n++;
+
+        // Only ever widened, so a reader that sees the new count also
+        // sees a range that covers it
+        if (timestamp < header->min_timestamp)
+        {
+            __atomic_store_n(&header->min_timestamp, timestamp, __ATOMIC_RELAXED);
+        }
+        if (timestamp > header->max_timestamp)
+        {
+            __atomic_store_n(&header->max_timestamp, timestamp, __ATOMIC_RELAXED);
+        }
+        if (pid < header->min_pid)
+        {
+            __atomic_store_n(&header->min_pid, pid, __ATOMIC_RELAXED);
+        }
+        if (pid > header->max_pid)
+        {
+            __atomic_store_n(&header->max_pid, pid, __ATOMIC_RELAXED);
+        }
+        if (value < header->min_value)
+        {
+            __atomic_store_n(&header->min_value, value, __ATOMIC_RELAXED);
+        }
+        if (value > header->max_value)
+        {
+            __atomic_store_n(&header->max_value, value, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (header != NULL)
+    {
+        __atomic_store_n(&header->count, n, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+// Unmaps the open segment. Its readings stay on disk.
+void series_close(struct series_store *store)
+{
+    segment_unmap(&store->segment);
+}
+
+static int is_segment(const struct dirent *entry)
+{
+    size_t length = strlen(entry->d_name);
+    return length > 4 && strcmp(entry->d_name + length - 4, ".seg") == 0;
+}
+
+// Visits one segment's readings of a Sensor between from and to,
+// inclusive. Returns the number visited.
+static long long range_segment(const char *path, pid_t pid, long long from, long long to,
+        series_visit visit, void *context)
+{
+    struct series_segment segment;
+    struct stat info;
+    long long found = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return 0;
+    }
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < SERIES_HEADER_SIZE)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    struct series_header *header = memory;
+    unsigned int capacity = header->capacity;
+
+    // A segment still being created, or not one of ours
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SERIES_MAGIC
+            || segment_size(capacity) > (size_t)info.st_size)
+    {
+        munmap(memory, info.st_size);
+        return 0;
+    }
+
+    segment_map(&segment, memory, capacity, info.st_size);
+    unsigned int count = __atomic_load_n(&header->count, __ATOMIC_ACQUIRE);
+    if (count > capacity)
+    {
+        count = capacity;
+    }
+
+    // Skips segments that cannot hold a match
+    if (__atomic_load_n(&header->min_timestamp, __ATOMIC_RELAXED) <= to
+            && __atomic_load_n(&header->max_timestamp, __ATOMIC_RELAXED) >= from
+            && __atomic_load_n(&header->min_pid, __ATOMIC_RELAXED) <= pid
+            && __atomic_load_n(&header->max_pid, __ATOMIC_RELAXED) >= pid)
+    {
+        for (unsigned int i=0; i<count; i++)
+        {
+            if (segment.pids[i] == pid && segment.timestamps[i] >= from
+                    && segment.timestamps[i] <= to)
+            {
+                struct reading reading = { segment.timestamps[i], segment.values[i] };
+                visit(context, &reading);
+                found++;
+            }
+        }
+    }
+
+    munmap(memory, info.st_size);
+
+    return found;
+}
+
+// Visits every stored reading of a Sensor between from and to, in wall
+// clock microseconds, segment by segment in time order. Returns the
+// number of readings visited, or -1 if the directory cannot be read.
+long long series_range(const char *directory, pid_t pid, long long from, long long to,
+        series_visit visit, void *context)
+{
+    struct dirent **entries;
+    char path[SERIES_PATH_MAX + 64];
+    long long found = 0;
+
+    int count = scandir(directory, &entries, is_segment, alphasort);
+    if (count == -1)
+    {
+        return -1;
+    }
+
+    for (int i=0; i<count; i++)
+    {
+        // Later segments only start later still, but late readings can
+        // put a reading in range into a segment that starts before from
+        if (strtoll(entries[i]->d_name, NULL, 10) <= to)
+        {
+            snprintf(path, sizeof(path), "%s/%s", directory, entries[i]->d_name);
+            found += range_segment(path, pid, from, to, visit, context);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    return found;
+}
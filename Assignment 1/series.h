@@ -0,0 +1,81 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: series.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * An append-only store of Sensor readings kept on disk. Readings are
+ * written to segment files, each covering a window of wall clock time
+ * and holding up to a fixed number of readings. A segment keeps its
+ * timestamps, pids and values in three separate columns and is mapped
+ * into memory while it is written. Its header holds the range of
+ * timestamps, pids and values it contains, so that a range query can
+ * skip segments without reading their columns.
+ *
+ * Every writer owns its own segments, so appending takes no lock.
+ * Readers map the segment files themselves and only see readings whose
+ * count has been published by the writer.
+ *
+ */
+#ifndef SERIES_H_
+#define SERIES_H_
+
+#include <sys/types.h>
+
+#include "message_queue.h"
+
+#define SERIES_MAGIC 0x53455231     // "SER1"
+#define SERIES_SEGMENT_CAPACITY 65536
+#define SERIES_WINDOW_US 60000000LL // Wall clock time covered by a segment
+#define SERIES_PATH_MAX 256
+
+// First 64 bytes of a segment file. The columns follow it.
+struct series_header
+{
+    unsigned int magic;         // Written last, once the header is valid
+    unsigned int capacity;
+    unsigned int count;         // Readings written, published last
+    unsigned int reserved;
+    long long window_start;
+    long long min_timestamp;
+    long long max_timestamp;
+    pid_t min_pid;
+    pid_t max_pid;
+    int min_value;
+    int max_value;
+};
+
+struct series_segment
+{
+    struct series_header *header;
+    long long *timestamps;
+    pid_t *pids;
+    int *values;
+    size_t size;
+};
+
+// A writer's open segment
+struct series_store
+{
+    char directory[SERIES_PATH_MAX];
+    unsigned int id;            // Tells apart writers sharing a directory
+    unsigned int sequence;      // Segments opened so far
+    long long wall_offset;      // Wall clock minus monotonic time, in microseconds
+    long long window_end;
+    struct series_segment segment;
+};
+
+// Called for each reading found by a range query, in wall clock time
+typedef void (*series_visit)(void *context, const struct reading *reading);
+
+int series_open(struct series_store *store, const char *directory, unsigned int id);
+int series_append(struct series_store *store, pid_t pid, const struct reading *readings,
+        int count);
+void series_close(struct series_store *store);
+long long series_range(const char *directory, pid_t pid, long long from, long long to,
+        series_visit visit, void *context);
+
+#endif
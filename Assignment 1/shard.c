@@ -0,0 +1,222 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: shard.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the shard pool. A single mutex protects the
+ * inboxes and the busy flags. It is only held while a message is
+ * copied in or out, never while a message is being handled.
+ *
+ */
+#include "shard.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Copies only the used part of a message
+static void copy_message(struct message_struct *dst, const struct message_struct *src)
+{
+    memcpy((void *)dst, (const void *)src,
+            offsetof(struct message_struct, header) + MESSAGE_SIZE(src));
+}
+
+// Doubles the capacity of an inbox, keeping its messages in order
+static int grow_inbox(struct shard *shard)
+{
+    unsigned int new_capacity = shard->inbox_capacity * 2;
+    struct message_struct *new_inbox = malloc(new_capacity * sizeof(struct message_struct));
+    if (new_inbox == NULL)
+    {
+        return -1;
+    }
+
+    for (unsigned int i=0; i<shard->inbox_count; i++)
+    {
+        copy_message(&new_inbox[i],
+                &shard->inbox[(shard->inbox_head + i) % shard->inbox_capacity]);
+    }
+
+    free(shard->inbox);
+    shard->inbox = new_inbox;
+    shard->inbox_head = 0;
+    shard->inbox_capacity = new_capacity;
+
+    return 0;
+}
+
+// Returns a shard with pending messages that no worker is handling,
+// preferring the ones owned by the given worker
+static struct shard *find_work(struct shard_pool *pool, unsigned int worker)
+{
+    for (unsigned int i=worker; i<pool->shard_count; i+=pool->worker_count)
+    {
+        if (pool->shards[i].inbox_count > 0 && !pool->shards[i].busy)
+        {
+            return &pool->shards[i];
+        }
+    }
+
+    // Steal from a shard owned by another worker
+    for (unsigned int i=0; i<pool->shard_count; i++)
+    {
+        if (pool->shards[i].inbox_count > 0 && !pool->shards[i].busy)
+        {
+            return &pool->shards[i];
+        }
+    }
+
+    return NULL;
+}
+
+int shard_pool_init(struct shard_pool *pool, unsigned int worker_count,
+        unsigned int shards_per_worker, unsigned int inbox_capacity)
+{
+    pool->worker_count = worker_count;
+    pool->shard_count = worker_count * shards_per_worker;
+    pool->pending = 0;
+    pool->busy = 0;
+    pool->stopping = 0;
+
+    pool->shards = calloc(pool->shard_count, sizeof(struct shard));
+    if (pool->shards == NULL)
+    {
+        return -1;
+    }
+
+    for (unsigned int i=0; i<pool->shard_count; i++)
+    {
+        struct shard *shard = &pool->shards[i];
+        shard->registry = registry_create();
+        shard->inbox = malloc(inbox_capacity * sizeof(struct message_struct));
+        shard->inbox_capacity = inbox_capacity;
+        if (shard->registry == NULL || shard->inbox == NULL)
+        {
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->space_ready, NULL);
+
+    return 0;
+}
+
+// Returns the index of the shard that owns the device with this pid
+unsigned int shard_index(struct shard_pool *pool, pid_t pid)
+{
+    unsigned int h = (unsigned int)pid * 2654435769u;
+    return (h >> 16) % pool->shard_count;
+}
+
+// Queues a message for a shard. If the inbox is full, waits for space
+// when may_block is set and grows the inbox otherwise. Workers must
+// not block, since they may be the only ones able to drain the inbox.
+int shard_pool_push(struct shard_pool *pool, unsigned int index,
+        const struct message_struct *message, int may_block)
+{
+    struct shard *shard = &pool->shards[index];
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (shard->inbox_count == shard->inbox_capacity)
+    {
+        if (!may_block)
+        {
+            if (grow_inbox(shard) == -1)
+            {
+                pthread_mutex_unlock(&pool->lock);
+                return -1;
+            }
+            break;
+        }
+        pthread_cond_wait(&pool->space_ready, &pool->lock);
+    }
+
+    copy_message(&shard->inbox[(shard->inbox_head + shard->inbox_count) % shard->inbox_capacity],
+            message);
+    shard->inbox_count++;
+    pool->pending++;
+
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    return 0;
+}
+
+// Blocks until there is a message to handle and returns its shard,
+// which stays reserved for the caller until shard_pool_release().
+// Returns NULL once the pool is stopping, every inbox is empty and no
+// shard is being handled, since a handler may still queue messages for
+// other shards.
+struct shard *shard_pool_take(struct shard_pool *pool, unsigned int worker,
+        struct message_struct *message)
+{
+    struct shard *shard;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while ((shard = find_work(pool, worker)) == NULL)
+    {
+        if (pool->stopping && pool->pending == 0 && pool->busy == 0)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        pthread_cond_wait(&pool->work_ready, &pool->lock);
+    }
+
+    shard->busy = 1;
+    pool->busy++;
+    copy_message(message, &shard->inbox[shard->inbox_head]);
+    shard->inbox_head = (shard->inbox_head + 1) % shard->inbox_capacity;
+    shard->inbox_count--;
+    pool->pending--;
+
+    pthread_cond_broadcast(&pool->space_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    return shard;
+}
+
+void shard_pool_release(struct shard_pool *pool, struct shard *shard)
+{
+    pthread_mutex_lock(&pool->lock);
+    shard->busy = 0;
+    pool->busy--;
+
+    // Other workers may be waiting for this shard's remaining messages
+    // or for the last message to be handled before stopping
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Lets workers exit once all queued messages have been handled
+void shard_pool_stop(struct shard_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void shard_pool_destroy(struct shard_pool *pool)
+{
+    for (unsigned int i=0; i<pool->shard_count; i++)
+    {
+        if (pool->shards[i].registry != NULL)
+        {
+            registry_destroy(pool->shards[i].registry);
+        }
+        free(pool->shards[i].inbox);
+    }
+    free(pool->shards);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->space_ready);
+}
@@ -0,0 +1,63 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: shard.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Partitions the Controller's devices into shards by pid. Each shard
+ * owns a slice of the device table and an inbox of messages for its
+ * devices. Worker threads take messages from the inboxes of the
+ * shards they own first and steal from other shards when idle. A
+ * shard is only ever processed by one worker at a time, so messages
+ * for a device are handled in the order they were received.
+ *
+ */
+#ifndef SHARD_H_
+#define SHARD_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "message_queue.h"
+#include "registry.h"
+
+struct shard
+{
+    struct registry *registry;
+
+    struct message_struct *inbox;
+    unsigned int inbox_head;
+    unsigned int inbox_count;
+    unsigned int inbox_capacity;
+    int busy;
+};
+
+struct shard_pool
+{
+    struct shard *shards;
+    unsigned int shard_count;
+    unsigned int worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t space_ready;
+    unsigned int pending;
+    unsigned int busy;          // Shards reserved by a worker
+    int stopping;
+};
+
+int shard_pool_init(struct shard_pool *pool, unsigned int worker_count,
+        unsigned int shards_per_worker, unsigned int inbox_capacity);
+unsigned int shard_index(struct shard_pool *pool, pid_t pid);
+int shard_pool_push(struct shard_pool *pool, unsigned int index,
+        const struct message_struct *message, int may_block);
+struct shard *shard_pool_take(struct shard_pool *pool, unsigned int worker,
+        struct message_struct *message);
+void shard_pool_release(struct shard_pool *pool, struct shard *shard);
+void shard_pool_stop(struct shard_pool *pool);
+void shard_pool_destroy(struct shard_pool *pool);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: stats.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Recording and dumping of the Controller's latency histograms and
+ * counters. A dump is a single line of JSON with the counters and, for
+ * every stage, its number of samples, mean, percentiles, maximum and
+ * the non-empty buckets as [lower bound, count] pairs.
+ *
+ */
+#include "stats.h"
+#include "timestamp.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+struct stats *g_stats = NULL;
+__thread struct stats_slot *g_stats_own = NULL;
+__thread unsigned int g_stats_tick = 0;
+__thread int g_stats_timing = 0;
+
+static const char *g_stage_names[STATS_STAGE_COUNT] =
+{
+    "receive", "lookup", "threshold", "dispatch", "handoff", "fifo_write", "ack", "sensor_to_actuator",
+    "store", "aggregate", "rules", "reload", "adopt"
+};
+
+static const char *g_counter_names[STATS_COUNTER_COUNT] =
+{
+    "messages", "readings", "breaches", "commands", "acks", "updates", "forwarded", "cache_hits",
+    "rules_fired"
+};
+
+static unsigned int bucket_index(uint64_t value)
+{
+    if (value < STATS_SUB_BUCKETS)
+    {
+        return value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > STATS_MAX_EXPONENT)
+    {
+        return STATS_BUCKETS - 1;
+    }
+
+    int shift = exponent - STATS_SUB_BITS;
+    return (shift + 1) * STATS_SUB_BUCKETS + ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+// Returns the smallest value that falls in a bucket
+static uint64_t bucket_lower(unsigned int index)
+{
+    if (index < STATS_SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    unsigned int shift = index / STATS_SUB_BUCKETS - 1;
+    return (uint64_t)(STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS) << shift;
+}
+
+static size_t stats_size(unsigned int slot_count)
+{
+    return sizeof(struct stats) + slot_count * sizeof(struct stats_slot);
+}
+
+// Maps the tables before the fork, so both processes share them, with
+// a slot for every thread that records. A shared mapping of /dev/zero
+// is zero filled and needs no name. Returns -1 if they could not be
+// mapped.
+int stats_init(unsigned int slot_count)
+{
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    void *memory = mmap(NULL, stats_size(slot_count), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    g_stats = memory;
+    g_stats->started = timestamp_now();
+    g_stats->slot_count = slot_count;
+    return 0;
+}
+
+// Makes the calling thread record into a slot. Every thread must use a
+// different one.
+void stats_set_slot(unsigned int slot)
+{
+    if (g_stats != NULL && slot < g_stats->slot_count)
+    {
+        g_stats_own = &g_stats->slots[slot];
+    }
+}
+
+void stats_destroy(void)
+{
+    if (g_stats != NULL)
+    {
+        munmap(g_stats, stats_size(g_stats->slot_count));
+        g_stats = NULL;
+        g_stats_own = NULL;
+    }
+}
+
+// Returns the smallest bucket bound that at least the given fraction
+// of the values fall under
+static uint64_t percentile(const uint64_t *buckets, uint64_t count, double fraction)
+{
+    uint64_t target = (uint64_t)(count * fraction + 0.5);
+    uint64_t seen = 0;
+
+    for (unsigned int i=0; i<STATS_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= target && seen > 0)
+        {
+            return i + 1 < STATS_BUCKETS ? bucket_lower(i + 1) - 1 : bucket_lower(i);
+        }
+    }
+
+    return 0;
+}
+
+void stats_record(int stage, uint64_t ns)
+{
+    stats_histogram_add(&g_stats_own->stages[stage], ns);
+}
+
+// Adds a value to a histogram only the calling thread writes
+void stats_histogram_add(struct stats_histogram *h, uint64_t value)
+{
+    stats_add(&h->buckets[bucket_index(value)], 1);
+    stats_add(&h->count, 1);
+    stats_add(&h->sum, value);
+    if (value > h->max)
+    {
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t stats_histogram_percentile(const struct stats_histogram *h, double fraction)
+{
+    // A bucket's upper edge can lie past the largest value recorded
+    uint64_t value = percentile(h->buckets, h->count, fraction);
+    return value < h->max ? value : h->max;
+}
+
+// Prints a one line summary of a histogram of nanoseconds in
+// microseconds
+void stats_histogram_print(FILE *out, const char *name, const struct stats_histogram *h)
+{
+    if (h->count == 0)
+    {
+        fprintf(out, "%s: no samples\n", name);
+        return;
+    }
+
+    fprintf(out, "%s: p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus over %llu\n", name,
+            stats_histogram_percentile(h, 0.5) / 1000.0, stats_histogram_percentile(h, 0.99) / 1000.0,
+            stats_histogram_percentile(h, 0.999) / 1000.0, h->max / 1000.0,
+            (unsigned long long)h->count);
+}
+
+// Writes all slots summed into one line of JSON. Counts are read while
+// other threads may be recording, so a dump may be slightly behind.
+void stats_dump(FILE *out)
+{
+    static uint64_t buckets[STATS_BUCKETS];
+
+    if (g_stats == NULL)
+    {
+        return;
+    }
+
+    fprintf(out, "{\"uptime_us\":%lld,\"sample_every\":%d,\"counters\":{",
+            timestamp_now() - g_stats->started, STATS_SAMPLE_EVERY);
+    for (int c=0; c<STATS_COUNTER_COUNT; c++)
+    {
+        uint64_t total = 0;
+        for (unsigned int s=0; s<g_stats->slot_count; s++)
+        {
+            total += __atomic_load_n(&g_stats->slots[s].counters[c], __ATOMIC_RELAXED);
+        }
+        fprintf(out, "%s\"%s\":%llu", c ? "," : "", g_counter_names[c], (unsigned long long)total);
+    }
+
+    fprintf(out, "},\"stages\":{");
+    for (int stage=0; stage<STATS_STAGE_COUNT; stage++)
+    {
+        uint64_t count = 0, sum = 0, max = 0;
+
+        for (unsigned int i=0; i<STATS_BUCKETS; i++)
+        {
+            buckets[i] = 0;
+        }
+        for (unsigned int s=0; s<g_stats->slot_count; s++)
+        {
+            struct stats_histogram *h = &g_stats->slots[s].stages[stage];
+            for (unsigned int i=0; i<STATS_BUCKETS; i++)
+            {
+                buckets[i] += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+            }
+            sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+            uint64_t slot_max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+            max = slot_max > max ? slot_max : max;
+        }
+        for (unsigned int i=0; i<STATS_BUCKETS; i++)
+        {
+            count += buckets[i];
+        }
+
+        fprintf(out, "%s\"%s\":{\"samples\":%llu,\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+                "\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu,\"buckets\":[",
+                stage ? "," : "", g_stage_names[stage], (unsigned long long)count,
+                (unsigned long long)(count ? sum / count : 0),
+                (unsigned long long)percentile(buckets, count, 0.5),
+                (unsigned long long)percentile(buckets, count, 0.9),
+                (unsigned long long)percentile(buckets, count, 0.99),
+                (unsigned long long)percentile(buckets, count, 0.999),
+                (unsigned long long)max);
+
+        int first = 1;
+        for (unsigned int i=0; i<STATS_BUCKETS; i++)
+        {
+            if (buckets[i] > 0)
+            {
+                fprintf(out, "%s[%llu,%llu]", first ? "" : ",",
+                        (unsigned long long)bucket_lower(i), (unsigned long long)buckets[i]);
+                first = 0;
+            }
+        }
+        fprintf(out, "]}");
+    }
+
+    fprintf(out, "}}\n");
+    fflush(out);
+}
@@ -0,0 +1,171 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: stats.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Latency histograms and counters for the Controller's hot path. They
+ * live in shared memory mapped before the fork, so the parent and the
+ * child record into the same tables and the parent can dump both.
+ * Each thread has a slot of its own that only it writes, so recording
+ * takes no locks or atomic read-modify-writes, and threads do not
+ * share cache lines.
+ *
+ * Counters count every event. Reading the clock costs about as much as
+ * checking a reading, so the stages every message goes through are
+ * only timed for one message in STATS_SAMPLE_EVERY. Stages that send
+ * a message cost far more than the clock and are always timed.
+ *
+ * Histograms are log-linear: every power of two is split into
+ * STATS_SUB_BUCKETS buckets, so a recorded value is off by at most
+ * 1/STATS_SUB_BUCKETS.
+ *
+ * A histogram can also be used on its own, as the Actuator and the
+ * Cloud do to summarize the latencies carried in messages.
+ *
+ */
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXPONENT 40   // Values up to about 18 minutes in ns
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 2) * STATS_SUB_BUCKETS)
+
+#define STATS_SAMPLE_EVERY 64
+
+// Slot 0 is the parent, 1 the child's receiving thread and the rest
+// its workers
+#define STATS_SLOT_PARENT 0
+#define STATS_SLOT_CHILD 1
+
+// Stages timed, in nanoseconds
+enum stats_stage
+{
+    STATS_RECEIVE,      // Sensor sending a batch to the child receiving it
+    STATS_LOOKUP,       // Finding the sender in the registry
+    STATS_THRESHOLD,    // Checking a batch against the threshold
+    STATS_DISPATCH,     // Sending commands to the routed Actuators
+    STATS_HANDOFF,      // Queuing an update for the parent
+    STATS_FIFO_WRITE,   // Parent writing an update to the Cloud
+    STATS_ACK,          // Command sent to ack received
+    STATS_SENSOR_TO_ACTUATOR, // Reading taken to command executed
+    STATS_STORE,        // Appending a batch to the reading store
+    STATS_AGGREGATE,    // Adding a batch to the Sensor's aggregates
+    STATS_RULES,        // Checking a batch against the Sensor's rules
+    STATS_RELOAD,       // Loading the rules file and handing it to the shards
+    STATS_ADOPT,        // A shard switching its Sensors to reloaded rules
+    STATS_STAGE_COUNT
+};
+
+enum stats_counter
+{
+    STATS_MESSAGES,
+    STATS_READINGS,
+    STATS_BREACHES,
+    STATS_COMMANDS,
+    STATS_ACKS,
+    STATS_UPDATES,
+    STATS_FORWARDED,
+    STATS_CACHE_HITS,
+    STATS_RULES_FIRED,
+    STATS_COUNTER_COUNT
+};
+
+struct stats_histogram
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];
+};
+
+struct stats_slot
+{
+    struct stats_histogram stages[STATS_STAGE_COUNT];
+    uint64_t counters[STATS_COUNTER_COUNT];
+} __attribute__((aligned(64)));
+
+struct stats
+{
+    long long started;
+    unsigned int slot_count;
+    struct stats_slot slots[];
+};
+
+// NULL until stats_init() is called, in which case nothing is recorded
+extern struct stats *g_stats;
+extern __thread struct stats_slot *g_stats_own;
+extern __thread unsigned int g_stats_tick;
+extern __thread int g_stats_timing;
+
+int stats_init(unsigned int slot_count);
+void stats_set_slot(unsigned int slot);
+void stats_destroy(void);
+void stats_record(int stage, uint64_t ns);
+void stats_dump(FILE *out);
+
+void stats_histogram_add(struct stats_histogram *h, uint64_t value);
+uint64_t stats_histogram_percentile(const struct stats_histogram *h, double fraction);
+void stats_histogram_print(FILE *out, const char *name, const struct stats_histogram *h);
+
+// Only this thread writes its slot, so plain increments are enough.
+// The relaxed store keeps a concurrent dump from seeing a torn value.
+static inline void stats_add(uint64_t *value, uint64_t n)
+{
+    __atomic_store_n(value, *value + n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_count(int counter, uint64_t n)
+{
+    if (g_stats_own != NULL)
+    {
+        stats_add(&g_stats_own->counters[counter], n);
+    }
+}
+
+// Called once per message handled. Decides whether the stages of this
+// message are timed.
+static inline void stats_next_message(void)
+{
+    g_stats_timing = g_stats_own != NULL && g_stats_tick++ % STATS_SAMPLE_EVERY == 0;
+}
+
+// Returns the current monotonic time in nanoseconds, or 0 if stats
+// are disabled
+static inline uint64_t stats_clock(void)
+{
+    struct timespec ts;
+
+    if (g_stats_own == NULL)
+    {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Same as stats_clock(), but returns 0 if this message is not timed,
+// so that callers skip reading the clock
+static inline uint64_t stats_start(void)
+{
+    return g_stats_timing ? stats_clock() : 0;
+}
+
+// Records the time since stats_start() or stats_clock() against a stage
+static inline void stats_stop(int stage, uint64_t start)
+{
+    if (start != 0)
+    {
+        stats_record(stage, stats_clock() - start);
+    }
+}
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: threshold.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Scalar, SSE2 and AVX2 versions of the threshold check. The vector
+ * versions are compiled with target attributes, so the rest of the
+ * program does not need to be built for a particular CPU. The best
+ * version the CPU supports is picked on first use.
+ *
+ */
+#include "threshold.h"
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define THRESHOLD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef uint64_t (*threshold_fn)(const int *values, int count, int threshold);
+
+static uint64_t mask_scalar(const int *values, int count, int threshold)
+{
+    uint64_t mask = 0;
+
+    for (int i=0; i<count; i++)
+    {
+        mask |= (uint64_t)(values[i] >= threshold) << i;
+    }
+
+    return mask;
+}
+
+#ifdef THRESHOLD_X86
+// Turns the mask of the first done values that are below the threshold
+// into a mask of those that reach it, and checks the remaining values
+static uint64_t finish_mask(uint64_t below, const int *values, int done, int count,
+        int threshold)
+{
+    if (done == THRESHOLD_BLOCK)
+    {
+        return ~below;
+    }
+
+    uint64_t mask = ~below & ((1ULL << done) - 1);
+    return mask | (mask_scalar(values + done, count - done, threshold) << done);
+}
+
+// Lanes where the threshold is greater than the reading are the ones
+// that did not reach it, so the movemask result is inverted
+__attribute__((target("sse2")))
+static uint64_t mask_sse2(const int *values, int count, int threshold)
+{
+    __m128i limit = _mm_set1_epi32(threshold);
+    uint64_t below = 0;
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        __m128i lt = _mm_cmpgt_epi32(limit, v);
+        below |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(lt)) << i;
+    }
+
+    return finish_mask(below, values, i, count, threshold);
+}
+
+__attribute__((target("avx2")))
+static uint64_t mask_avx2(const int *values, int count, int threshold)
+{
+    __m256i limit = _mm256_set1_epi32(threshold);
+    uint64_t below = 0;
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+        __m256i lt = _mm256_cmpgt_epi32(limit, v);
+        below |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(lt)) << i;
+    }
+
+    return finish_mask(below, values, i, count, threshold);
+}
+#endif
+
+static threshold_fn g_kernel_fn = NULL;
+static int g_kernel = -1;
+
+// Uses the given version of the check. Returns -1 if the CPU does not
+// support it.
+int threshold_select(int kernel)
+{
+    threshold_fn fn = NULL;
+
+    switch (kernel)
+    {
+    case THRESHOLD_KERNEL_SCALAR:
+        fn = mask_scalar;
+        break;
+#ifdef THRESHOLD_X86
+    case THRESHOLD_KERNEL_SSE2:
+        if (__builtin_cpu_supports("sse2"))
+        {
+            fn = mask_sse2;
+        }
+        break;
+    case THRESHOLD_KERNEL_AVX2:
+        if (__builtin_cpu_supports("avx2"))
+        {
+            fn = mask_avx2;
+        }
+        break;
+#endif
+    }
+
+    if (fn == NULL)
+    {
+        return -1;
+    }
+
+    g_kernel_fn = fn;
+    g_kernel = kernel;
+    return 0;
+}
+
+// Returns the version of the check in use, picking the best one the
+// CPU supports if none was selected
+int threshold_kernel(void)
+{
+    if (g_kernel == -1)
+    {
+        if (threshold_select(THRESHOLD_KERNEL_AVX2) == -1
+                && threshold_select(THRESHOLD_KERNEL_SSE2) == -1)
+        {
+            threshold_select(THRESHOLD_KERNEL_SCALAR);
+        }
+    }
+
+    return g_kernel;
+}
+
+const char *threshold_kernel_name(int kernel)
+{
+    switch (kernel)
+    {
+    case THRESHOLD_KERNEL_SSE2:
+        return "sse2";
+    case THRESHOLD_KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+// Returns a mask with bit i set if values[i] is at least the threshold.
+// At most THRESHOLD_BLOCK values are checked.
+uint64_t threshold_mask(const int *values, int count, int threshold)
+{
+    if (g_kernel_fn == NULL)
+    {
+        threshold_kernel();
+    }
+
+    if (count > THRESHOLD_BLOCK)
+    {
+        count = THRESHOLD_BLOCK;
+    }
+
+    return g_kernel_fn(values, count, threshold);
+}
@@ -0,0 +1,33 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: threshold.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Checks a column of Sensor readings against a threshold and returns
+ * a mask of the readings that reach it. The check runs with AVX2 or
+ * SSE2 when the CPU supports them and falls back to a scalar loop
+ * otherwise.
+ *
+ */
+#ifndef THRESHOLD_H_
+#define THRESHOLD_H_
+
+#include <stdint.h>
+
+// Readings checked by one call, one bit of the mask each
+#define THRESHOLD_BLOCK 64
+
+#define THRESHOLD_KERNEL_SCALAR 0
+#define THRESHOLD_KERNEL_SSE2 1
+#define THRESHOLD_KERNEL_AVX2 2
+
+int threshold_select(int kernel);
+int threshold_kernel(void);
+const char *threshold_kernel_name(int kernel);
+uint64_t threshold_mask(const int *values, int count, int threshold);
+
+#endif
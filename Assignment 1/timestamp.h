@@ -0,0 +1,28 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: timestamp.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Monotonic timestamps shared by all processes. CLOCK_MONOTONIC is
+ * system wide, so timestamps taken in different processes on the same
+ * machine can be compared directly.
+ *
+ */
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+#include <time.h>
+
+// Returns the current monotonic time in microseconds
+static inline long long timestamp_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+#endif
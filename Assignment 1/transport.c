@@ -0,0 +1,315 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: transport.c
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Implementation of the message queue and shared memory transports.
+ *
+ * The shared memory ring is a bounded multi-producer single-consumer
+ * queue. A producer claims a cell by atomically incrementing the
+ * enqueue position, copies its message in and publishes the cell by
+ * storing its position + 1 in the cell's sequence. Two process shared
+ * semaphores count free cells and published messages, so producers
+ * block while the ring is full and the Controller blocks while it is
+ * empty. Neither semaphore enters the kernel unless someone has to
+ * sleep.
+ *
+ * A producer that dies between claiming and publishing a cell stalls
+ * the ring, since the consumer waits for cells in order.
+ *
+ */
+#include "transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/msg.h>
+#include <sys/stat.h>
+
+#define SHM_RING_MAGIC 0x52494e47
+
+struct ring_cell
+{
+    unsigned long sequence;
+    struct message_struct message;
+};
+
+struct shm_ring
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long mask;
+    sem_t free_cells;
+    sem_t used_cells;
+
+    // Producers and the consumer update these from different cores, so
+    // keep them on separate cache lines
+    unsigned long enqueue_position __attribute__((aligned(64)));
+    unsigned long dequeue_position __attribute__((aligned(64)));
+
+    struct ring_cell cells[] __attribute__((aligned(64)));
+};
+
+static size_t ring_size(void)
+{
+    return sizeof(struct shm_ring) + SHM_RING_CELLS * sizeof(struct ring_cell);
+}
+
+static struct shm_ring *ring_create(const char *name)
+{
+    // Start from an empty ring even if a previous Controller crashed
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (ftruncate(fd, ring_size()) == -1)
+    {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    struct shm_ring *ring = mmap(NULL, ring_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ring->mask = SHM_RING_CELLS - 1;
+    ring->enqueue_position = 0;
+    ring->dequeue_position = 0;
+    for (unsigned long i=0; i<SHM_RING_CELLS; i++)
+    {
+        ring->cells[i].sequence = i;
+    }
+    if (sem_init(&ring->free_cells, 1, SHM_RING_CELLS) == -1
+            || sem_init(&ring->used_cells, 1, 0) == -1)
+    {
+        munmap(ring, ring_size());
+        shm_unlink(name);
+        return NULL;
+    }
+    ring->version = MESSAGE_VERSION;
+
+    // Devices check the magic number last, once the ring is usable
+    __atomic_store_n(&ring->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    return ring;
+}
+
+static struct shm_ring *ring_attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct shm_ring *ring = mmap(NULL, ring_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if (__atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC
+            || ring->version != MESSAGE_VERSION)
+    {
+        munmap(ring, ring_size());
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return ring;
+}
+
+// A signal ends the wait for a free cell with EINTR, as it does msgsnd,
+// so that a device blocked on a full ring can still be stopped
+static int ring_push(struct shm_ring *ring, const struct message_struct *message, int flags)
+{
+    if (((flags & IPC_NOWAIT) ? sem_trywait(&ring->free_cells) : sem_wait(&ring->free_cells)) == -1)
+    {
+        return -1;
+    }
+
+    unsigned long position = __atomic_fetch_add(&ring->enqueue_position, 1, __ATOMIC_RELAXED);
+    struct ring_cell *cell = &ring->cells[position & ring->mask];
+
+    memcpy((void *)&cell->message, (const void *)message,
+            offsetof(struct message_struct, header) + MESSAGE_SIZE(message));
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+
+    return sem_post(&ring->used_cells);
+}
+
+static int ring_pop(struct shm_ring *ring, struct message_struct *message, int flags)
+{
+    int result = (flags & IPC_NOWAIT) ? sem_trywait(&ring->used_cells) : sem_wait(&ring->used_cells);
+    if (result == -1)
+    {
+        if (errno == EAGAIN)
+        {
+            errno = ENOMSG;
+        }
+        return -1;
+    }
+
+    unsigned long position = ring->dequeue_position;
+    struct ring_cell *cell = &ring->cells[position & ring->mask];
+
+    // A message published behind this cell may have been counted
+    // before this cell's producer finished copying
+    while (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != position + 1)
+    {
+        sched_yield();
+    }
+
+    // Any process can write the ring, so the length is read once, from
+    // the copied header, and checked before the payload is copied
+    memcpy((void *)message, (const void *)&cell->message, offsetof(struct message_struct, payload));
+    size_t size = MESSAGE_SIZE(message);
+    if (size <= MAX_MESSAGE_SIZE)
+    {
+        memcpy((void *)&message->payload, (const void *)&cell->message.payload,
+                message->header.length);
+    }
+    __atomic_store_n(&cell->sequence, position + SHM_RING_CELLS, __ATOMIC_RELEASE);
+    ring->dequeue_position = position + 1;
+
+    if (sem_post(&ring->free_cells) == -1)
+    {
+        return -1;
+    }
+
+    return message_validate(message, size);
+}
+
+// Returns the transport named on the command line, or -1
+int transport_parse(const char *name)
+{
+    if (strcmp(name, "msgqueue") == 0)
+    {
+        return TRANSPORT_MSGQUEUE;
+    }
+    if (strcmp(name, "shm") == 0)
+    {
+        return TRANSPORT_SHM;
+    }
+
+    return -1;
+}
+
+// Opens the message queue and, for the shared memory transport, the
+// ring. The Controller creates the ring and devices attach to it.
+int transport_open(struct transport *t, int kind, key_t key, const char *shm_name, int create)
+{
+    t->kind = kind;
+    t->ring = NULL;
+    t->shm_name = shm_name;
+
+    t->msgid = msgget(key, 0666 | IPC_CREAT);
+    if (t->msgid == -1)
+    {
+        return -1;
+    }
+
+    if (kind == TRANSPORT_SHM)
+    {
+        t->ring = create ? ring_create(shm_name) : ring_attach(shm_name);
+        if (t->ring == NULL)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Sends a message. Messages to the Controller use the ring if there is
+// one, everything else goes through the message queue. Either way, a
+// signal interrupts a wait for room with EINTR.
+int transport_send(struct transport *t, const struct message_struct *message)
+{
+    if (t->ring != NULL && message->type == TO_CONTROLLER)
+    {
+        return ring_push(t->ring, message, 0);
+    }
+
+    return message_send(t->msgid, message);
+}
+
+// Like transport_send(), but fails with EAGAIN instead of blocking
+// when the queue or ring is full
+int transport_try_send(struct transport *t, const struct message_struct *message)
+{
+    if (t->ring != NULL && message->type == TO_CONTROLLER)
+    {
+        return ring_push(t->ring, message, IPC_NOWAIT);
+    }
+
+    return msgsnd(t->msgid, (const void *)message, MESSAGE_SIZE(message), IPC_NOWAIT);
+}
+
+// Receives a message of the given type, with the same semantics as
+// message_receive()
+int transport_receive(struct transport *t, struct message_struct *message, long type, int flags)
+{
+    if (t->ring != NULL && type == TO_CONTROLLER)
+    {
+        return ring_pop(t->ring, message, flags);
+    }
+
+    return message_receive(t->msgid, message, type, flags);
+}
+
+// Returns how many messages are waiting for the Controller, or -1
+int transport_backlog(struct transport *t)
+{
+    if (t->ring != NULL)
+    {
+        unsigned long enqueued = __atomic_load_n(&t->ring->enqueue_position, __ATOMIC_RELAXED);
+        unsigned long dequeued = __atomic_load_n(&t->ring->dequeue_position, __ATOMIC_RELAXED);
+        return enqueued > dequeued ? (int)(enqueued - dequeued) : 0;
+    }
+
+    struct msqid_ds info;
+    if (msgctl(t->msgid, IPC_STAT, &info) == -1)
+    {
+        return -1;
+    }
+
+    return (int)info.msg_qnum;
+}
+
+void transport_close(struct transport *t, int destroy)
+{
+    if (t->ring != NULL)
+    {
+        if (destroy)
+        {
+            sem_destroy(&t->ring->free_cells);
+            sem_destroy(&t->ring->used_cells);
+        }
+        munmap(t->ring, ring_size());
+        t->ring = NULL;
+        if (destroy)
+        {
+            shm_unlink(t->shm_name);
+        }
+    }
+}
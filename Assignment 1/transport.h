@@ -0,0 +1,50 @@
+/*
+ * SYSC 4001 Assignment 1
+ *
+ * File: transport.h
+ * Author: Brandon To
+ * Student #: 100874049
+ * Created: October 17, 2026
+ *
+ * Description:
+ * Selects how messages addressed to the Controller are delivered.
+ * By default they go through the shared message queue. Alternatively
+ * they can be placed in a ring buffer in POSIX shared memory, which
+ * needs no system call or kernel copy per message unless the
+ * Controller is asleep waiting for work. Messages addressed to
+ * devices and to the Controller's parent always use the message
+ * queue.
+ *
+ */
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <sys/types.h>
+
+#include "message_queue.h"
+
+#define TRANSPORT_MSGQUEUE 0
+#define TRANSPORT_SHM 1
+
+#define SHM_RING_NAME "/sysc4001_ring"
+#define SHM_RING_CELLS 1024
+
+struct shm_ring;
+
+struct transport
+{
+    int kind;
+    int msgid;
+    struct shm_ring *ring;
+    const char *shm_name;
+};
+
+int transport_parse(const char *name);
+int transport_open(struct transport *t, int kind, key_t key, const char *shm_name, int create);
+int transport_send(struct transport *t, const struct message_struct *message);
+int transport_try_send(struct transport *t, const struct message_struct *message);
+int transport_receive(struct transport *t, struct message_struct *message, long type, int flags);
+int transport_backlog(struct transport *t);
+void transport_close(struct transport *t, int destroy);
+
+#endif